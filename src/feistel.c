@@ -0,0 +1,75 @@
+/*************************************************************************
+  > File Name: feistel.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 02:05:36 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "feistel.h"
+
+inline static uint64_t feistel_mix(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+inline static uint64_t feistel_round(feistel_t *f, int i, uint64_t r)
+{
+  return feistel_mix(r ^ f->keys[i]) & f->half_mask;
+}
+int feistel_init(feistel_t *f, int bits, const char *key, size_t key_len)
+{
+  if (f == NULL || key == NULL || bits < 2 || bits > 64 || bits % 2 != 0)
+  {
+    return -1;
+  }
+  memset(f, 0, sizeof(*f));
+  f->bits = bits;
+  f->half_mask = bits == 64 ? UINT32_MAX : (1ULL << (bits / 2)) - 1;
+
+  // fnv1a over the key seeds the round keys
+  uint64_t seed = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i < key_len; i++)
+  {
+    seed ^= (unsigned char)key[i];
+    seed *= 0x100000001b3ULL;
+  }
+  int j = 0;
+  for (; j < FEISTEL_ROUNDS; j++)
+  {
+    seed += 0x9e3779b97f4a7c15ULL;
+    f->keys[j] = feistel_mix(seed);
+  }
+  return 0;
+}
+uint64_t feistel_encrypt(feistel_t *f, uint64_t x)
+{
+  int half = f->bits / 2;
+  uint64_t l = (x >> half) & f->half_mask;
+  uint64_t r = x & f->half_mask;
+  int i = 0;
+  for (; i < FEISTEL_ROUNDS; i++)
+  {
+    uint64_t t = l ^ feistel_round(f, i, r);
+    l = r;
+    r = t;
+  }
+  return (l << half) | r;
+}
+uint64_t feistel_decrypt(feistel_t *f, uint64_t x)
+{
+  int half = f->bits / 2;
+  uint64_t l = (x >> half) & f->half_mask;
+  uint64_t r = x & f->half_mask;
+  int i = FEISTEL_ROUNDS - 1;
+  for (; i >= 0; i--)
+  {
+    uint64_t t = r ^ feistel_round(f, i, l);
+    r = l;
+    l = t;
+  }
+  return (l << half) | r;
+}
@@ -0,0 +1,27 @@
+/*************************************************************************
+  > File Name: feistel.h
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 02:05:31 PM UTC
+ ************************************************************************/
+
+#ifndef _FEISTEL_H
+#define _FEISTEL_H
+#include <stdint.h>
+#include <stdio.h>
+
+#define FEISTEL_ROUNDS 8
+
+// keyed bijection over [0, 2^bits), bits is even and at most 64. feeding it
+// a counter gives ids that look random but never repeat
+typedef struct
+{
+  int bits;
+  uint64_t half_mask;
+  uint64_t keys[FEISTEL_ROUNDS];
+} feistel_t;
+
+int feistel_init(feistel_t *f, int bits, const char *key, size_t key_len);
+uint64_t feistel_encrypt(feistel_t *f, uint64_t x);
+uint64_t feistel_decrypt(feistel_t *f, uint64_t x);
+#endif
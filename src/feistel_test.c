@@ -0,0 +1,53 @@
+/*************************************************************************
+  > File Name: feistel_test.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 02:31:10 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "feistel.h"
+
+int main(int argc, char *argv[])
+{
+  feistel_t f;
+  assert(feistel_init(&f, 31, "k", 1) == -1);
+
+  // a small domain is checked exhaustively: every output shows up once
+  assert(feistel_init(&f, 16, "secret", 6) == 0);
+  char *seen = calloc(1, 1 << 16);
+  uint64_t x = 0;
+  for (; x < (1 << 16); x++)
+  {
+    uint64_t y = feistel_encrypt(&f, x);
+    assert(y < (1 << 16));
+    assert(seen[y] == 0);
+    seen[y] = 1;
+    assert(feistel_decrypt(&f, y) == x);
+  }
+  free(seen);
+
+  // consecutive counters don't give consecutive ids
+  int bits[] = {32, 64};
+  int i = 0;
+  for (; i < 2; i++)
+  {
+    assert(feistel_init(&f, bits[i], "secret", 6) == 0);
+    for (x = 0; x < 1000; x++)
+    {
+      uint64_t y = feistel_encrypt(&f, x);
+      assert(bits[i] == 64 || y <= UINT32_MAX);
+      assert(feistel_encrypt(&f, x + 1) != y + 1);
+      assert(feistel_decrypt(&f, y) == x);
+    }
+  }
+
+  // another key, another permutation
+  feistel_t g;
+  assert(feistel_init(&g, 64, "other", 5) == 0);
+  assert(feistel_encrypt(&f, 42) != feistel_encrypt(&g, 42));
+  fprintf(stdout, "feistel test succ\n");
+  return 0;
+}
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "kv_db.h"
 #include "hashfn.h"
 const char *schema_format = "key_format=u,value_format=u";
@@ -20,6 +21,30 @@ inline static void wt_item_init(WT_ITEM *item, void *data, size_t size)
   item->data = data;
   item->size = size;
 }
+inline static int kv_session_put(WT_CURSOR *cursor, void *key, size_t key_sz, void *val, size_t val_sz)
+{
+  WT_ITEM key_item, value_item;
+  wt_item_init(&key_item, key, key_sz);
+  wt_item_init(&value_item, val, val_sz);
+  cursor->set_key(cursor, &key_item);
+  cursor->set_value(cursor, &value_item);
+  return cursor->insert(cursor);
+}
+// a thread with a session of its own exits
+static void kv_session_release(void *ptr)
+{
+  kv_session_t *s = (kv_session_t *)ptr;
+  kv_db_t *db = (kv_db_t *)s->ctx;
+  kv_session_t **cur = &db->sessions;
+  pthread_mutex_lock(&db->session_lock);
+  while (*cur != s)
+  {
+    cur = &(*cur)->next;
+  }
+  *cur = s->next;
+  pthread_mutex_unlock(&db->session_lock);
+  kv_session_destroy(s);
+}
 
 kv_schema_t *kv_schema_alloc(const char *schema_name, void *ctx, bool is_force_drop)
 {
@@ -38,9 +63,10 @@ kv_schema_t *kv_schema_alloc(const char *schema_name, void *ctx, bool is_force_d
     assert(schema->session->drop(schema->session, &schema_buf, schema_format) != -1);
   }
   assert(schema->session->create(schema->session, &schema_buf, schema_format) != -1);
-  assert(schema->session->open_cursor(schema->session, &schema_buf, NULL, "overwrite=false", &schema->cursor) != -1);
+  schema->id = __sync_fetch_and_add(&db->schema_count, 1);
+  assert(schema->id < SCHEMA_LIMIT);
   strncpy((char *)&schema->schema_name, schema_name, schema_sz);
-  schema->schema_name[schema_sz] = '\0';
+  ((char *)&schema->schema_name)[schema_sz] = '\0';
   schema->ctx = ctx;
   schema->schema_format = strdup(schema_buf);
   fprintf(stdout, "create schema %s succ\n", (char *)&schema->schema_name);
@@ -50,59 +76,15 @@ void kv_schema_destroy(kv_schema_t *schema)
 {
   if (schema != NULL)
   {
-    kv_db_t *db = (kv_db_t *)schema->ctx;
-    schema->cursor->close(schema->cursor);
-    schema->session->drop(schema->session, &schema->schema_name, schema->schema_format);
+    // only the handle goes, the table and its data stay for the next
+    // kv_schema_alloc. is_force_drop is how a table is dropped
     schema->session->close(schema->session, NULL);
+    free(schema->schema_format);
     free(schema);
     schema = NULL;
   }
 }
 
-void *kv_db_fetch_top_index(kv_schema_t *schema, uint32_t index)
-{
-  kv_t *kv_pair = NULL;
-  WT_CURSOR *cursor = schema->cursor;
-  assert(session->open_cursor(session, schema_format, NULL, NULL, &cursor));
-  uint32_t tmp_index = 0;
-  while ((ret = cursor->next(cursor)) == 0)
-  {
-
-    tmp_index++;
-    if (tmp_index == indnex - 1)
-    {
-      kv_pair = calloc(1, sizeof(kv_t));
-      WT_ITEM *key_item = NULL;
-      WT_ITEM *val_item = NULL;
-      cursor->get_key(cursor, &key_item);
-      cursor->get_value(cursor, &val_item);
-      kv_pair->key = key_item->data;
-      key_pair->val = val_item->data;
-      break;
-    }
-    cursor->update(cursor);
-  }
-  return kv_pair;
-}
-int kv_db_fetch_all(kv_schema_t *schema, kv_func_cb cb)
-{
-  WT_CURSOR *cursor = schema->cursor;
-  assert(session->open_cursor(session, schema_format, NULL, NULL, &cursor));
-  uint32_t tmp_index = 0;
-  while ((ret = cursor->next(cursor)) == 0)
-  {
-    WT_ITEM *key_item = NULL;
-    WT_ITEM *val_item = NULL;
-    cursor->get_key(cursor, &key_item);
-    cursor->get_value(cursor, &val_item);
-    if (cb != NULL)
-    {
-      cb(key_item->data, val_item->data);
-    }
-    cursor->update(cursor);
-  }
-  return 0;
-}
 kv_db_t *kv_db_alloc(const char *database_name, const char *database_dir)
 {
   if (database_name != NULL && database_dir != NULL)
@@ -118,11 +100,14 @@ kv_db_t *kv_db_alloc(const char *database_name, const char *database_dir)
 
     kv_db_t *db = calloc(1, sizeof(kv_db_t));
     assert(db != NULL);
-    assert(wiredtiger_open(&base_path, NULL, "create", &db->conn) != -1);
+    // commits are only durable with the log on
+    assert(wiredtiger_open(&base_path, NULL, "create,log=(enabled=true)", &db->conn) != -1);
 
     db->database_name = strdup(database_name);
     db->database_dir = strdup(database_dir);
     db->schema_ctx = dict_create(SCHEMA_LIMIT, hash_fnv1_64);
+    pthread_mutex_init(&db->session_lock, NULL);
+    assert(pthread_key_create(&db->session_key, kv_session_release) == 0);
     return db;
   }
   return NULL;
@@ -130,18 +115,22 @@ kv_db_t *kv_db_alloc(const char *database_name, const char *database_dir)
 int kv_db_set(kv_schema_t *schema, void *key, size_t key_sz, void *val, size_t val_sz)
 {
 
-  WT_CURSOR *cursor = schema->cursor;
-  WT_ITEM key_item, value_item;
-  wt_item_init(&key_item, key, key_sz);
-  wt_item_init(&value_item, val, val_sz);
-  cursor->set_key(cursor, &key_item);
-  cursor->set_value(cursor, &value_item);
-  return cursor->insert(cursor);
+  WT_CURSOR *cursor = kv_session_cursor(kv_db_session(schema->ctx), schema);
+  if (cursor == NULL)
+  {
+    return -1;
+  }
+  return kv_session_put(cursor, key, key_sz, val, val_sz);
 }
+// the value stays valid until this thread's next call on the schema
 void *kv_db_get(kv_schema_t *schema, void *key, size_t key_sz)
 {
-  WT_CURSOR *cursor = schema->cursor;
+  WT_CURSOR *cursor = kv_session_cursor(kv_db_session(schema->ctx), schema);
   WT_ITEM key_item, value_item;
+  if (cursor == NULL)
+  {
+    return NULL;
+  }
   wt_item_init(&key_item, key, key_sz);
   cursor->set_key(cursor, &key_item);
   if (cursor->search(cursor) != 0)
@@ -151,29 +140,162 @@ void *kv_db_get(kv_schema_t *schema, void *key, size_t key_sz)
   cursor->get_value(cursor, &value_item);
   return value_item.data;
 }
-int kv_db_del(kv_db_t *db, char *schema_name, void *key, size_t key_sz)
+int kv_db_del(kv_schema_t *schema, void *key, size_t key_sz)
 {
-  kv_schema_t *schema = (kv_schema_t *)dict_get(db->schema_ctx, schema_name);
-  WT_CURSOR *cursor = schema->cursor;
-  WT_ITEM key_item, value_item;
+  WT_CURSOR *cursor = kv_session_cursor(kv_db_session(schema->ctx), schema);
+  WT_ITEM key_item;
+  if (cursor == NULL)
+  {
+    return -1;
+  }
   wt_item_init(&key_item, key, key_sz);
   cursor->set_key(cursor, &key_item);
   return cursor->remove(cursor);
 }
 inline static void kv_schema_free_cb(void *ptr)
 {
-  kv_schema_t *schema = (kv_schema_t *)ptr;
+  // dict_deinit passes where the value is kept
+  kv_schema_t *schema = *(kv_schema_t **)ptr;
   kv_schema_destroy(schema);
 }
 void *kv_db_destroy(kv_db_t *db)
 {
   if (db != NULL)
   {
+    kv_session_t *s = db->sessions;
+    // threads still running give up their sessions here, and aren't called
+    // back for them when they exit
+    pthread_key_delete(db->session_key);
+    while (s != NULL)
+    {
+      kv_session_t *next = s->next;
+      kv_session_destroy(s);
+      s = next;
+    }
+    db->sessions = NULL;
+    pthread_mutex_destroy(&db->session_lock);
 
     dict_deinit(db->schema_ctx, kv_schema_free_cb);
     free(db->database_dir);
     free(db->database_name);
+    // closing the connection checkpoints, and lets the database be opened again
+    db->conn->close(db->conn, NULL);
+    free(db);
+  }
+}
+kv_session_t *kv_session_alloc(kv_db_t *db)
+{
+  kv_session_t *s = calloc(1, sizeof(kv_session_t));
+  assert(s != NULL);
+  s->cursors = calloc(SCHEMA_LIMIT, sizeof(WT_CURSOR *));
+  assert(s->cursors != NULL);
+  if (db->conn->open_session(db->conn, NULL, NULL, &s->session) != 0)
+  {
+    free(s->cursors);
+    free(s);
+    return NULL;
+  }
+  s->ctx = db;
+  return s;
+}
+void kv_session_destroy(kv_session_t *s)
+{
+  if (s != NULL)
+  {
+    // an unfinished transaction is rolled back, and the cursors closed, along
+    // with the session
+    s->session->close(s->session, NULL);
+    free(s->cursors);
+    free(s);
+  }
+}
+kv_session_t *kv_db_session(kv_db_t *db)
+{
+  kv_session_t *s = (kv_session_t *)pthread_getspecific(db->session_key);
+  if (s == NULL)
+  {
+    s = kv_session_alloc(db);
+    assert(s != NULL);
+    pthread_mutex_lock(&db->session_lock);
+    s->next = db->sessions;
+    db->sessions = s;
+    pthread_mutex_unlock(&db->session_lock);
+    pthread_setspecific(db->session_key, s);
+  }
+  return s;
+}
+WT_CURSOR *kv_session_cursor(kv_session_t *s, kv_schema_t *schema)
+{
+  WT_CURSOR **cursor = &s->cursors[schema->id];
+  if (*cursor == NULL && s->session->open_cursor(s->session, schema->schema_format, NULL, NULL, cursor) != 0)
+  {
+    *cursor = NULL;
+  }
+  return *cursor;
+}
+int kv_db_begin(kv_session_t *s)
+{
+  int ret = s->session->begin_transaction(s->session, NULL);
+  s->in_txn = (ret == 0);
+  return ret;
+}
+int kv_db_commit(kv_session_t *s, kv_db_durability_t durability)
+{
+  WT_SESSION *session = s->session;
+  s->in_txn = false;
+  if (durability == KV_DB_SYNC)
+  {
+    return session->commit_transaction(session, "sync=on");
+  }
+  int ret = session->commit_transaction(session, "sync=off");
+  if (ret == 0 && durability == KV_DB_LOG_FLUSH)
+  {
+    ret = session->log_flush(session, "sync=off");
+  }
+  return ret;
+}
+int kv_db_rollback(kv_session_t *s)
+{
+  s->in_txn = false;
+  return s->session->rollback_transaction(s->session, NULL);
+}
+int kv_db_txn_set(kv_session_t *s, kv_schema_t *schema, void *key, size_t key_sz, void *val, size_t val_sz)
+{
+  WT_CURSOR *cursor = kv_session_cursor(s, schema);
+  if (cursor == NULL)
+  {
+    return -1;
+  }
+  return kv_session_put(cursor, key, key_sz, val, val_sz);
+}
+int kv_db_set_batch(kv_session_t *s, kv_schema_t *schema, kv_pair_t *pairs, size_t n, kv_db_durability_t durability)
+{
+  WT_CURSOR *cursor = kv_session_cursor(s, schema);
+  bool own_txn = !s->in_txn;
+  int ret = 0;
+  size_t i = 0;
+  if (cursor == NULL)
+  {
+    return -1;
+  }
+  if (own_txn && (ret = kv_db_begin(s)) != 0)
+  {
+    return ret;
+  }
+  for (; ret == 0 && i < n; i++)
+  {
+    ret = kv_session_put(cursor, pairs[i].key, pairs[i].key_sz, pairs[i].val, pairs[i].val_sz);
+  }
+  if (!own_txn)
+  {
+    return ret;
+  }
+  if (ret != 0)
+  {
+    kv_db_rollback(s);
+    return ret;
   }
+  return kv_db_commit(s, durability);
 }
 kv_schema_t *kv_db_fetch_schema(kv_db_t *db, char *schema_name)
 {
@@ -203,4 +325,210 @@ void kv_db_unregister_schema(kv_db_t *db, char *schema_name)
   {
     dict_del(db->schema_ctx, schema_name, NULL);
   }
-}
\ No newline at end of file
+}
+enum
+{
+  KV_ITER_FIRST = 0,
+  KV_ITER_RUNNING,
+  KV_ITER_DONE,
+};
+// keys of format u sort like this, bytes first and then length
+inline static int kv_key_cmp(const void *a, size_t a_sz, const void *b, size_t b_sz)
+{
+  int cmp = memcmp(a, b, a_sz < b_sz ? a_sz : b_sz);
+  if (cmp != 0)
+  {
+    return cmp;
+  }
+  return a_sz < b_sz ? -1 : a_sz > b_sz;
+}
+inline static void *kv_iter_copy(const void *data, size_t size)
+{
+  void *copy = malloc(size > 0 ? size : 1);
+  assert(copy != NULL);
+  memcpy(copy, data, size);
+  return copy;
+}
+int kv_iter_open(kv_iter_t *it, kv_session_t *s, kv_schema_t *schema, const kv_range_t *range)
+{
+  memset(it, 0, sizeof(kv_iter_t));
+  if (range != NULL)
+  {
+    it->range = *range;
+  }
+  kv_range_t *r = &it->range;
+  if (r->batch_size == 0)
+  {
+    r->batch_size = KV_ITER_BATCH;
+  }
+  // a cursor of its own, so gets on the schema don't move it. wiredtiger
+  // keeps closed cursors cached in the session, opening one is cheap
+  int ret = s->session->open_cursor(s->session, schema->schema_format, NULL, NULL, &it->cursor);
+  if (ret != 0)
+  {
+    it->cursor = NULL;
+    return ret;
+  }
+  r->start = r->start != NULL ? kv_iter_copy(r->start, r->start_sz) : NULL;
+  r->end = r->end != NULL ? kv_iter_copy(r->end, r->end_sz) : NULL;
+  r->prefix = r->prefix != NULL ? kv_iter_copy(r->prefix, r->prefix_sz) : NULL;
+  return 0;
+}
+void kv_iter_close(kv_iter_t *it)
+{
+  if (it->cursor != NULL)
+  {
+    it->cursor->close(it->cursor);
+    it->cursor = NULL;
+  }
+  free((void *)it->range.start);
+  free((void *)it->range.end);
+  free((void *)it->range.prefix);
+  free(it->resume);
+  memset(it, 0, sizeof(kv_iter_t));
+}
+// put the cursor on the first key >= key (<= key in reverse), or past it if
+// strict
+static int kv_iter_seek(kv_iter_t *it, const void *key, size_t key_sz, bool strict)
+{
+  WT_CURSOR *cursor = it->cursor;
+  WT_ITEM item;
+  int exact = 0;
+  wt_item_init(&item, (void *)key, key_sz);
+  cursor->set_key(cursor, &item);
+  int ret = cursor->search_near(cursor, &exact);
+  if (ret != 0)
+  {
+    return ret;
+  }
+  if (it->range.reverse)
+  {
+    return exact > 0 || (exact == 0 && strict) ? cursor->prev(cursor) : 0;
+  }
+  return exact < 0 || (exact == 0 && strict) ? cursor->next(cursor) : 0;
+}
+// the first key past every key beginning with prefix, false if there is none
+// as the prefix is all 0xff
+static bool kv_prefix_successor(const kv_range_t *r, void **succ, size_t *succ_sz)
+{
+  size_t n = r->prefix_sz;
+  const unsigned char *p = (const unsigned char *)r->prefix;
+  while (n > 0 && p[n - 1] == 0xff)
+  {
+    n--;
+  }
+  if (n == 0)
+  {
+    return false;
+  }
+  unsigned char *s = (unsigned char *)kv_iter_copy(p, n);
+  s[n - 1]++;
+  *succ = s;
+  *succ_sz = n;
+  return true;
+}
+static int kv_iter_first(kv_iter_t *it)
+{
+  WT_CURSOR *cursor = it->cursor;
+  kv_range_t *r = &it->range;
+  if (!r->reverse)
+  {
+    // the prefix is a lower bound too, start from the larger one
+    const void *from = r->start;
+    size_t from_sz = r->start_sz;
+    if (r->prefix != NULL && (from == NULL || kv_key_cmp(r->prefix, r->prefix_sz, from, from_sz) > 0))
+    {
+      from = r->prefix;
+      from_sz = r->prefix_sz;
+    }
+    return from != NULL ? kv_iter_seek(it, from, from_sz, false) : cursor->next(cursor);
+  }
+  // going down, start below the smaller of end and what follows the prefix
+  void *succ = NULL;
+  size_t succ_sz = 0;
+  const void *to = r->end;
+  size_t to_sz = r->end_sz;
+  if (r->prefix != NULL && kv_prefix_successor(r, &succ, &succ_sz) &&
+      (to == NULL || kv_key_cmp(succ, succ_sz, to, to_sz) < 0))
+  {
+    to = succ;
+    to_sz = succ_sz;
+  }
+  int ret = to != NULL ? kv_iter_seek(it, to, to_sz, true) : cursor->prev(cursor);
+  free(succ);
+  return ret;
+}
+// is the row under the cursor still in range. in the direction of the scan
+// the keys only move away from the bound it starts at, so only the far
+// bounds need checking
+static bool kv_iter_in_range(kv_iter_t *it)
+{
+  kv_range_t *r = &it->range;
+  WT_ITEM *key = &it->key;
+  if (r->prefix != NULL && (key->size < r->prefix_sz || memcmp(key->data, r->prefix, r->prefix_sz) != 0))
+  {
+    return false;
+  }
+  if (r->reverse)
+  {
+    return r->start == NULL || kv_key_cmp(key->data, key->size, r->start, r->start_sz) >= 0;
+  }
+  return r->end == NULL || kv_key_cmp(key->data, key->size, r->end, r->end_sz) < 0;
+}
+int kv_iter_next(kv_iter_t *it)
+{
+  WT_CURSOR *cursor = it->cursor;
+  int ret = 0;
+  switch (it->state)
+  {
+  case KV_ITER_DONE:
+    return 0;
+  case KV_ITER_FIRST:
+    ret = kv_iter_first(it);
+    it->state = KV_ITER_RUNNING;
+    break;
+  default:
+    if (it->n_batch < it->range.batch_size)
+    {
+      ret = it->range.reverse ? cursor->prev(cursor) : cursor->next(cursor);
+      break;
+    }
+    // end of a batch, remember where we are and let go of the snapshot. the
+    // key has to be copied, it lives in a page the reset unpins
+    if (it->resume_cap < it->key.size)
+    {
+      free(it->resume);
+      it->resume_cap = it->key.size;
+      it->resume = kv_iter_copy(it->key.data, it->key.size);
+    }
+    else
+    {
+      memcpy(it->resume, it->key.data, it->key.size);
+    }
+    it->resume_sz = it->key.size;
+    it->n_batch = 0;
+    if ((ret = cursor->reset(cursor)) == 0)
+    {
+      ret = kv_iter_seek(it, it->resume, it->resume_sz, true);
+    }
+    break;
+  }
+  if (ret == 0)
+  {
+    cursor->get_key(cursor, &it->key);
+    cursor->get_value(cursor, &it->val);
+    if (kv_iter_in_range(it))
+    {
+      it->n_batch++;
+      return 1;
+    }
+  }
+  else if (ret != WT_NOTFOUND)
+  {
+    return ret;
+  }
+  // done, the snapshot isn't needed anymore
+  it->state = KV_ITER_DONE;
+  cursor->reset(cursor);
+  return 0;
+}
@@ -8,6 +8,7 @@
 #ifndef _KV_DB_H
 #define _KV_DB_H
 #include <stdio.h>
+#include <pthread.h>
 #include <wiredtiger_ext.h>
 #include <wiredtiger.h>
 #include "dict.h"
@@ -16,6 +17,8 @@
 #define SCHEMA_STATE 2
 
 #define SCHEMA_LIMIT (1024)
+// rows a scan reads before it lets go of its snapshot, if not told
+#define KV_ITER_BATCH (1024)
 
 
 typedef  struct {
@@ -25,24 +28,102 @@ typedef  struct {
 typedef struct
 {
 
+  // only used to create and drop the table, reads and writes go through
+  // the cursors of the caller's session
   WT_SESSION *session;
-  WT_CURSOR *cursor;
+  // where the schema's cursor sits in each session's cache
+  uint32_t id;
   void *ctx;
   char  *schema_format;
   char *schema_name[0]
 } kv_schema_t;
 
+// a session of its own for a caller that wants transactions, the writes
+// made through it between begin and commit are applied all or nothing,
+// across schemas. a session must only be used by one thread at a time
+typedef struct kv_session_s
+{
+  WT_SESSION *session;
+  void *ctx;
+  bool in_txn;
+  // cursors opened in this session so far, by schema id
+  WT_CURSOR **cursors;
+  // the db's list of per thread sessions
+  struct kv_session_s *next;
+} kv_session_t;
+
 typedef struct
 {
   char *database_name;
   char *database_dir;
   dict_t *schema_ctx;
    WT_CONNECTION *conn;
+  uint32_t schema_count;
+  // each thread gets a session of its own for kv_db_set/get/del, wiredtiger
+  // sessions can't be shared between threads
+  pthread_key_t session_key;
+  pthread_mutex_t session_lock;
+  kv_session_t *sessions;
 
   // struct kv_schema **schema_ctx;
 } kv_db_t;
 
-typedef int (*kv_func)(void *,void *) kv_func_cb;
+// how far a commit gets before it returns
+typedef enum
+{
+  // synced to the log, survives losing the machine
+  KV_DB_SYNC = 0,
+  // written to the log file, survives the process crashing
+  KV_DB_LOG_FLUSH,
+  // left in the log buffer for a later sync or checkpoint to write out
+  KV_DB_NO_SYNC,
+} kv_db_durability_t;
+
+typedef struct
+{
+  void *key;
+  size_t key_sz;
+  void *val;
+  size_t val_sz;
+} kv_pair_t;
+
+// the keys a scan visits, in byte order. a bound left NULL doesn't apply
+typedef struct
+{
+  // first key, inclusive
+  const void *start;
+  size_t start_sz;
+  // where the scan stops, exclusive
+  const void *end;
+  size_t end_sz;
+  // only keys beginning with these bytes
+  const void *prefix;
+  size_t prefix_sz;
+  // from the last key down
+  bool reverse;
+  // rows read under one snapshot. a long scan lets go of the snapshot, and
+  // the pages it pins, between batches and picks up after the last key it
+  // returned. 0 takes KV_ITER_BATCH
+  size_t batch_size;
+} kv_range_t;
+
+typedef struct
+{
+  WT_CURSOR *cursor;
+  kv_range_t range;
+  // the current row. these point into wiredtiger's memory and are only
+  // valid until the next call on the iterator
+  WT_ITEM key;
+  WT_ITEM val;
+  // rows returned in this batch
+  size_t n_batch;
+  // a copy of the last key, taken at the end of a batch to find our place
+  // again
+  void *resume;
+  size_t resume_sz;
+  size_t resume_cap;
+  int state;
+} kv_iter_t;
 
 kv_schema_t *kv_schema_alloc(const char *name, void *ctx,bool is_force_drop);
 
@@ -53,11 +134,32 @@ kv_db_t *kv_db_alloc(const char *database_name, const char *database_dir);
 kv_schema_t *kv_db_fetch_schema(kv_db_t *db, char *schema_name);
 int kv_db_register_schema(kv_db_t *db, kv_schema_t *schema);
 void kv_db_unregister_schema(kv_db_t *db, char *schema_name);
-// key and value operation
+// key and value operation, through the calling thread's session
 int kv_db_set(kv_schema_t *schema, void *key, size_t key_sz, void *val,size_t val_sz);
 void *kv_db_get(kv_schema_t *schema, void *key,size_t key_sz);
 int kv_db_del(kv_schema_t *schema, void *key,size_t key_sz);
-void *kv_db_fetch_top_index(kv_schema_t *schema,uint32_t index);
-int  kv_db_fetch_all(kv_schema_t *schema,kv_func_cb cb);
 void *kv_db_destroy(kv_db_t *db);
+// transactions, calls return 0 or a wiredtiger error
+kv_session_t *kv_session_alloc(kv_db_t *db);
+void kv_session_destroy(kv_session_t *s);
+// the calling thread's session, opened on first use and closed when the
+// thread exits
+kv_session_t *kv_db_session(kv_db_t *db);
+// the session's cursor on schema, opened on first use and kept
+WT_CURSOR *kv_session_cursor(kv_session_t *s, kv_schema_t *schema);
+int kv_db_begin(kv_session_t *s);
+int kv_db_commit(kv_session_t *s, kv_db_durability_t durability);
+int kv_db_rollback(kv_session_t *s);
+int kv_db_txn_set(kv_session_t *s, kv_schema_t *schema, void *key, size_t key_sz, void *val, size_t val_sz);
+// put every pair in one transaction, committed with the given durability.
+// inside a transaction begun by the caller the pairs join it instead, and
+// the caller's commit decides
+int kv_db_set_batch(kv_session_t *s, kv_schema_t *schema, kv_pair_t *pairs, size_t n, kv_db_durability_t durability);
+// scan schema through session s, range may be NULL for the whole table. the
+// range's keys are only read by kv_iter_open
+int kv_iter_open(kv_iter_t *it, kv_session_t *s, kv_schema_t *schema, const kv_range_t *range);
+// step to the next row: 1 with it->key and it->val set, 0 once past the end
+// of the range, or a wiredtiger error
+int kv_iter_next(kv_iter_t *it);
+void kv_iter_close(kv_iter_t *it);
 #endif
@@ -6,6 +6,8 @@
  ************************************************************************/
 
 #include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
 #include <wiredtiger_ext.h>
 #include <wiredtiger.h>
 #include "hashfn.h"
@@ -18,6 +20,45 @@ typedef struct
   char name[256];
   uint ver;
 } demo_t;
+static void *read_tickets(void *arg)
+{
+  kv_schema_t *docs = (kv_schema_t *)arg;
+  uint32_t i, j;
+  for (j = 0; j < 1000; j++)
+  {
+    for (i = 0; i < 16; i++)
+    {
+      assert(kv_db_get(docs, &i, sizeof(i)) != NULL);
+    }
+  }
+  return NULL;
+}
+static int scanned_first, scanned_last;
+// walk range, checking every value is at the key it was put at
+static int scan_entries(kv_schema_t *schema, kv_range_t *range)
+{
+  kv_iter_t it;
+  char log_key[16];
+  int n = 0, ret;
+  assert(kv_iter_open(&it, kv_db_session(schema->ctx), schema, range) == 0);
+  while ((ret = kv_iter_next(&it)) == 1)
+  {
+    if (it.val.size == sizeof(int))
+    {
+      scanned_last = *(int *)it.val.data;
+      snprintf(log_key, sizeof(log_key), "log-%02d", scanned_last);
+      assert(it.key.size == strlen(log_key) && memcmp(it.key.data, log_key, it.key.size) == 0);
+      if (n == 0)
+      {
+        scanned_first = scanned_last;
+      }
+    }
+    n++;
+  }
+  assert(ret == 0);
+  kv_iter_close(&it);
+  return n;
+}
 int main(int argc, char *argv[])
 {
 
@@ -54,9 +95,84 @@ const  char *schemas_meta[] = {
     fprintf(stdout, "set demo_t info :id=%d,name=%s,ver=%d\n", inst.id, inst.name, inst.ver);
     char key[256] = {'\0'};
     snprintf(&key,256,"%s-%d","test",i);
-    int ret = kv_db_set(db, schema_name,&key, strlen(&key),&inst,sizeof(inst));
-   demo_t *inst2 =(demo_t *) kv_db_get(db, schema_name, &key,strlen(&key));
+    int ret = kv_db_set(schema, &key, strlen(&key),&inst,sizeof(inst));
+   demo_t *inst2 =(demo_t *) kv_db_get(schema, &key,strlen(&key));
     fprintf(stdout, "get demo_t info :id=%d,name=%s,ver=%d\n", inst2->id, inst2->name, inst2->ver);
-    kv_db_del(db, schema_name, &key,strlen(&key));
+    kv_db_del(schema, &key,strlen(&key));
+  }
+  kv_schema_t *docs = kv_db_fetch_schema(db, "docs");
+  kv_schema_t *state = kv_db_fetch_schema(db, "state");
+  kv_session_t *session = kv_session_alloc(db);
+  uint32_t tickets[16];
+  kv_pair_t pairs[16];
+  for (i = 0; i < 16; i++)
+  {
+    tickets[i] = i;
+    pairs[i].key = &tickets[i];
+    pairs[i].key_sz = sizeof(uint32_t);
+    pairs[i].val = "";
+    pairs[i].val_sz = 0;
+  }
+  assert(kv_db_set_batch(session, docs, pairs, 16, KV_DB_LOG_FLUSH) == 0);
+  assert(kv_db_get(docs, &tickets[15], sizeof(uint32_t)) != NULL);
+
+  // term and vote go in one transaction, with one sync
+  int term = 2, voted_for = 1;
+  assert(kv_db_begin(session) == 0);
+  assert(kv_db_txn_set(session, state, "term", 4, &term, sizeof(term)) == 0);
+  assert(kv_db_txn_set(session, state, "voted_for", 9, &voted_for, sizeof(voted_for)) == 0);
+  assert(kv_db_commit(session, KV_DB_SYNC) == 0);
+  assert(*(int *)kv_db_get(state, "voted_for", 9) == 1);
+
+  // a rolled back transaction leaves nothing behind, batch included
+  term = 3;
+  assert(kv_db_begin(session) == 0);
+  assert(kv_db_txn_set(session, state, "term", 4, &term, sizeof(term)) == 0);
+  assert(kv_db_set_batch(session, docs, pairs, 16, KV_DB_NO_SYNC) == 0);
+  assert(kv_db_rollback(session) == 0);
+  assert(*(int *)kv_db_get(state, "term", 4) == 2);
+  kv_session_destroy(session);
+
+  // readers on several threads, each through a session of its own
+  pthread_t readers[4];
+  for (i = 0; i < 4; i++)
+  {
+    assert(pthread_create(&readers[i], NULL, read_tickets, docs) == 0);
+  }
+  for (i = 0; i < 4; i++)
+  {
+    assert(pthread_join(readers[i], NULL) == 0);
+  }
+
+  // range reads
+  kv_schema_t *entries = kv_db_fetch_schema(db, "entries");
+  char log_key[16];
+  for (i = 0; i < 20; i++)
+  {
+    snprintf(log_key, sizeof(log_key), "log-%02d", i);
+    assert(kv_db_set(entries, log_key, strlen(log_key), &i, sizeof(i)) == 0);
   }
+  assert(kv_db_set(entries, "meta", 4, "", 0) == 0);
+  assert(scan_entries(entries, NULL) == 21);
+  kv_range_t range = {
+      .prefix = "log-",
+      .prefix_sz = 4,
+  };
+  assert(scan_entries(entries, &range) == 20 && scanned_first == 0 && scanned_last == 19);
+  range.start = "log-05";
+  range.start_sz = 6;
+  range.end = "log-10";
+  range.end_sz = 6;
+  assert(scan_entries(entries, &range) == 5 && scanned_first == 5 && scanned_last == 9);
+  range.reverse = true;
+  assert(scan_entries(entries, &range) == 5 && scanned_first == 9 && scanned_last == 5);
+  // batches pick up where the last one stopped
+  range.batch_size = 2;
+  assert(scan_entries(entries, &range) == 5 && scanned_first == 9 && scanned_last == 5);
+  range.reverse = false;
+  range.prefix = "log-1";
+  range.prefix_sz = 5;
+  range.end = NULL;
+  assert(scan_entries(entries, &range) == 10 && scanned_first == 10 && scanned_last == 19);
+  kv_db_destroy(db);
 }
@@ -7,17 +7,24 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#include "kv_db.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "storage.h"
+#include "membership.h"
+#include "options.h"
+#include "segment.h"
+#include "feistel.h"
+#include "wal.h"
 #include "h2o.h"
 #include "h2o/http1.h"
 #include "h2o_helpers.h"
-#include "lmdb.h"
-#include "lmdb_helpers.h"
 #include "raft.h"
 #include "uv_helpers.h"
 #include "uv_multiplex.h"
 #include "tpl.h"
+#include "peer_msg.h"
 #include "arraytools.h"
 
 #include "usage.c"
@@ -28,64 +35,141 @@
 #define MAX_HTTP_CONNECTIONS 128
 #define MAX_PEER_CONNECTIONS 128
 #define IPV4_STR_LEN 3 * 4 + 3 + 1
-#define PERIOD_MSEC 1000
 #define RAFT_BUFLEN 512
 #define LEADER_URL_LEN 512
+#define DB_DIR "/tmp/seq_db"
 #define IPC_PIPE_NAME "ticketd_ipc"
 #define HTTP_WORKERS 4
-#define IP_STR_LEN strlen("111.111.111.111")
-
-typedef enum
-{
-    HANDSHAKE_FAILURE,
-    HANDSHAKE_SUCCESS,
-} handshake_state_e;
-
-/** Message types used for peer to peer traffic
- * These values are used to identify message types during deserialization */
+#define BATCH_MAX 100000
+#define LEASE_BASE (1ULL << 32)
+/* feistel IDs have the top bit set, which keeps them apart from random
+ * tickets below LEASE_BASE and from the leased IDs above it */
+#define FEISTEL_BASE (1ULL << 63)
+#define QUERY_LEN 256
+#define REQUEST_TIMEOUT_MSEC 5000
+
+/** Log entry types used by the ticketd state machine.
+ * Raft reserves the values below RAFT_LOGTYPE_NUM */
 typedef enum
 {
-    /** Handshake is a special non-raft message type
-     * We send a handshake so that we can identify ourselves to our peers */
-    MSG_HANDSHAKE,
-    /** Successful responses mean we can start the Raft periodic callback */
-    MSG_HANDSHAKE_RESPONSE,
-    /** Tell leader we want to leave the cluster */
-    /* When instance is ctrl-c'd we have to gracefuly disconnect */
-    MSG_LEAVE,
-    /* Receiving a leave response means we can shutdown */
-    MSG_LEAVE_RESPONSE,
-    MSG_REQUESTVOTE,
-    MSG_REQUESTVOTE_RESPONSE,
-    MSG_APPENDENTRIES,
-    MSG_APPENDENTRIES_RESPONSE,
-} peer_message_type_e;
-
-/** Peer protocol handshake
- * Send handshake after connecting so that our peer can identify us */
+    /** A single random ticket */
+    LOGTYPE_TICKET = RAFT_LOGTYPE_NORMAL,
+    /** Lease a range of IDs to a node */
+    LOGTYPE_LEASE = RAFT_LOGTYPE_NUM,
+} ticket_logtype_e;
+
+/** Lease a range of IDs to a node.
+ * The range is carved out of the lease high-water mark when the entry is
+ * applied, so every replica hands out the same [lo, hi) */
 typedef struct
 {
-    int raft_port;
-    int http_port;
     int node_id;
-} msg_handshake_t;
+    unsigned int size;
+} entry_lease_t;
 
+/** IDs handed out for a single request.
+ * A contiguous block is [first, first + count), otherwise the IDs are in list */
 typedef struct
 {
-    int success;
+    int contiguous;
+    uint64_t first;
+    unsigned int count;
+    uint64_t *list;
+} id_block_t;
 
-    /* leader's Raft port */
-    int leader_port;
+typedef struct http_worker_s http_worker_t;
 
-    /* the responding node's HTTP port */
-    int http_port;
+/** What reads are answered with: the counters and where the cluster is at */
+typedef struct
+{
+    int term;
+    int commit_idx;
+    int last_applied_idx;
+    int num_nodes;
 
-    /* my Raft node ID.
-     * Sometimes we don't know who we did the handshake with */
-    int node_id;
+    /* every ID below this has been leased to some node */
+    uint64_t lease_hi;
+
+    /* the last ID handed to a client through the log, 0 if none */
+    uint64_t last_issued;
+} read_state_t;
+
+/** A client request waiting on Raft.
+ * The HTTP worker doesn't block while the request's entry is replicated, the
+ * request is handed back to the worker once the entry has been applied. */
+typedef struct completion_s completion_t;
+
+struct completion_s
+{
+    /* NULL if the client went away in the meantime */
+    h2o_req_t *req;
+
+    /* points back at us from the request's pool */
+    completion_t **ref;
+
+    http_worker_t *worker;
+
+    /* what the client asked for */
+    unsigned int count;
+    int binary;
+
+    /* the entry we are waiting on */
+    msg_entry_response_t r;
+
+    /* where our IDs start within the entry, ie. when a group shares it */
+    unsigned int offset;
+
+    /* our segment has been refilled, serve the request again */
+    int retry;
+
+    /* give up on the entry after this, in uv_hrtime() nanoseconds */
+    uint64_t deadline;
+
+    int e;
+    id_block_t blk;
+
+    /* a read of the state rather than a request for IDs, confirmed by a
+     * round of heartbeats */
+    int read;
+    raft_read_index_t rd;
+    read_state_t st;
+
+    completion_t *next;
+};
+
+struct http_worker_s
+{
+    h2o_context_t ctx;
+    h2o_accept_ctx_t accept_ctx;
+
+    /* Raft hands finished requests back to us through this */
+    uv_async_t completed;
+    uv_mutex_t lock;
+    completion_t *done;
+
+    /* closes the window of a group opened by one of our requests */
+    uv_timer_t group_timer;
+};
+
+/** How an entry starts its WAL record, its data follows */
+typedef struct
+{
+    unsigned int term;
+    unsigned int id;
+    int type;
+} wal_entry_t;
 
-    char leader_host[IP_STR_LEN];
-} msg_handshake_response_t;
+/** Requests that are appended to the log as a single entry */
+typedef struct
+{
+    /* IDs asked for by all the requests in the group */
+    unsigned int count;
+
+    /* uv_hrtime() when the group window closes */
+    uint64_t deadline;
+
+    completion_t *members, **tail;
+} group_t;
 
 /** Add/remove Raft peer */
 typedef struct
@@ -96,21 +180,6 @@ typedef struct
     char host[IP_STR_LEN];
 } entry_cfg_change_t;
 
-typedef struct
-{
-    int type;
-    union
-    {
-        msg_handshake_t hs;
-        msg_handshake_response_t hsr;
-        msg_requestvote_t rv;
-        msg_requestvote_response_t rvr;
-        msg_appendentries_t ae;
-        msg_appendentries_response_t aer;
-    };
-    int padding[100];
-} msg_t;
-
 typedef enum
 {
     DISCONNECTED,
@@ -119,6 +188,7 @@ typedef enum
 } conn_status_e;
 
 typedef struct peer_connection_s peer_connection_t;
+typedef struct snapshot_job_s snapshot_job_t;
 
 struct peer_connection_s
 {
@@ -145,6 +215,13 @@ struct peer_connection_s
      * used in tandem with n_expected_entries */
     msg_t ae;
 
+    /* installsnapshot msg whose state we are about to read, last_idx is 0
+     * if we aren't expecting one */
+    msg_installsnapshot_t is;
+
+    /* installsnapshot message being packed for the peer, NULL if none */
+    snapshot_job_t *snapshot;
+
     uv_stream_t *stream;
 
     uv_loop_t *loop;
@@ -159,40 +236,75 @@ typedef struct
 
     raft_server_t *raft;
 
-    /* Set of tickets that have been issued
-     * We store unsigned ints in here */
-    MDB_dbi tickets;
-    kv_schema_t *tickets_schema;
-    /* Persistent state for voted_for and term
-     * We store string keys (eg. "term") with int values */
-    MDB_dbi state;
-
-    /* Entries that have been appended to our log
-     * For each log entry we store two things next to each other:
-     *  - TPL serialized raft_entry_t
-     *  - raft_entry_data_t */
-    MDB_dbi entries;
-    kv_schema_t *entries_schema;
-    /* LMDB database environment */
-    MDB_env *db_env;
-
-    kv_schema_t *state_schema;
-    kv_db_t *db;
+    /* Every ID below this has been leased to some node */
+    uint64_t lease_hi;
+
+    /* Index of the last lease entry applied to lease_hi.
+     * Lease entries aren't idempotent, so we skip them when reloading */
+    int lease_idx;
+
+    /* The last random ticket applied */
+    unsigned int last_ticket;
+
+    /* IDs leased to us that we hand out without touching the log */
+    segment_alloc_t segment;
+
+    /* The lease entry we are waiting on, ie. ID of 0 if none in flight */
+    unsigned int lease_ety_id;
+    msg_entry_response_t lease_r;
+
+    /* Permutation applied to leased IDs in feistel mode */
+    feistel_t feistel;
+
+    /* Requests waiting on entries, in log index order */
+    completion_t *completions, **completions_tail;
+
+    /* Requests waiting for our segment to be refilled */
+    completion_t *segment_waiters;
+
+    /* Reads waiting on a round of heartbeats */
+    completion_t *reads;
+
+    /* What reads are answered with while we hold a lease, published under
+     * read_lock so that serving them doesn't queue behind raft_lock.
+     * lease_deadline is in uv_hrtime() nanoseconds, 0 if we have no lease */
+    uv_mutex_t read_lock;
+    read_state_t read_state;
+    uint64_t lease_deadline;
+
+    /* Requests being gathered into one entry, NULL until one arrives */
+    group_t *group;
+
+    /* Entries that have been appended to our log, a WAL record each: the
+     * entry's wal_entry_t followed by its data */
+    wal_t wal;
+
+    /* Entries before this have been compacted away. The WAL segments that
+     * only hold such entries are deleted once the snapshot is durable */
+    int wal_head;
+
+    /* The cluster as of our snapshot. The cfg change entries that made it
+     * are compacted away, see __compact_log */
+    membership_t members;
+
+    /* The set of tickets that have been issued, and persistent state such
+     * as voted_for and term, in whichever backend opts.storage picked */
+    storage_t storage;
+
     h2o_globalconf_t cfg;
-    h2o_context_t ctx;
-    h2o_accept_ctx_t accept_ctx;
+    http_worker_t workers[HTTP_WORKERS];
 
     /* Raft isn't multi-threaded, therefore we use a global lock */
     uv_mutex_t raft_lock;
 
-    /* When we receive an entry from the client we need to block until the
-     * entry has been committed. This condition is used to wake us up. */
-    uv_cond_t appendentries_received;
-
     uv_loop_t peer_loop, http_loop;
 
     /* Link list of peer connections */
     peer_connection_t *conns;
+
+    /* we were ctrl-c'd as leader, we leave the cluster once leadership
+     * has been handed over */
+    int leaving;
 } server_t;
 
 options_t opts;
@@ -226,45 +338,57 @@ static size_t peer_msg_serialize(tpl_node *tn, uv_buf_t *buf, char *data)
     return sz;
 }
 
-static void peer_msg_send(uv_stream_t *s, tpl_node *tn, uv_buf_t *buf, char *data)
+static void __peer_write_cb(uv_write_t *req, int status)
 {
-    peer_msg_serialize(tn, buf, data);
-    int e = uv_try_write(s, buf, 1);
-    if (e < 0)
-        uv_fatal(e);
+    free(req);
 }
 
-/** Check if the ticket has already been issued
- * @return 0 if not unique; otherwise 1 */
-static int check_if_ticket_exists(const unsigned int ticket)
+/** Write to a peer without waiting on the socket.
+ * Whatever the socket doesn't take straight away is copied and queued,
+ * appendentries messages carrying many entries don't fit into the socket
+ * buffer. */
+static void peer_write(uv_stream_t *s, uv_buf_t *bufs, unsigned int nbufs)
 {
-    MDB_txn *txn;
+    size_t total = 0, written;
+    unsigned int i;
 
-    int e = mdb_txn_begin(sv->db_env, NULL, MDB_RDONLY, &txn);
-    if (0 != e)
-        mdb_fatal(e);
+    for (i = 0; i < nbufs; i++)
+        total += bufs[i].len;
 
-    MDB_val v, k = {.mv_size = sizeof(ticket), .mv_data = (void *)&ticket};
+    int e = uv_try_write(s, bufs, nbufs);
+    if (e < 0 && UV_EAGAIN != e)
+        uv_fatal(e);
+    written = e < 0 ? 0 : e;
+    if (written == total)
+        return;
 
-    e = mdb_get(txn, sv->tickets, &k, &v);
-    switch (e)
+    uv_write_t *req = malloc(sizeof(*req) + total - written);
+    char *p = (char *)(req + 1);
+    for (i = 0; i < nbufs; i++)
     {
-    case 0:
-        break;
-    case MDB_NOTFOUND:
-        e = mdb_txn_commit(txn);
-        if (0 != e)
-            mdb_fatal(e);
-        return 0;
-    default:
-        mdb_fatal(e);
+        size_t skip = written < bufs[i].len ? written : bufs[i].len;
+        memcpy(p, bufs[i].base + skip, bufs[i].len - skip);
+        p += bufs[i].len - skip;
+        written -= skip;
     }
 
-    e = mdb_txn_commit(txn);
+    uv_buf_t rest = uv_buf_init((char *)(req + 1), p - (char *)(req + 1));
+    e = uv_write(req, s, &rest, 1, __peer_write_cb);
     if (0 != e)
-        mdb_fatal(e);
+        uv_fatal(e);
+}
 
-    return 1;
+static void peer_msg_send(uv_stream_t *s, tpl_node *tn, uv_buf_t *buf, char *data)
+{
+    peer_msg_serialize(tn, buf, data);
+    peer_write(s, buf, 1);
+}
+
+/** Check if the ticket has already been issued
+ * @return 0 if not unique; otherwise 1 */
+static int check_if_ticket_exists(const unsigned int ticket)
+{
+    return sv->storage.ops->has_ticket(&sv->storage, ticket);
 }
 
 static unsigned int __generate_ticket()
@@ -279,18 +403,697 @@ static unsigned int __generate_ticket()
     return ticket;
 }
 
-/** HTTP POST entry point for receiving entries from client
- * Provide the user with an ID */
-static int __http_get_id(h2o_handler_t *self, h2o_req_t *req)
+static int __cmp_ticket(const void *a, const void *b)
 {
-    static h2o_generator_t generator = {NULL, NULL};
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return x < y ? -1 : x > y;
+}
 
-    if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("POST")))
+/** Fill tickets with count tickets that haven't been issued yet.
+ * Tickets within the batch can collide with each other, so we sort them and
+ * replace duplicates until there are none. */
+static void __generate_tickets(unsigned int *tickets, unsigned int count)
+{
+    unsigned int i, dups;
+
+    for (i = 0; i < count; i++)
+        tickets[i] = __generate_ticket();
+
+    do
+    {
+        qsort(tickets, count, sizeof(*tickets), __cmp_ticket);
+        for (i = 1, dups = 0; i < count; i++)
+            if (tickets[i] == tickets[i - 1])
+            {
+                tickets[i - 1] = __generate_ticket();
+                dups++;
+            }
+    } while (dups);
+}
+
+/** Hand a request back to the HTTP worker it came from.
+ * Must be called with raft_lock held. */
+static void __complete(completion_t *c, int e)
+{
+    http_worker_t *w = c->worker;
+
+    c->e = e;
+    uv_mutex_lock(&w->lock);
+    c->next = w->done;
+    w->done = c;
+    uv_mutex_unlock(&w->lock);
+    uv_async_send(&w->completed);
+}
+
+/** Park the request until its entry has been applied.
+ * Requests are queued in log index order, so applying an entry only has to
+ * look at the front of the queue.
+ * Must be called with raft_lock held. */
+static void __park(completion_t *c)
+{
+    c->deadline = uv_hrtime() + REQUEST_TIMEOUT_MSEC * 1000000ULL;
+    c->next = NULL;
+    *sv->completions_tail = c;
+    sv->completions_tail = &c->next;
+
+    /* the entry is already committed if we are the only node */
+    raft_apply_all(sv->raft);
+}
+
+/** Resume the requests waiting on entries up to the one just applied.
+ * lo is the start of the range carved out by a lease entry.
+ * Must be called with raft_lock held. */
+static void __complete_applied(raft_entry_t *ety, int idx, uint64_t lo)
+{
+    completion_t *c;
+
+    while ((c = sv->completions) && c->r.idx <= idx)
+    {
+        sv->completions = c->next;
+        if (!sv->completions)
+            sv->completions_tail = &sv->completions;
+
+        /* a new leader overwrote our entry */
+        if (c->r.idx != idx || c->r.id != ety->id || c->r.term != (int)ety->term)
+        {
+            __complete(c, -1);
+            continue;
+        }
+
+        c->blk.count = c->count;
+        if (LOGTYPE_LEASE == ety->type)
+        {
+            c->blk.contiguous = 1;
+            c->blk.first = lo + c->offset;
+        }
+        else
+        {
+            unsigned int *tickets = ety->data.buf;
+            c->blk.contiguous = 0;
+            c->blk.list = malloc(sizeof(*c->blk.list) * c->count);
+            for (unsigned int i = 0; i < c->count; i++)
+                c->blk.list[i] = tickets[c->offset + i];
+        }
+        __complete(c, 0);
+    }
+}
+
+/** Serve the requests that were waiting for our segment to be refilled.
+ * Must be called with raft_lock held. */
+static void __resume_segment_waiters(server_t *sv)
+{
+    completion_t *c = sv->segment_waiters, *next;
+
+    sv->segment_waiters = NULL;
+    for (; c; c = next)
+    {
+        next = c->next;
+        c->retry = 1;
+        __complete(c, 0);
+    }
+}
+
+/** Fail the requests whose entries were overwritten by a new leader, or that
+ * have waited for too long.
+ * Must be called with raft_lock held. */
+static void __expire_requests(server_t *sv)
+{
+    uint64_t now = uv_hrtime();
+    completion_t **prev, *c;
+
+    for (prev = &sv->completions; (c = *prev);)
+    {
+        if (now < c->deadline &&
+            -1 != raft_msg_entry_response_committed(sv->raft, &c->r))
+        {
+            prev = &c->next;
+            continue;
+        }
+        *prev = c->next;
+        __complete(c, -1);
+    }
+    sv->completions_tail = prev;
+
+    /* our segment lease didn't make it, the waiters will ask for another */
+    if (0 != sv->lease_ety_id &&
+        -1 == raft_msg_entry_response_committed(sv->raft, &sv->lease_r))
+    {
+        sv->lease_ety_id = 0;
+        __resume_segment_waiters(sv);
+    }
+
+    for (prev = &sv->segment_waiters; (c = *prev);)
+    {
+        if (now < c->deadline)
+        {
+            prev = &c->next;
+            continue;
+        }
+        *prev = c->next;
+        __complete(c, -1);
+    }
+}
+
+/** Take a snapshot of what reads are answered with.
+ * Must be called with raft_lock held. */
+static void __read_state(server_t *sv, read_state_t *st)
+{
+    st->term = raft_get_current_term(sv->raft);
+    st->commit_idx = raft_get_commit_idx(sv->raft);
+    st->last_applied_idx = raft_get_last_applied_idx(sv->raft);
+    st->num_nodes = raft_get_num_nodes(sv->raft);
+    st->lease_hi = sv->lease_hi;
+
+    /* in counter mode every leased ID went straight to a client */
+    if (ID_MODE_COUNTER == opts.id_mode)
+        st->last_issued = sv->lease_hi ? sv->lease_hi - 1 : 0;
+    else
+        st->last_issued = sv->last_ticket;
+}
+
+/** Publish the state and our lease for reads, which don't take raft_lock.
+ * Called whenever either might have moved, ie. after applying entries and
+ * after hearing from peers.
+ * Must be called with raft_lock held. */
+static void __publish_read_state(server_t *sv)
+{
+    read_state_t st;
+    uint64_t deadline = 0;
+
+    __read_state(sv, &st);
+
+    /* Raft's clock only moves on each heartbeat, so its lease can be up to
+     * a heartbeat older than it looks */
+    int lease = raft_read_lease_remaining(sv->raft) - opts.heartbeat_ms;
+    if (0 < lease)
+        deadline = uv_hrtime() + lease * 1000000ULL;
+
+    uv_mutex_lock(&sv->read_lock);
+    sv->read_state = st;
+    sv->lease_deadline = deadline;
+    uv_mutex_unlock(&sv->read_lock);
+}
+
+/** Answer the reads that a majority has confirmed we were leader for, and
+ * fail those that lost leadership or waited for too long.
+ * Must be called with raft_lock held. */
+static void __confirm_reads(server_t *sv)
+{
+    uint64_t now = uv_hrtime();
+    completion_t **prev, *c;
+
+    for (prev = &sv->reads; (c = *prev);)
+    {
+        int e = raft_read_index_ready(sv->raft, &c->rd);
+        if (0 == e && now < c->deadline)
+        {
+            prev = &c->next;
+            continue;
+        }
+        *prev = c->next;
+        if (1 == e)
+            __read_state(sv, &c->st);
+        __complete(c, 1 == e ? 0 : -1);
+    }
+}
+
+/** Append a batch of random tickets to the log as one entry.
+ * Must be called with raft_lock held. */
+static int __propose_tickets(unsigned int *tickets, unsigned int count,
+                             msg_entry_response_t *r)
+{
+    msg_entry_t entry = {};
+    entry.id = rand();
+    entry.type = LOGTYPE_TICKET;
+    entry.data.buf = (void *)tickets;
+    entry.data.len = sizeof(*tickets) * count;
+
+    return raft_recv_entry(sv->raft, &entry, r);
+}
+
+/** Issue a batch of random tickets by committing them to the log as one entry */
+static int __append_tickets(completion_t *c)
+{
+    unsigned int *tickets = malloc(sizeof(*tickets) * c->count);
+    __generate_tickets(tickets, c->count);
+
+    uv_mutex_lock(&sv->raft_lock);
+    int e = __propose_tickets(tickets, c->count, &c->r);
+    if (0 == e)
+        __park(c);
+    uv_mutex_unlock(&sv->raft_lock);
+
+    free(tickets);
+    return 0 == e ? 1 : -1;
+}
+
+/** Append a lease of size IDs to ourselves.
+ * Must be called with raft_lock held. */
+static int __append_lease_entry(server_t *sv,
+                                unsigned int size,
+                                msg_entry_response_t *r)
+{
+    entry_lease_t lease = {.node_id = sv->node_id, .size = size};
+
+    msg_entry_t entry = {};
+    entry.id = rand();
+    entry.type = LOGTYPE_LEASE;
+    entry.data.buf = (void *)&lease;
+    entry.data.len = sizeof(lease);
+
+    if (0 != raft_recv_entry(sv->raft, &entry, r))
         return -1;
+    return 0;
+}
+
+/** Ask the cluster to lease us a new segment.
+ * The lease is sized from our recent allocation rate.
+ * Must be called with raft_lock held. */
+static int __append_lease(server_t *sv)
+{
+    int e = __append_lease_entry(sv, segment_alloc_lease_size(&sv->segment),
+                                 &sv->lease_r);
+    if (0 == e)
+        sv->lease_ety_id = sv->lease_r.id;
+    return e;
+}
+
+/** Start leasing the reserve segment without waiting for it to commit */
+static void __prefetch_lease(server_t *sv)
+{
+    uv_mutex_lock(&sv->raft_lock);
+    if (0 == sv->lease_ety_id && 0 != __append_lease(sv))
+        printf("ERROR: failed to prefetch lease\n");
+    uv_mutex_unlock(&sv->raft_lock);
+}
+
+/** Hand out an ID from our leased segments.
+ * Only when both segments run dry is the request parked until Raft commits
+ * a lease. */
+static int __lease_segment_id(completion_t *c)
+{
+    int e = segment_alloc_next(&sv->segment, &c->blk.first);
+    if (1 == e)
+        __prefetch_lease(sv);
+    if (0 <= e)
+        return 0;
+
+    uv_mutex_lock(&sv->raft_lock);
+
+    /* another worker might have refilled the segment while we were waiting
+     * for the lock */
+    e = segment_alloc_next(&sv->segment, &c->blk.first);
+    if (-1 == e)
+    {
+        if (0 == sv->lease_ety_id && 0 != __append_lease(sv))
+            goto done;
+
+        /* we are served again once the lease is installed into our segment */
+        c->deadline = uv_hrtime() + REQUEST_TIMEOUT_MSEC * 1000000ULL;
+        c->next = sv->segment_waiters;
+        sv->segment_waiters = c;
+        raft_apply_all(sv->raft);
+        e = 1;
+        goto done;
+    }
+
+    if (1 == e && 0 == sv->lease_ety_id)
+        __append_lease(sv);
+    e = 0;
+
+done:
+    uv_mutex_unlock(&sv->raft_lock);
+    return e;
+}
 
+/** Advance the high-water mark by count and hand the range to the caller */
+static int __commit_block(completion_t *c)
+{
+    uv_mutex_lock(&sv->raft_lock);
+    int e = __append_lease_entry(sv, c->count, &c->r);
+    if (0 == e)
+        __park(c);
+    uv_mutex_unlock(&sv->raft_lock);
+    return 0 == e ? 1 : -1;
+}
+
+/** Append the group being gathered to the log as one entry.
+ * Must be called with raft_lock held. */
+static void __seal_group(server_t *sv)
+{
+    group_t *g = sv->group;
+    msg_entry_response_t r;
+    int e;
+
+    /* requests arriving from now on start the next group */
+    sv->group = NULL;
+
+    if (ID_MODE_COUNTER == opts.id_mode)
+        e = __append_lease_entry(sv, g->count, &r);
+    else
+    {
+        unsigned int *tickets = malloc(sizeof(*tickets) * g->count);
+        __generate_tickets(tickets, g->count);
+        e = __propose_tickets(tickets, g->count, &r);
+        free(tickets);
+    }
+
+    completion_t *c, *next;
+    for (c = g->members; c; c = next)
+    {
+        next = c->next;
+        if (0 != e)
+        {
+            __complete(c, -1);
+            continue;
+        }
+        c->r = r;
+        __park(c);
+    }
+    free(g);
+}
+
+/** Close the group window */
+static void __on_group_timer(uv_timer_t *handle)
+{
+    uv_mutex_lock(&sv->raft_lock);
+    group_t *g = sv->group;
+    if (g)
+    {
+        uint64_t now = uv_hrtime();
+        if (g->deadline <= now)
+            __seal_group(sv);
+        else
+            /* the group was opened after we were armed */
+            uv_timer_start(handle, __on_group_timer,
+                           (g->deadline - now + 999999) / 1000000, 0);
+    }
+    uv_mutex_unlock(&sv->raft_lock);
+}
+
+/** Join the group of requests currently being gathered.
+ * The group is appended to the log as one entry when the group window
+ * closes, or as soon as it fills up. */
+static int __group_commit(completion_t *c)
+{
+    uv_mutex_lock(&sv->raft_lock);
+
+    group_t *g = sv->group;
+    if (!g)
+    {
+        g = sv->group = calloc(1, sizeof(*g));
+        g->deadline = uv_hrtime() + opts.group_window * 1000ULL;
+        g->tail = &g->members;
+
+        /* the timer runs on our own loop, uv timers are in milliseconds */
+        uv_timer_start(&c->worker->group_timer, __on_group_timer,
+                       (opts.group_window + 999) / 1000, 0);
+    }
+
+    c->offset = g->count;
+    c->next = NULL;
+    *g->tail = c;
+    g->tail = &c->next;
+    g->count += c->count;
+
+    if (opts.group_max <= g->count)
+        __seal_group(sv);
+
+    uv_mutex_unlock(&sv->raft_lock);
+    return 1;
+}
+
+/** Hand out a contiguous block of IDs.
+ * Blocks that don't fit into our segment get a lease of their own. */
+static int __lease_block(completion_t *c)
+{
+    int e = segment_alloc_take(&sv->segment, c->count, &c->blk.first);
+    if (1 == e)
+        __prefetch_lease(sv);
+    if (0 <= e)
+        return 0;
+
+    return __commit_block(c);
+}
+
+/** Run a block of leased IDs through the feistel permutation.
+ * The permutation's input is the ID's offset from LEASE_BASE, so with 32-bit
+ * IDs we can hand out 2^32 of them before the space is exhausted. Its output
+ * is moved up into the range starting at FEISTEL_BASE.
+ * @return 0 on success; -1 if the ID space is exhausted */
+static int __permute_block(id_block_t *blk)
+{
+    feistel_t *f = &sv->feistel;
+    uint64_t last = blk->first - LEASE_BASE + blk->count - 1;
+
+    if ((last >> f->bits) != 0)
+        return -1;
+
+    blk->list = malloc(sizeof(*blk->list) * blk->count);
+    for (unsigned int i = 0; i < blk->count; i++)
+        blk->list[i] = FEISTEL_BASE |
+            feistel_encrypt(f, blk->first - LEASE_BASE + i);
+    blk->contiguous = 0;
+    return 0;
+}
+
+/** Parse the "count=N" and "format=bin" query parameters
+ * @return 0 on success; -1 if the query is malformed */
+static int __parse_id_query(h2o_req_t *req, unsigned int *count, int *binary)
+{
+    char query[QUERY_LEN], *tok, *save;
+
+    *count = 1;
+    *binary = 0;
+
+    if (SIZE_MAX == req->query_at)
+        return 0;
+
+    size_t len = req->path.len - req->query_at - 1;
+    if (QUERY_LEN <= len)
+        return -1;
+    memcpy(query, req->path.base + req->query_at + 1, len);
+    query[len] = '\0';
+
+    for (tok = strtok_r(query, "&", &save); tok; tok = strtok_r(NULL, "&", &save))
+    {
+        if (0 == strncmp(tok, "count=", strlen("count=")))
+        {
+            char *end;
+            unsigned long n = strtoul(tok + strlen("count="), &end, 10);
+            if (*end || 0 == n || BATCH_MAX < n)
+                return -1;
+            *count = n;
+        }
+        else if (0 == strcmp(tok, "format=bin"))
+            *binary = 1;
+    }
+    return 0;
+}
+
+static char *__put_u64(char *p, uint64_t v)
+{
+    for (int i = 7; 0 <= i; i--)
+        *p++ = (v >> (i * 8)) & 0xff;
+    return p;
+}
+
+/** Serialize a block of IDs for the response body.
+ * Text is the ID itself, "first-last" for a contiguous block, or a comma
+ * separated list.
+ * Binary is a kind byte (0 for a contiguous block, 1 for a list) followed by
+ * big endian u64s: first and count for a block, count and the IDs for a list. */
+static h2o_iovec_t __serialize_id_block(h2o_req_t *req, id_block_t *blk, int binary)
+{
+    char *buf, *p;
+
+    if (binary)
+    {
+        size_t sz = 1 + 8 * 2 + (blk->contiguous ? 0 : 8 * (blk->count - 1));
+        buf = p = h2o_mem_alloc_pool(&req->pool, sz);
+        *p++ = !blk->contiguous;
+        if (blk->contiguous)
+        {
+            p = __put_u64(p, blk->first);
+            p = __put_u64(p, blk->count);
+        }
+        else
+        {
+            p = __put_u64(p, blk->count);
+            for (unsigned int i = 0; i < blk->count; i++)
+                p = __put_u64(p, blk->list[i]);
+        }
+        return h2o_iovec_init(buf, p - buf);
+    }
+
+    if (blk->contiguous)
+    {
+        buf = h2o_mem_alloc_pool(&req->pool, 21 * 2);
+        if (1 == blk->count)
+            sprintf(buf, "%" PRIu64, blk->first);
+        else
+            sprintf(buf, "%" PRIu64 "-%" PRIu64,
+                    blk->first, blk->first + blk->count - 1);
+        return h2o_iovec_init(buf, strlen(buf));
+    }
+
+    buf = p = h2o_mem_alloc_pool(&req->pool, 21 * blk->count + 1);
+    for (unsigned int i = 0; i < blk->count; i++)
+        p += sprintf(p, i ? ",%" PRIu64 : "%" PRIu64, blk->list[i]);
+    return h2o_iovec_init(buf, p - buf);
+}
+
+/** Find the IDs for the request.
+ * @return 0 if the IDs are in c->blk; 1 if the request was parked and will
+ *  be resumed by its worker; -1 on error */
+static int __serve_ids(completion_t *c)
+{
+    c->blk.contiguous = 1;
+    c->blk.count = c->count;
+
+    switch (opts.id_mode)
+    {
+    case ID_MODE_SEGMENT:
+    case ID_MODE_FEISTEL:
+        if (1 < c->count)
+            return __lease_block(c);
+        return __lease_segment_id(c);
+    case ID_MODE_COUNTER:
+        /* no lookups and nothing stored per ID, only the high-water mark */
+        if (opts.group_window)
+            return __group_commit(c);
+        return __commit_block(c);
+    default:
+        if (opts.group_window)
+            return __group_commit(c);
+        return __append_tickets(c);
+    }
+}
+
+/** Send the state to the client as JSON */
+static void __send_read_state(h2o_req_t *req, read_state_t *st)
+{
+    static h2o_generator_t generator = {NULL, NULL};
+    char *buf = h2o_mem_alloc_pool(&req->pool, 256);
+
+    int len = snprintf(buf, 256,
+                       "{\"node_id\":%d,\"term\":%d,\"commit_idx\":%d,"
+                       "\"last_applied_idx\":%d,\"num_nodes\":%d,"
+                       "\"lease_hi\":%" PRIu64 ",\"last_issued\":%" PRIu64 "}\n",
+                       sv->node_id, st->term, st->commit_idx,
+                       st->last_applied_idx, st->num_nodes,
+                       st->lease_hi, st->last_issued);
+    h2o_iovec_t body = h2o_iovec_init(buf, len);
+
+    req->res.status = 200;
+    req->res.reason = "OK";
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE,
+                   NULL, H2O_STRLIT("application/json"));
+    h2o_start_response(req, &generator);
+    h2o_send(req, &body, 1, 1);
+}
+
+/** Send the IDs to the client, or an error if e isn't 0 */
+static void __respond(completion_t *c, int e)
+{
+    static h2o_generator_t generator = {NULL, NULL};
+    h2o_req_t *req = c->req;
+
+    /* the client went away while we were waiting on Raft */
+    if (!req)
+        goto done;
+
+    *c->ref = NULL;
+
+    if (0 != e)
+    {
+        h2oh_respond_with_error(req, 400, "TRY AGAIN");
+        goto done;
+    }
+
+    if (c->read)
+    {
+        __send_read_state(req, &c->st);
+        goto done;
+    }
+
+    /* feistel IDs are unique because the leased IDs are, no lookups needed */
+    if (ID_MODE_FEISTEL == opts.id_mode && 0 != __permute_block(&c->blk))
+    {
+        h2oh_respond_with_error(req, 503, "ID space exhausted");
+        goto done;
+    }
+
+    /* leased IDs stop short of the feistel range */
+    if (c->blk.contiguous && FEISTEL_BASE - c->blk.first < c->blk.count)
+    {
+        h2oh_respond_with_error(req, 503, "ID space exhausted");
+        goto done;
+    }
+
+    h2o_iovec_t body = __serialize_id_block(req, &c->blk, c->binary);
+
+    req->res.status = 200;
+    req->res.reason = "OK";
+    if (c->binary)
+        h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE,
+                       NULL, H2O_STRLIT("application/octet-stream"));
+    h2o_start_response(req, &generator);
+    h2o_send(req, &body, 1, 1);
+
+done:
+    free(c->blk.list);
+    free(c);
+}
+
+static void __serve(completion_t *c)
+{
+    int e = __serve_ids(c);
+    if (1 != e)
+        __respond(c, e);
+}
+
+/** Resume the requests Raft has finished with */
+static void __on_completed(uv_async_t *async)
+{
+    http_worker_t *w = async->data;
+
+    uv_mutex_lock(&w->lock);
+    completion_t *c = w->done, *next;
+    w->done = NULL;
+    uv_mutex_unlock(&w->lock);
+
+    for (; c; c = next)
+    {
+        next = c->next;
+        if (0 == c->e && c->retry)
+        {
+            c->retry = 0;
+            __serve(c);
+        }
+        else
+            __respond(c, c->e);
+    }
+}
+
+/** The request is being freed, don't respond to it */
+static void __on_req_dispose(void *p)
+{
+    completion_t **ref = p;
+    if (*ref)
+        (*ref)->req = NULL;
+}
+
+/** Send the client over to the leader, who answers for the cluster.
+ * @return 0 if we are the leader; 1 if the client has been answered */
+static int __redirect_to_leader(h2o_req_t *req)
+{
     raft_node_t *leader = raft_get_current_leader_node(sv->raft);
     if (!leader)
-        return h2oh_respond_with_error(req, 503, "Leader unavailable");
+    {
+        h2oh_respond_with_error(req, 503, "Leader unavailable");
+        return 1;
+    }
     else if (raft_node_get_id(leader) != sv->node_id)
     {
         peer_connection_t *leader_conn = raft_node_get_udata(leader);
@@ -300,9 +1103,10 @@ static int __http_get_id(h2o_handler_t *self, h2o_req_t *req)
         req->res.status = 301;
         req->res.reason = "Moved Permanently";
         h2o_start_response(req, &generator);
-        snprintf(leader_url, LEADER_URL_LEN, "http://%s:%d/",
+        snprintf(leader_url, LEADER_URL_LEN, "http://%s:%d%.*s",
                  inet_ntoa(leader_conn->addr.sin_addr),
-                 leader_conn->http_port);
+                 leader_conn->http_port,
+                 (int)req->path.len, req->path.base);
         h2o_add_header(&req->pool,
                        &req->res.headers,
                        H2O_TOKEN_LOCATION,
@@ -310,64 +1114,87 @@ static int __http_get_id(h2o_handler_t *self, h2o_req_t *req)
                        leader_url,
                        strlen(leader_url));
         h2o_send(req, &body, 1, 1);
-        return 0;
+        return 1;
     }
+    return 0;
+}
 
-    int e;
+/** HTTP POST entry point for receiving entries from client
+ * Provide the user with an ID */
+static int __http_get_id(h2o_handler_t *self, h2o_req_t *req)
+{
+    if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("POST")))
+        return -1;
+
+    if (__redirect_to_leader(req))
+        return 0;
 
-    unsigned int ticket = __generate_ticket();
+    unsigned int count;
+    int binary;
 
-    msg_entry_t entry = {};
-    entry.id = rand();
-    entry.data.buf = (void *)&ticket;
-    entry.data.len = sizeof(ticket);
+    if (0 != __parse_id_query(req, &count, &binary))
+        return h2oh_respond_with_error(req, 400, "BAD QUERY");
 
-    uv_mutex_lock(&sv->raft_lock);
+    completion_t *c = calloc(1, sizeof(*c));
+    c->req = req;
+    c->worker = (http_worker_t *)req->conn->ctx;
+    c->count = count;
+    c->binary = binary;
 
-    msg_entry_response_t r;
-    e = raft_recv_entry(sv->raft, &entry, &r);
-    if (0 != e)
-        return h2oh_respond_with_error(req, 500, "BAD");
+    /* we don't block the worker while Raft commits our entry, so the request
+     * might be freed before we get back to it */
+    c->ref = h2o_mem_alloc_shared(&req->pool, sizeof(*c->ref), __on_req_dispose);
+    *c->ref = c;
 
-    /* block until the entry is committed */
-    int done = 0, tries = 0;
-    do
+    __serve(c);
+    return 0;
+}
+
+/** HTTP GET entry point for reading the counters and the cluster's state.
+ * Reads don't go through the log. While we hold a lease they're answered
+ * from the state last published, otherwise a round of heartbeats confirms
+ * we are still leader first (ReadIndex) */
+static int __http_get_status(h2o_handler_t *self, h2o_req_t *req)
+{
+    if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")))
+        return -1;
+
+    if (__redirect_to_leader(req))
+        return 0;
+
+    uv_mutex_lock(&sv->read_lock);
+    read_state_t st = sv->read_state;
+    int leased = uv_hrtime() < sv->lease_deadline;
+    uv_mutex_unlock(&sv->read_lock);
+
+    if (leased)
     {
-        if (3 < tries)
-        {
-            printf("ERROR: failed to commit entry\n");
-            uv_mutex_unlock(&sv->raft_lock);
-            return h2oh_respond_with_error(req, 400, "TRY AGAIN");
-        }
+        __send_read_state(req, &st);
+        return 0;
+    }
 
-        uv_cond_wait(&sv->appendentries_received, &sv->raft_lock);
-        e = raft_msg_entry_response_committed(sv->raft, &r);
-        tries += 1;
-        switch (e)
-        {
-        case 0:
-            /* not committed yet */
-            break;
-        case 1:
-            done = 1;
-            uv_mutex_unlock(&sv->raft_lock);
-            break;
-        case -1:
-            uv_mutex_unlock(&sv->raft_lock);
-            return h2oh_respond_with_error(req, 400, "TRY AGAIN");
-        }
-    } while (!done);
+    completion_t *c = calloc(1, sizeof(*c));
+    c->req = req;
+    c->worker = (http_worker_t *)req->conn->ctx;
+    c->read = 1;
+    c->ref = h2o_mem_alloc_shared(&req->pool, sizeof(*c->ref), __on_req_dispose);
+    *c->ref = c;
+
+    uv_mutex_lock(&sv->raft_lock);
+    int e = raft_read_index_start(sv->raft, &c->rd);
+    if (0 == e)
+    {
+        c->deadline = uv_hrtime() + REQUEST_TIMEOUT_MSEC * 1000000ULL;
+        c->next = sv->reads;
+        sv->reads = c;
 
-    /* serialize ID */
-    char id_str[100];
-    h2o_iovec_t body;
-    sprintf(id_str, "%d", entry.id);
-    body = h2o_iovec_init(id_str, strlen(id_str));
+        /* confirmed already if we are the only node */
+        __confirm_reads(sv);
+    }
+    uv_mutex_unlock(&sv->raft_lock);
 
-    req->res.status = 200;
-    req->res.reason = "OK";
-    h2o_start_response(req, &generator);
-    h2o_send(req, &body, 1, 1);
+    if (0 != e)
+        __respond(c, e);
     return 0;
 }
 
@@ -388,12 +1215,13 @@ static void __on_http_connection(uv_stream_t *listener, const int status)
     if (0 != e)
         uv_fatal(e);
 
-    struct timeval connected_at = *h2o_get_timestamp(&sv->ctx, NULL, NULL);
+    http_worker_t *w = listener->data;
+    struct timeval connected_at = *h2o_get_timestamp(&w->ctx, NULL, NULL);
 
     h2o_socket_t *sock = h2o_uv_socket_create((uv_stream_t *)tcp, (uv_close_cb)free);
-    sv->accept_ctx.ctx = &sv->ctx;
-    sv->accept_ctx.hosts = sv->cfg.hosts;
-    h2o_http1_accept(&sv->accept_ctx, sock, connected_at);
+    w->accept_ctx.ctx = &w->ctx;
+    w->accept_ctx.hosts = sv->cfg.hosts;
+    h2o_http1_accept(&w->accept_ctx, sock, connected_at);
 }
 
 /** Initiate connection if we are disconnected */
@@ -421,74 +1249,206 @@ static int raft_send_requestvote_cb(
     if (-1 == e)
         return 0;
 
-    uv_buf_t bufs[1];
-    char buf[RAFT_BUFLEN];
-    msg_t msg = {};
-    msg.type = MSG_REQUESTVOTE,
-    msg.rv = *m;
-    peer_msg_send(conn->stream, tpl_map("S(I$(IIII))", &msg), bufs, buf);
-    return 0;
+    uv_buf_t bufs[1];
+    char buf[RAFT_BUFLEN];
+    msg_t msg = {};
+    msg.type = MSG_REQUESTVOTE,
+    msg.rv = *m;
+    peer_msg_send(conn->stream, tpl_map("S(I$(IIIII))", &msg), bufs, buf);
+    return 0;
+}
+
+/** Raft callback for sending appendentries message */
+static int raft_send_appendentries_cb(
+    raft_server_t *raft,
+    void *user_data,
+    raft_node_t *node,
+    msg_appendentries_t *m)
+{
+    uv_buf_t bufs[3];
+    peer_connection_t *conn = raft_node_get_udata(node);
+
+    int e = connect_if_needed(conn);
+    if (-1 == e)
+        return 0;
+
+    char buf[RAFT_BUFLEN], *ptr = buf;
+    msg_t msg = {};
+    peer_msg_appendentries(&msg, m);
+    ptr += peer_msg_serialize(tpl_map(PEER_MSG_APPENDENTRIES_FMT, &msg), bufs, ptr);
+
+    /* appendentries with payload.
+     * The entries follow the header as a single tpl image holding an array of
+     * (id, term, type, data) */
+    if (0 < m->n_entries)
+    {
+        msg_entry_t ety;
+        tpl_bin tb;
+        tpl_node *tn = tpl_map("A(IIIB)", &ety.id, &ety.term, &ety.type, &tb);
+        for (int i = 0; i < m->n_entries; i++)
+        {
+            ety = m->entries[i];
+            tb.sz = ety.data.len;
+            tb.addr = ety.data.buf;
+            tpl_pack(tn, 1);
+        }
+
+        size_t sz;
+        void *img;
+        e = tpl_dump(tn, TPL_MEM, &img, &sz);
+        assert(0 == e);
+        tpl_free(tn);
+
+        bufs[1].len = sz;
+        bufs[1].base = img;
+        peer_write(conn->stream, bufs, 2);
+        free(img);
+    }
+    else
+    {
+        /* keep alive appendentries only */
+        peer_write(conn->stream, bufs, 1);
+    }
+
+    return 0;
+}
+
+/** Raft callback for sending timeoutnow message */
+static int raft_send_timeoutnow_cb(
+    raft_server_t *raft,
+    void *user_data,
+    raft_node_t *node,
+    msg_timeoutnow_t *m)
+{
+    peer_connection_t *conn = raft_node_get_udata(node);
+
+    int e = connect_if_needed(conn);
+    if (-1 == e)
+        return 0;
+
+    uv_buf_t bufs[1];
+    char buf[RAFT_BUFLEN];
+    msg_t msg = {};
+    msg.type = MSG_TIMEOUTNOW;
+    msg.tn = *m;
+    peer_msg_send(conn->stream, tpl_map("S(I$(I))", &msg), bufs, buf);
+    return 0;
+}
+
+/** An installsnapshot message whose state is packed by a thread of its
+ * own, so that walking every issued ticket doesn't hold raft_lock */
+struct snapshot_job_s
+{
+    /* NULL once the connection is gone */
+    peer_connection_t *conn;
+
+    /* the header, serialized */
+    uv_buf_t hdr;
+    char buf[RAFT_BUFLEN];
+
+    /* the state besides the tickets, as it was when raft asked */
+    uint64_t lease_hi;
+    int lease_idx;
+    membership_t members;
+
+    tpl_node *tn;
+    unsigned int ticket;
+};
+
+static int __pack_ticket(void *arg, uint32_t ticket)
+{
+    snapshot_job_t *job = arg;
+    job->ticket = ticket;
+    tpl_pack(job->tn, 1);
+    return 0;
+}
+
+/** Pack the snapshot's state, then send it along with its header */
+static void *__send_snapshot(void *arg)
+{
+    snapshot_job_t *job = arg;
+
+    tpl_bin members = {.addr = job->members.members,
+                       .sz = sizeof(member_t) * job->members.count};
+    job->tn = tpl_map("UiBA(u)", &job->lease_hi, &job->lease_idx, &members,
+                      &job->ticket);
+    tpl_pack(job->tn, 0);
+    sv->storage.ops->each_ticket(&sv->storage, __pack_ticket, job);
+
+    size_t sz;
+    void *img;
+    int e = tpl_dump(job->tn, TPL_MEM, &img, &sz);
+    assert(0 == e);
+    tpl_free(job->tn);
+
+    uv_mutex_lock(&sv->raft_lock);
+    if (job->conn)
+    {
+        uv_buf_t bufs[2] = {job->hdr, uv_buf_init(img, sz)};
+        if (CONNECTED == job->conn->connection_status)
+            peer_write(job->conn->stream, bufs, 2);
+        job->conn->snapshot = NULL;
+    }
+    uv_mutex_unlock(&sv->raft_lock);
+
+    free(img);
+    membership_deinit(&job->members);
+    free(job);
+    return NULL;
 }
 
-/** Raft callback for sending appendentries message */
-static int raft_send_appendentries_cb(
+/** Raft callback for sending installsnapshot message.
+ * The state machine's state follows the header as a single tpl image holding
+ * lease_hi, lease_idx, the cluster's members as of m->last_idx and the
+ * array of issued tickets. The tickets are read after raft_lock is released
+ * rather than as of m->last_idx, that's fine because applying the entries
+ * after last_idx again doesn't change the state: lease entries up to
+ * lease_idx are skipped and the tickets are a set. */
+static int raft_send_installsnapshot_cb(
     raft_server_t *raft,
     void *user_data,
     raft_node_t *node,
-    msg_appendentries_t *m)
+    msg_installsnapshot_t *m)
 {
-    uv_buf_t bufs[3];
     peer_connection_t *conn = raft_node_get_udata(node);
 
     int e = connect_if_needed(conn);
     if (-1 == e)
         return 0;
 
-    char buf[RAFT_BUFLEN], *ptr = buf;
+    /* the one being packed goes out soon enough */
+    if (conn->snapshot)
+        return 0;
+
+    snapshot_job_t *job = calloc(1, sizeof(*job));
+    if (!job)
+        return 0;
+
     msg_t msg = {};
-    msg.type = MSG_APPENDENTRIES;
-    msg.ae.term = m->term;
-    msg.ae.prev_log_idx = m->prev_log_idx;
-    msg.ae.prev_log_term = m->prev_log_term;
-    msg.ae.leader_commit = m->leader_commit;
-    msg.ae.n_entries = m->n_entries;
-    ptr += peer_msg_serialize(tpl_map("S(I$(IIIII))", &msg), bufs, ptr);
-
-    /* appendentries with payload */
-    if (0 < m->n_entries)
+    msg.type = MSG_INSTALLSNAPSHOT;
+    msg.is = *m;
+    peer_msg_serialize(tpl_map(PEER_MSG_INSTALLSNAPSHOT_FMT, &msg), &job->hdr, job->buf);
+
+    job->conn = conn;
+    job->lease_hi = sv->lease_hi;
+    job->lease_idx = sv->lease_idx;
+    membership_init(&job->members);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (0 != membership_set(&job->members, sv->members.members,
+                            sv->members.count) ||
+        0 != pthread_create(&thread, &attr, __send_snapshot, job))
     {
-        tpl_bin tb = {
-            .sz = m->entries[0].data.len,
-            .addr = m->entries[0].data.buf};
-
-        /* list of entries */
-        tpl_node *tn = tpl_map("IIIB",
-                               &m->entries[0].id,
-                               &m->entries[0].term,
-                               &m->entries[0].type,
-                               &tb);
-        size_t sz;
-        tpl_pack(tn, 0);
-        tpl_dump(tn, TPL_GETSIZE, &sz);
-        e = tpl_dump(tn, TPL_MEM | TPL_PREALLOCD, ptr, RAFT_BUFLEN);
-        assert(0 == e);
-        bufs[1].len = sz;
-        bufs[1].base = ptr;
-        e = uv_try_write(conn->stream, bufs, 2);
-        if (e < 0) {
-            uv_fatal(e);
- 
-        }
-        tpl_free(tn);
+        /* raft sends it again with the next heartbeat */
+        membership_deinit(&job->members);
+        free(job);
     }
     else
-    {
-        /* keep alive appendentries only */
-        e = uv_try_write(conn->stream, bufs, 1);
-        if (e < 0) {
-            uv_fatal(e);
-        }
-    }
+        conn->snapshot = job;
+    pthread_attr_destroy(&attr);
 
     return 0;
 }
@@ -512,6 +1472,10 @@ static void delete_connection(server_t *sv, peer_connection_t *conn)
 
     }
 
+    /* the snapshot being packed for the peer is dropped */
+    if (conn->snapshot)
+        conn->snapshot->conn = NULL;
+
     // TODO: make sure all resources are freed
     free(conn);
 }
@@ -572,82 +1536,230 @@ static int offer_cfg_change(server_t *sv,
     return 0;
 }
 
-/** Raft callback for applying an entry to the finite state machine */
-static int raft_applylog_cb(
-    raft_server_t *raft,
-    void *udata,
-    raft_entry_t *ety)
+/** Fold a cfg change entry into the members
+ * @return 0 on success; -1 if we ran out of memory */
+static int __fold_cfg_change(membership_t *m, raft_entry_t *ety)
 {
-    MDB_txn *txn;
+    entry_cfg_change_t *change = ety->data.buf;
 
-    MDB_val key = {.mv_size = ety->data.len, .mv_data = ety->data.buf};
-    MDB_val val = {.mv_size = 0, .mv_data = "\0"};
+    if (RAFT_LOGTYPE_REMOVE_NODE == ety->type)
+    {
+        membership_remove(m, change->node_id);
+        return 0;
+    }
 
-    int e = mdb_txn_begin(sv->db_env, NULL, 0, &txn);
-    if (0 != e)
-        mdb_fatal(e);
+    member_t mb = {
+        .node_id = change->node_id,
+        .raft_port = change->raft_port,
+        .http_port = change->http_port,
+        .voting = RAFT_LOGTYPE_ADD_NODE == ety->type,
+    };
+    snprintf(mb.host, sizeof(mb.host), "%s", change->host);
+    return membership_add(m, &mb);
+}
+
+/** Make our nodes those of a snapshot, as if we had the cfg change entries
+ * that were compacted into it. Nodes added by entries the snapshot replaced
+ * are removed */
+static void __install_members(server_t *sv, membership_t *m)
+{
+    for (int i = raft_get_num_nodes(sv->raft) - 1; 0 <= i; i--)
+    {
+        raft_node_t *node = raft_get_node_from_idx(sv->raft, i);
+        int id = raft_node_get_id(node);
+        if (id == sv->node_id || membership_find(m, id))
+            continue;
+
+        peer_connection_t *conn = raft_node_get_udata(node);
+        if (conn)
+            conn->node = NULL;
+        raft_remove_node(sv->raft, node);
+    }
+
+    for (int i = 0; i < m->count; i++)
+    {
+        member_t *mb = &m->members[i];
+        entry_cfg_change_t change = {
+            .raft_port = mb->raft_port,
+            .http_port = mb->http_port,
+            .node_id = mb->node_id,
+        };
+        snprintf(change.host, sizeof(change.host), "%s", mb->host);
+        offer_cfg_change(sv, sv->raft, (void *)&change,
+                         mb->voting ? RAFT_LOGTYPE_ADD_NODE :
+                         RAFT_LOGTYPE_ADD_NONVOTING_NODE);
+    }
+}
+
+/** Carve the lease's range out of the high-water mark.
+ * If the lease is the one we asked for, start handing out its IDs. */
+static int __apply_lease(void *txn, raft_entry_t *ety, int idx,
+                         uint64_t *range_lo)
+{
+    entry_lease_t *lease = ety->data.buf;
+
+    /* we already applied this lease before we restarted */
+    if (idx <= sv->lease_idx)
+        return 0;
+
+    /* Leased IDs start above the 32-bit space random tickets come from, so
+     * moving a cluster off random mode can't hand out an issued ticket */
+    if (sv->lease_hi < LEASE_BASE)
+        sv->lease_hi = LEASE_BASE;
+
+    uint64_t lo = *range_lo = sv->lease_hi;
+    sv->lease_hi += lease->size;
+    sv->lease_idx = idx;
+
+    if (opts.debug)
+        printf("lease %d: [%" PRIu64 ", %" PRIu64 ") size %u to node %d\n",
+               idx, lo, sv->lease_hi, lease->size, lease->node_id);
+
+    if (0 != sv->storage.ops->put_meta(&sv->storage, txn, "lease_hi",
+                                       &sv->lease_hi, sizeof(sv->lease_hi)) ||
+        0 != storage_put_int(&sv->storage, txn, "lease_idx", sv->lease_idx))
+        return -1;
+    return 0;
+}
+
+/** Install a lease of ours into our segment, once it's been committed to
+ * the store. Leases for a single request are handed over by
+ * __complete_applied instead */
+static void __install_lease(raft_entry_t *ety, uint64_t lo)
+{
+    entry_lease_t *lease = ety->data.buf;
+
+    if (LOGTYPE_LEASE != ety->type || 0 == lo ||
+        lease->node_id != sv->node_id || ety->id != sv->lease_ety_id)
+        return;
+
+    segment_alloc_install(&sv->segment, lo, lo + lease->size);
+    sv->lease_ety_id = 0;
+    __resume_segment_waiters(sv);
+}
 
+/** Apply one entry to the finite state machine within txn
+ * @return 0 on success; -1 if the map is full */
+static int __apply_entry(void *txn, raft_entry_t *ety, int idx,
+                         uint64_t *lo)
+{
     /* Check if it's a configuration change */
     if (raft_entry_is_cfg_change(ety))
     {
         entry_cfg_change_t *change = ety->data.buf;
         if (RAFT_LOGTYPE_REMOVE_NODE != ety->type || !raft_is_leader(sv->raft))
-            goto commit;
+            return 0;
 
         peer_connection_t *conn = find_connection(sv, change->host, change->raft_port);
         send_leave_response(conn);
-        goto commit;
+        return 0;
     }
 
-    /* This log affects the ticketd state machine */
-    e = mdb_put(txn, sv->tickets, &key, &val, 0);
-    switch (e)
-    {
-    case 0:
-        break;
-    case MDB_MAP_FULL:
-    {
-        mdb_txn_abort(txn);
+    if (LOGTYPE_LEASE == ety->type)
+        return __apply_lease(txn, ety, idx, lo);
+
+    /* This log affects the ticketd state machine.
+     * The entry holds a batch of one or more tickets */
+    unsigned int *tickets = ety->data.buf;
+    for (unsigned int i = 0; i < ety->data.len / sizeof(*tickets); i++)
+        if (0 != sv->storage.ops->put_ticket(&sv->storage, txn, tickets[i]))
+            return -1;
+    if (0 < ety->data.len)
+        sv->last_ticket = tickets[ety->data.len / sizeof(*tickets) - 1];
+    return 0;
+}
+
+/** Raft callback for applying a run of entries to the finite state machine.
+ * They're applied in one transaction, which matters when we're catching up
+ * on a lot of entries after a restart or a snapshot */
+static int raft_applylog_batch_cb(
+    raft_server_t *raft,
+    void *udata,
+    raft_entry_t *etys,
+    int ety_idx,
+    int n_etys)
+{
+    storage_t *st = &sv->storage;
+    void *txn;
+
+    /* Raft hands the entries back to us if we fail. What they did to our
+     * state has to be undone along with the transaction, so they apply the
+     * same way the next time round */
+    uint64_t lease_hi = sv->lease_hi;
+    int lease_idx = sv->lease_idx;
+    unsigned int last_ticket = sv->last_ticket;
+
+    /* where each lease entry's range starts, for __complete_applied */
+    uint64_t *los = calloc(n_etys, sizeof(*los));
+    if (!los)
         return -1;
-    }
-    default:
-        mdb_fatal(e);
-    }
 
-commit:
+    st->ops->begin(st, &txn);
+
+    for (int i = 0; i < n_etys; i++)
+        if (0 != __apply_entry(txn, &etys[i], ety_idx + i, &los[i]))
+            goto fail;
+
     /* We save the commit idx for performance reasons.
      * Note that Raft doesn't require this as it can figure it out itself. */
-    e = mdb_puts_int(txn, sv->state, "commit_idx", raft_get_commit_idx(raft));
+    if (0 != storage_put_int(st, txn, "commit_idx", raft_get_commit_idx(raft)))
+        goto fail;
 
-    e = mdb_txn_commit(txn);
-    if (0 != e)
-        mdb_fatal(e);
+    if (0 != st->ops->commit(st, txn))
+        goto undo;
 
+    /* a client that was just handed IDs must be able to read them back */
+    __publish_read_state(sv);
+
+    for (int i = 0; i < n_etys; i++)
+    {
+        __install_lease(&etys[i], los[i]);
+        __complete_applied(&etys[i], ety_idx + i, los[i]);
+    }
+    free(los);
     return 0;
+
+fail:
+    st->ops->abort(st, txn);
+undo:
+    sv->lease_hi = lease_hi;
+    sv->lease_idx = lease_idx;
+    sv->last_ticket = last_ticket;
+    free(los);
+    return -1;
 }
 
-/** Raft callback for saving term field to disk.
- * This only returns when change has been made to disk. */
-static int raft_persist_term_cb(
+/** Raft callback for applying an entry to the finite state machine */
+static int raft_applylog_cb(
     raft_server_t *raft,
     void *udata,
-    const int current_term)
+    raft_entry_t *ety)
 {
-    server_t *sv = (server_t *)udata;
-    return  kv_db_set(sv->state_schema, "term",4, &current_term,sizeof(current_term));
-  //  return mdb_puts_int_commit(sv->db_env, sv->state, "term", current_term);
+    return raft_applylog_batch_cb(raft, udata, ety,
+                                  raft_get_last_applied_idx(raft), 1);
 }
 
-/** Raft callback for saving voted_for field to disk.
- * This only returns when change has been made to disk. */
-static int raft_persist_vote_cb(
+/** Raft callback for saving term and voted_for fields to disk.
+ * Both go in one transaction, so a new term and our vote in it cost one
+ * sync. This only returns when change has been made to disk. */
+static int raft_persist_term_vote_cb(
     raft_server_t *raft,
     void *udata,
+    const int current_term,
     const int voted_for)
 {
     server_t *sv = (server_t *)udata;
-    return  kv_db_set(sv->state_schema, "voted_for",9, &voted_for,sizeof(voted_for));
-   // return mdb_puts_int_commit(sv->db_env, sv->state, "voted_for", voted_for);
+    storage_t *st = &sv->storage;
+    void *txn;
+
+    st->ops->begin(st, &txn);
+    if (0 != storage_put_int(st, txn, "term", current_term) ||
+        0 != storage_put_int(st, txn, "voted_for", voted_for))
+    {
+        st->ops->abort(st, txn);
+        return -1;
+    }
+    return st->ops->commit(st, txn);
 }
 
 static void __peer_alloc_cb(uv_handle_t *handle, size_t size, uv_buf_t *buf)
@@ -678,22 +1790,90 @@ static int append_cfg_change(server_t *sv,
     return raft_recv_entry(sv->raft, &entry, &r);
 }
 
-/** Deserialize a single log entry from appendentries message */
-static void deserialize_appendentries_payload(msg_entry_t *out,
-                                                peer_connection_t *conn,
-                                                void *img,
-                                                size_t sz)
+/** Unpack the entries that follow an appendentries header.
+ * The entries' data is allocated by tpl, data holds the buffers so that they
+ * can be freed once the entries have been appended.
+ * @return number of entries */
+static int deserialize_appendentries_payload(msg_entry_t **out,
+                                             void ***data,
+                                             void *img,
+                                             size_t sz)
 {
+    msg_entry_t ety = {};
     tpl_bin tb;
-    tpl_node *tn = tpl_map(tpl_peek(TPL_MEM, img, sz),
-                           &out->id,
-                           &out->term,
-                           &out->type,
-                           &tb);
+    tpl_node *tn = tpl_map("A(IIIB)", &ety.id, &ety.term, &ety.type, &tb);
+    tpl_load(tn, TPL_MEM, img, sz);
+
+    int n = tpl_Alen(tn, 1);
+    *out = calloc(n, sizeof(**out));
+    *data = calloc(n, sizeof(**data));
+    for (int i = 0; tpl_unpack(tn, 1) > 0 && i < n; i++)
+    {
+        ety.data.buf = tb.addr;
+        ety.data.len = tb.sz;
+        (*out)[i] = ety;
+        (*data)[i] = tb.addr;
+    }
+    tpl_free(tn);
+    return n;
+}
+
+/** Replace our state machine's state with the one from a leader's
+ * snapshot, see raft_send_installsnapshot_cb. Our persisted entries are
+ * dropped in the same txn, so a crash leaves either the old state and log or
+ * the snapshot. The snapshot's members become our nodes. */
+static void __load_snapshot_state(msg_installsnapshot_t *is, void *img, size_t sz)
+{
+    uint64_t lease_hi;
+    int lease_idx;
+    tpl_bin members;
+    unsigned int ticket;
+    tpl_node *tn = tpl_map("UiBA(u)", &lease_hi, &lease_idx, &members, &ticket);
     tpl_load(tn, TPL_MEM, img, sz);
     tpl_unpack(tn, 0);
-    out->data.buf = tb.addr;
-    out->data.len = tb.sz;
+
+    if (0 != membership_set(&sv->members, members.addr,
+                            members.sz / sizeof(member_t)))
+    {
+        fprintf(stderr, "out of memory, can't install snapshot\n");
+        exit(1);
+    }
+    free(members.addr);
+
+    storage_t *st = &sv->storage;
+    void *txn;
+    st->ops->begin(st, &txn);
+    st->ops->drop_tickets(st, txn);
+
+    int e = 0;
+    while (0 == e && 0 < tpl_unpack(tn, 1))
+        e = st->ops->put_ticket(st, txn, ticket);
+    tpl_free(tn);
+
+    if (0 == e)
+        e = st->ops->put_meta(st, txn, "lease_hi", &lease_hi, sizeof(lease_hi)) ||
+            storage_put_int(st, txn, "lease_idx", lease_idx) ||
+            storage_put_int(st, txn, "snapshot_idx", is->last_idx) ||
+            storage_put_int(st, txn, "snapshot_term", is->last_term) ||
+            membership_save(&sv->members, st, txn, "snapshot_members") ||
+            storage_put_int(st, txn, "commit_idx", is->last_idx);
+    if (0 != e)
+    {
+        fprintf(stderr, "storage is full, can't install snapshot\n");
+        exit(1);
+    }
+
+    st->ops->commit(st, txn);
+
+    /* our entries are superseded by the snapshot. If we crash before they're
+     * gone, __load_commit_log drops them */
+    if (0 != wal_reset(&sv->wal))
+        wal_fatal();
+
+    sv->lease_hi = lease_hi;
+    sv->lease_idx = lease_idx;
+
+    __install_members(sv, &sv->members);
 }
 
 /** Parse raft peer traffic using binary protocol, and respond to message */
@@ -709,23 +1889,45 @@ static int deserialize_and_handle_msg(void *img, size_t sz, void *data)
     /* special case: handle appendentries payload */
     if (0 < conn->n_expected_entries)
     {
-        msg_entry_t entry;
-
-        deserialize_appendentries_payload(&entry, conn, img, sz);
+        msg_entry_t *entries;
+        void **data;
+        int n = deserialize_appendentries_payload(&entries, &data, img, sz);
 
-        conn->ae.ae.entries = &entry;
+        /* the whole batch is appended in one go */
+        conn->ae.ae.entries = entries;
+        conn->ae.ae.n_entries = n;
         msg_t msg = {.type = MSG_APPENDENTRIES_RESPONSE};
         e = raft_recv_appendentries(sv->raft, conn->node, &conn->ae.ae, &msg.aer);
 
         /* send response */
         uv_buf_t bufs[1];
         char buf[RAFT_BUFLEN];
-        peer_msg_send(conn->stream, tpl_map("S(I$(IIII))", &msg), bufs, buf);
+        peer_msg_send(conn->stream, tpl_map(PEER_MSG_APPENDENTRIES_RESPONSE_FMT, &msg), bufs, buf);
+
+        /* appended entries point at their copy on disk by now */
+        for (int i = 0; i < n; i++)
+            free(data[i]);
+        free(data);
+        free(entries);
 
         conn->n_expected_entries = 0;
         return 0;
     }
 
+    /* special case: handle installsnapshot payload */
+    if (0 < conn->is.last_idx)
+    {
+        msg_t msg = {.type = MSG_APPENDENTRIES_RESPONSE};
+        e = raft_recv_installsnapshot(sv->raft, conn->node, &conn->is, &msg.aer);
+        if (0 == e)
+            __load_snapshot_state(&conn->is, img, sz);
+
+        peer_msg_send(conn->stream, tpl_map(PEER_MSG_APPENDENTRIES_RESPONSE_FMT, &msg), bufs, buf);
+
+        conn->is.last_idx = 0;
+        return 0;
+    }
+
     /* deserialize message */
     tpl_node *tn = tpl_map(tpl_peek(TPL_MEM, img, sz), &m);
     tpl_load(tn, TPL_MEM, img, sz);
@@ -831,7 +2033,7 @@ static int deserialize_and_handle_msg(void *img, size_t sz, void *data)
     {
         msg_t msg = {.type = MSG_REQUESTVOTE_RESPONSE};
         e = raft_recv_requestvote(sv->raft, conn->node, &m.rv, &msg.rvr);
-        peer_msg_send(conn->stream, tpl_map("S(I$(II))", &msg), bufs, buf);
+        peer_msg_send(conn->stream, tpl_map("S(I$(III))", &msg), bufs, buf);
     }
     break;
     case MSG_REQUESTVOTE_RESPONSE:
@@ -849,11 +2051,19 @@ static int deserialize_and_handle_msg(void *img, size_t sz, void *data)
         /* this is a keep alive message */
         msg_t msg = {.type = MSG_APPENDENTRIES_RESPONSE};
         e = raft_recv_appendentries(sv->raft, conn->node, &m.ae, &msg.aer);
-        peer_msg_send(conn->stream, tpl_map("S(I$(IIII))", &msg), bufs, buf);
+        peer_msg_send(conn->stream, tpl_map(PEER_MSG_APPENDENTRIES_RESPONSE_FMT, &msg), bufs, buf);
         break;
     case MSG_APPENDENTRIES_RESPONSE:
+        /* this applies newly committed entries, which resumes the requests
+         * waiting on them */
         e = raft_recv_appendentries_response(sv->raft, conn->node, &m.aer);
-        uv_cond_signal(&sv->appendentries_received);
+        break;
+    case MSG_INSTALLSNAPSHOT:
+        /* special case: get ready to handle the state that follows */
+        conn->is = m.is;
+        break;
+    case MSG_TIMEOUTNOW:
+        e = raft_recv_timeoutnow(sv->raft, conn->node, &m.tn);
         break;
     default:
         printf("unknown msg\n");
@@ -884,6 +2094,10 @@ static void __peer_read_cb(uv_stream_t *tcp, ssize_t nread, const uv_buf_t *buf)
         uv_mutex_lock(&sv->raft_lock);
         tpl_gather(TPL_GATHER_MEM, buf->base, nread, &conn->gt,
                    deserialize_and_handle_msg, conn);
+
+        /* responses to our heartbeats extend our lease */
+        __confirm_reads(sv);
+        __publish_read_state(sv);
         uv_mutex_unlock(&sv->raft_lock);
     }
 }
@@ -1080,106 +2294,90 @@ void raft_log_cb(raft_server_t *raft, raft_node_t *node, void *udata,
         printf("raft: %s\n", buf);
 }
 
-/** Raft callback for appending an item to the log */
-static int raft_logentry_offer_cb(
+/** Raft callback for appending a run of items to the log.
+ * All of them are appended to the WAL and synced together, so a whole
+ * appendentries message or group commit costs a single fdatasync.
+ * On the leader this runs once the entries have been sent to the followers,
+ * so our sync overlaps with theirs instead of holding up replication */
+static int raft_logentry_offer_batch_cb(
     raft_server_t *raft,
     void *udata,
-    raft_entry_t *ety,
-    int ety_idx)
+    raft_entry_t *etys,
+    int ety_idx,
+    int n_etys)
 {
-    MDB_txn *txn;
-
-    if (raft_entry_is_cfg_change(ety))
-        offer_cfg_change(sv, raft, ety->data.buf, ety->type);
-
-    int e = mdb_txn_begin(sv->db_env, NULL, 0, &txn);
-    if (0 != e)
-        mdb_fatal(e);
-
-    uv_buf_t bufs[1];
-    char buf[RAFT_BUFLEN];
-    peer_msg_serialize(tpl_map("S(III)", ety), bufs, buf);
+    int i;
 
-    /* 1. put metadata */
-    ety_idx <<= 1;
-    MDB_val key = {.mv_size = sizeof(ety_idx), .mv_data = (void *)&ety_idx};
-    MDB_val val = {.mv_size = bufs->len, .mv_data = bufs->base};
+    for (i = 0; i < n_etys; i++)
+        if (raft_entry_is_cfg_change(&etys[i]))
+            offer_cfg_change(sv, raft, etys[i].data.buf, etys[i].type);
 
-    e = mdb_put(txn, sv->entries, &key, &val, 0);
-    switch (e)
-    {
-    case 0:
-        break;
-    case MDB_MAP_FULL:
-    {
-        mdb_txn_abort(txn);
+    /* where each entry's data landed in the WAL */
+    const char **recs = calloc(n_etys, sizeof(*recs));
+    if (!recs)
         return -1;
-    }
-    default:
-        mdb_fatal(e);
-    }
-
-    /* 2. put entry */
-    ety_idx |= 1;
-    key.mv_size = sizeof(ety_idx);
-    key.mv_data = (void *)&ety_idx;
-    val.mv_size = ety->data.len;
-    val.mv_data = ety->data.buf;
 
-    e = mdb_put(txn, sv->entries, &key, &val, 0);
-    switch (e)
+    for (i = 0; i < n_etys; i++)
     {
-    case 0:
-        break;
-    case MDB_MAP_FULL:
-    {
-        mdb_txn_abort(txn);
-        return -1;
-    }
-    default:
-        mdb_fatal(e);
-    }
+        raft_entry_t *ety = &etys[i];
+        uint64_t idx = ety_idx + i + 1;
 
-    e = mdb_txn_commit(txn);
-    if (0 != e)
-        mdb_fatal(e);
+        /* entries read back from the WAL by __load_commit_log are offered
+         * again, they are already in it */
+        if (idx < sv->wal.next_idx)
+            continue;
 
-    /* So that our entry points to a valid buffer, get the mmap'd buffer.
-     * This is because the currently pointed to buffer is temporary. */
-    e = mdb_txn_begin(sv->db_env, NULL, 0, &txn);
-    if (0 != e)
-        mdb_fatal(e);
+        wal_entry_t hdr = {.term = ety->term, .id = ety->id, .type = ety->type};
+        struct iovec iov[] = {
+            {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+            {.iov_base = ety->data.buf, .iov_len = ety->data.len}};
 
-    e = mdb_get(txn, sv->entries, &key, &val);
-    switch (e)
-    {
-    case 0:
-        break;
-    default:
-        mdb_fatal(e);
+        if (0 != wal_append(&sv->wal, idx, iov, len(iov), &recs[i]))
+        {
+            /* Our own entries have been sent to the followers already, so
+             * Raft keeps them and offers them again later. By then the
+             * buffers they point at are gone */
+            if (raft_is_leader(raft))
+                wal_fatal();
+
+            wal_truncate_tail(&sv->wal, ety_idx + 1);
+            free(recs);
+            return -1;
+        }
     }
-    ety->data.buf = val.mv_data;
-    ety->data.len = val.mv_size;
 
-    e = mdb_txn_commit(txn);
-    if (0 != e)
-        mdb_fatal(e);
+    if (0 != wal_sync(&sv->wal))
+        wal_fatal();
 
+    /* So that our entries point to valid buffers, use their copy in the
+     * WAL's mapping. This is because the currently pointed to buffers are
+     * temporary. */
+    for (i = 0; i < n_etys; i++)
+        if (recs[i])
+            etys[i].data.buf = (void *)(recs[i] + sizeof(wal_entry_t));
+    free(recs);
     return 0;
 }
 
-/** Raft callback for removing the first entry from the log
- * @note this is provided to support log compaction in the future */
+/** Raft callback for appending an item to the log */
+static int raft_logentry_offer_cb(
+    raft_server_t *raft,
+    void *udata,
+    raft_entry_t *ety,
+    int ety_idx)
+{
+    return raft_logentry_offer_batch_cb(raft, udata, ety, ety_idx, 1);
+}
+
+/** Raft callback for removing the first entry from the log.
+ * This happens when the log is compacted, see __compact_log */
 static int raft_logentry_poll_cb(
     raft_server_t *raft,
     void *udata,
     raft_entry_t *entry,
     int ety_idx)
 {
-    MDB_val k, v;
-
-    mdb_poll(sv->db_env, sv->entries, &k, &v);
-
+    sv->wal_head = ety_idx + 2;
     return 0;
 }
 
@@ -1192,10 +2390,7 @@ static int raft_logentry_pop_cb(
     raft_entry_t *entry,
     int ety_idx)
 {
-    MDB_val k, v;
-
-    mdb_pop(sv->db_env, sv->entries, &k, &v);
-
+    wal_truncate_tail(&sv->wal, ety_idx + 1);
     return 0;
 }
 
@@ -1217,103 +2412,144 @@ static void raft_node_has_sufficient_logs_cb(
 raft_cbs_t raft_funcs = {
     .send_requestvote = raft_send_requestvote_cb,
     .send_appendentries = raft_send_appendentries_cb,
+    .send_installsnapshot = raft_send_installsnapshot_cb,
+    .send_timeoutnow = raft_send_timeoutnow_cb,
     .applylog = raft_applylog_cb,
-    .persist_vote = raft_persist_vote_cb,
-    .persist_term = raft_persist_term_cb,
+    .applylog_batch = raft_applylog_batch_cb,
+    .persist_term_vote = raft_persist_term_vote_cb,
     .log_offer = raft_logentry_offer_cb,
+    .log_offer_batch = raft_logentry_offer_batch_cb,
     .log_poll = raft_logentry_poll_cb,
     .log_pop = raft_logentry_pop_cb,
     .node_has_sufficient_logs = raft_node_has_sufficient_logs_cb,
     .log = raft_log_cb,
 };
 
+/** Compact the log, keeping the last snapshot_entries entries around for
+ * followers that are a little behind.
+ * The state machine lives in LMDB and is up to date with every applied
+ * entry, so taking a snapshot is only a matter of recording where it is. */
+static void __compact_log(server_t *sv)
+{
+    int idx = raft_get_last_applied_idx(sv->raft) - opts.snapshot_entries;
+    if (0 == opts.snapshot_entries ||
+        idx - raft_get_snapshot_last_idx(sv->raft) < opts.snapshot_entries)
+        return;
+
+    /* the snapshot has to say who the cluster is once the cfg change
+     * entries are gone */
+    for (int i = raft_get_snapshot_last_idx(sv->raft) + 1; i <= idx; i++)
+    {
+        raft_entry_t *ety = raft_get_entry_from_idx(sv->raft, i);
+        if (raft_entry_is_cfg_change(ety) &&
+            0 != __fold_cfg_change(&sv->members, ety))
+        {
+            fprintf(stderr, "out of memory, can't compact the log\n");
+            exit(1);
+        }
+    }
+
+    if (0 != raft_compact_log(sv->raft, idx))
+        return;
+
+    storage_t *st = &sv->storage;
+    void *txn;
+    st->ops->begin(st, &txn);
+    if (0 != storage_put_int(st, txn, "snapshot_idx", idx) ||
+        0 != storage_put_int(st, txn, "snapshot_term",
+                             raft_get_snapshot_last_term(sv->raft)) ||
+        0 != membership_save(&sv->members, st, txn, "snapshot_members"))
+    {
+        fprintf(stderr, "storage is full, can't compact the log\n");
+        exit(1);
+    }
+    st->ops->commit(st, txn);
+
+    /* the snapshot is durable, the compacted entries can go */
+    if (0 != wal_truncate_head(&sv->wal, sv->wal_head))
+        wal_fatal();
+}
+
 /** Raft callback for handling periodic logic */
 static void __periodic(uv_timer_t *handle)
 {
     uv_mutex_lock(&sv->raft_lock);
 
-    raft_periodic(sv->raft, PERIOD_MSEC);
+    raft_periodic(sv->raft, opts.heartbeat_ms);
 
-    if (opts.leave)
+    if (opts.leave || sv->leaving)
     {
+        /* while leaving as leader, we wait for the new leader */
         raft_node_t *leader = raft_get_current_leader_node(sv->raft);
-        if (leader)
+        if (leader && raft_node_get_id(leader) != sv->node_id)
         {
             peer_connection_t *leader_conn = raft_node_get_udata(leader);
-            assert(raft_node_get_id(leader) != sv->node_id);
             __send_leave(leader_conn);
         }
     }
 
     raft_apply_all(sv->raft);
 
+    __expire_requests(sv);
+
+    __confirm_reads(sv);
+
+    __publish_read_state(sv);
+
+    __compact_log(sv);
+
     uv_mutex_unlock(&sv->raft_lock);
 }
 
-/** Load all log entries we have persisted to disk */
-static void __load_commit_log(server_t *sv)
+/** Hand an entry read back from the WAL to Raft */
+static int __load_entry(void *arg, uint64_t idx, const char *rec, uint32_t len)
 {
-    MDB_cursor *curs;
-    MDB_txn *txn;
-    MDB_val k, v;
-    int e;
+    server_t *sv = arg;
+    const wal_entry_t *hdr = (const wal_entry_t *)rec;
 
-    e = mdb_txn_begin(sv->db_env, NULL, MDB_RDONLY, &txn);
-    if (0 != e)
-        mdb_fatal(e);
+    /* compacted into our snapshot, its segment just wasn't deleted yet */
+    if (idx <= (uint64_t)raft_get_snapshot_last_idx(sv->raft))
+        return 0;
 
-    e = mdb_cursor_open(txn, sv->entries, &curs);
-    if (0 != e)
-        mdb_fatal(e);
+    raft_entry_t ety = {.term = hdr->term, .id = hdr->id, .type = hdr->type};
+    ety.data.buf = (void *)(rec + sizeof(*hdr));
+    ety.data.len = len - sizeof(*hdr);
+    raft_append_entry(sv->raft, &ety);
+    return 0;
+}
 
-    e = mdb_cursor_get(curs, &k, &v, MDB_FIRST);
-    switch (e)
+/** Load all log entries we have persisted to disk */
+static void __load_commit_log(server_t *sv)
+{
+    /* the entries we have follow on from our snapshot */
+    int snapshot_idx = 0, snapshot_term = 0;
+    storage_get_int(&sv->storage, "snapshot_idx", &snapshot_idx);
+    storage_get_int(&sv->storage, "snapshot_term", &snapshot_term);
+    if (0 < snapshot_idx)
     {
-    case 0:
-        break;
-    case MDB_NOTFOUND:
-        return;
-    default:
-        mdb_fatal(e);
-    }
+        raft_load_snapshot(sv->raft, snapshot_idx, snapshot_term);
 
-    raft_entry_t ety;
-    ety.id = 0;
-
-    int n_entries = 0;
-
-    do
-    {
-        if (!(*(int *)k.mv_data & 1))
-        {
-            /* entry metadata */
-            tpl_node *tn =
-                tpl_map(tpl_peek(TPL_MEM, v.mv_data, v.mv_size), &ety);
-            tpl_load(tn, TPL_MEM, v.mv_data, v.mv_size);
-            tpl_unpack(tn, 0);
-        }
-        else
-        {
-            /* entry data for FSM */
-            ety.data.buf = v.mv_data;
-            ety.data.len = v.mv_size;
-            raft_append_entry(sv->raft, &ety);
-            n_entries++;
-        }
+        /* the cfg change entries that made the cluster were compacted */
+        if (0 == membership_load(&sv->members, &sv->storage,
+                                 "snapshot_members"))
+            __install_members(sv, &sv->members);
+    }
 
-        e = mdb_cursor_get(curs, &k, &v, MDB_NEXT);
-    } while (0 == e);
+    /* we crashed while installing a snapshot, before dropping our entries */
+    if (0 != sv->wal.next_idx && sv->wal.next_idx <= (uint64_t)snapshot_idx &&
+        0 != wal_reset(&sv->wal))
+        wal_fatal();
 
-    mdb_cursor_close(curs);
+    /* the log might be empty after a snapshot, we still need the state */
+    wal_replay(&sv->wal, __load_entry, sv);
 
-    e = mdb_txn_commit(txn);
-    if (0 != e)
-        mdb_fatal(e);
+    int commit_idx;
+    if (0 == storage_get_int(&sv->storage, "commit_idx", &commit_idx))
+        raft_set_commit_idx(sv->raft, commit_idx);
 
-    MDB_val val;
-    mdb_gets(sv->db_env, sv->state, "commit_idx", &val);
-    if (val.mv_data)
-        raft_set_commit_idx(sv->raft, *(int *)val.mv_data);
+    sv->storage.ops->get_meta(&sv->storage, "lease_hi", &sv->lease_hi,
+                              sizeof(sv->lease_hi));
+    storage_get_int(&sv->storage, "lease_idx", &sv->lease_idx);
 
     raft_apply_all(sv->raft);
 }
@@ -1322,38 +2558,47 @@ static void __load_commit_log(server_t *sv)
 static void load_persistent_state(server_t *sv)
 {
     int val = -1;
-    kv_schema_t *sv->state_schema;
 
-    //mdb_gets_int(sv->db_env, sv->state, "voted_for", &val);
-    int *val_ptr = (int *)kv_db_get(sv->state_schema,"voted_for",9);
-    val = *val_ptr;
+    storage_get_int(&sv->storage, "voted_for", &val);
     raft_vote_for_nodeid(sv->raft, val);
-   // mdb_gets_int(sv->db_env, sv->state, "term", &val);
-    kv_db_set(sv->state_schema,"term",4,&val,sizeof(val));
-
+    val = 0;
+    storage_get_int(&sv->storage, "term", &val);
     raft_set_current_term(sv->raft, val);
 }
 
 static int load_opts(server_t *sv, options_t *opts)
 {
-    int http_port, raft_port;
+    char port[16] = {};
 
-    sv->node_id = *(int *)kv_db_get(sv->state_schema, "id", 2);
-    opts->raft_port = (char *)kv_db_get(sv->state_schema, "raft_port", 9);
-    opts->http_port = (char *)kv_db_get(sv->state_schema, "http_port", 9);
+    if (0 != storage_get_int(&sv->storage, "id", &sv->node_id))
+        return -1;
 
-    if (srv->node_id == NULL||pts->raft_port == NULL || opts->http_port == NULL)
-    {
+    if (-1 == sv->storage.ops->get_meta(&sv->storage, "raft_port", port,
+                                        sizeof(port) - 1))
         return -1;
-    }
+    opts->raft_port = strdup(port);
+
+    memset(port, 0, sizeof(port));
+    if (-1 == sv->storage.ops->get_meta(&sv->storage, "http_port", port,
+                                        sizeof(port) - 1))
+        return -1;
+    opts->http_port = strdup(port);
     return 0;
 }
 
 static void __http_worker_start(void *uv_tcp)
 {
     uv_tcp_t *listener = uv_tcp;
+    http_worker_t *w = listener->data;
 
-    h2o_context_init(&sv->ctx, listener->loop, &sv->cfg);
+    /* each worker has its own h2o context, requests find their way back to
+     * the worker through it */
+    h2o_context_init(&w->ctx, listener->loop, &sv->cfg);
+
+    uv_mutex_init(&w->lock);
+    w->completed.data = w;
+    uv_async_init(listener->loop, &w->completed, __on_completed);
+    uv_timer_init(listener->loop, &w->group_timer);
 
     int e = uv_listen((uv_stream_t *)listener,
                       MAX_HTTP_CONNECTIONS,
@@ -1366,8 +2611,10 @@ static void __http_worker_start(void *uv_tcp)
 
 static void __drop_db(server_t *sv)
 {
-    MDB_dbi dbs[] = {sv->entries, sv->tickets, sv->state};
-    mdb_drop_dbs(sv->db_env, dbs, len(dbs));
+    sv->storage.ops->drop(&sv->storage);
+    if (0 != wal_reset(&sv->wal))
+        wal_fatal();
+    wal_close(&sv->wal);
 }
 
 static void start_raft_periodic_timer(server_t *sv)
@@ -1375,8 +2622,57 @@ static void start_raft_periodic_timer(server_t *sv)
     uv_timer_t *periodic_req = calloc(1, sizeof(uv_timer_t));
     periodic_req->data = sv;
     uv_timer_init(&sv->peer_loop, periodic_req);
-    uv_timer_start(periodic_req, __periodic, 0, PERIOD_MSEC);
-    raft_set_election_timeout(sv->raft, 2000);
+    /* the timer only drives heartbeats and elections, entries are applied
+     * as soon as they are committed */
+    uv_timer_start(periodic_req, __periodic, 0, opts.heartbeat_ms);
+    raft_set_request_timeout(sv->raft, opts.heartbeat_ms);
+    raft_set_election_timeout(sv->raft, opts.election_ms);
+    raft_set_appendentries_max_entries(sv->raft, opts.append_max_entries);
+    raft_set_appendentries_max_bytes(sv->raft, opts.append_max_bytes);
+    raft_set_appendentries_max_inflight(sv->raft, opts.append_max_inflight);
+
+    /* a node that comes back from a network blip mustn't depose a healthy
+     * leader, that stalls allocation for a whole election */
+    raft_set_prevote(sv->raft, 1);
+
+    /* pre-votes keep followers loyal to a leader they hear from, which is
+     * what lets the leader answer reads on its own for a while */
+    raft_set_read_lease(sv->raft, opts.read_lease_ms);
+}
+
+/** Hand leadership over to the follower that's furthest along, so that it
+ * can take over within a round trip instead of an election timeout.
+ * Must be called with raft_lock held.
+ * @return 0 on success */
+static int __transfer_leadership(server_t *sv)
+{
+    raft_node_t *best = NULL;
+
+    for (int i = 0; i < raft_get_num_nodes(sv->raft); i++)
+    {
+        raft_node_t *node = raft_get_node_from_idx(sv->raft, i);
+        if (raft_node_get_id(node) == sv->node_id ||
+            !raft_node_is_voting(node) || !raft_node_get_udata(node))
+            continue;
+        if (!best || raft_node_get_match_idx(best) < raft_node_get_match_idx(node))
+            best = node;
+    }
+
+    if (!best)
+        return -1;
+    printf("Handing leadership over to node %d...\n", raft_node_get_id(best));
+    return raft_transfer_leadership(sv->raft, best);
+}
+
+/** SIGUSR1 asks the leader to step down, eg. before it's restarted */
+static void __usr1_handler(int dummy)
+{
+    uv_mutex_lock(&sv->raft_lock);
+    if (!raft_is_leader(sv->raft))
+        printf("I'm not the leader...\n");
+    else if (0 != __transfer_leadership(sv))
+        printf("Can't hand leadership over at the moment...\n");
+    uv_mutex_unlock(&sv->raft_lock);
 }
 
 static void __int_handler(int dummy)
@@ -1385,9 +2681,13 @@ static void __int_handler(int dummy)
     raft_node_t *leader = raft_get_current_leader_node(sv->raft);
     if (leader)
     {
+        /* we leave once the new leader has taken over, see __periodic */
         if (raft_node_get_id(leader) == sv->node_id)
         {
-            printf("I'm the leader, I can't leave the cluster...\n");
+            if (0 == __transfer_leadership(sv))
+                sv->leaving = 1;
+            else
+                printf("I'm the leader, I can't leave the cluster...\n");
             goto done;
         }
 
@@ -1406,12 +2706,21 @@ done:
 
 static void new_db(server_t *sv)
 {
-    // kv_db_t *kv_db_alloc(const char *database_name, const char *database_dir)
-    sv->db = kv_db_alloc("seq_db", "/tmp");
-    // kv_schema_t *kv_schema_alloc(const char *name, void *ctx,bool is_force_drop);
-    sv->entries_schema = kv_schema_alloc("entries", sv->db, false);
-    sv->tickets_schema = kv_schema_alloc("docs", sv->db, false);
-    sv->state_schema = kv_schema_alloc("state", sv->db, false);
+    char path[PATH_MAX];
+
+    mkdir(DB_DIR, 0755);
+
+    if (0 != storage_init(&sv->storage, opts.storage) ||
+        0 != sv->storage.ops->open(&sv->storage, DB_DIR))
+    {
+        fprintf(stderr, "ERROR: can't open %s storage in %s\n",
+                opts.storage, DB_DIR);
+        exit(1);
+    }
+
+    snprintf(path, PATH_MAX, "%s/wal", DB_DIR);
+    if (0 != wal_open(&sv->wal, path, (uint64_t)opts.wal_segment_mb << 20))
+        wal_fatal();
 }
 
 static void __start_http_socket(server_t *sv, const char *host, int port, uv_tcp_t *listen, uv_multiplex_t *m)
@@ -1424,7 +2733,7 @@ static void __start_http_socket(server_t *sv, const char *host, int port, uv_tcp
     uv_multiplex_init(m, listen, IPC_PIPE_NAME, HTTP_WORKERS,
                       __http_worker_start);
     for (int i = 0; i < HTTP_WORKERS; i++)
-        uv_multiplex_worker_create(m, i, NULL);
+        uv_multiplex_worker_create(m, i, &sv->workers[i]);
     uv_multiplex_dispatch(m);
 }
 
@@ -1444,11 +2753,16 @@ static void __start_peer_socket(server_t *sv, const char *host, int port, uv_tcp
 
 static void save_opts(server_t *sv, options_t *opts)
 {
-
-    kv_schema_t *state_schema = sv->state_schema;
-    kv_db_set(state_schema, "raft_port", 9, opts->raft_port, strlen(opts->raft_port));
-    kv_db_set(state_schema, "http_port", 9, opts->http_port, strlen(opts->http_port));
-    kv_db_set(state_schema, "id", 2, sv->id, sizeof(sv->id));
+    storage_t *st = &sv->storage;
+    void *txn;
+
+    st->ops->begin(st, &txn);
+    st->ops->put_meta(st, txn, "raft_port", opts->raft_port,
+                      strlen(opts->raft_port));
+    st->ops->put_meta(st, txn, "http_port", opts->http_port,
+                      strlen(opts->http_port));
+    storage_put_int(st, txn, "id", sv->node_id);
+    st->ops->commit(st, txn);
 }
 
 int main(int argc, char **argv)
@@ -1464,6 +2778,7 @@ int main(int argc, char **argv)
 
     signal(SIGPIPE, SIG_IGN);
     signal(SIGINT, __int_handler);
+    signal(SIGUSR1, __usr1_handler);
 
     sv->raft = raft_new();
     // add server context
@@ -1490,15 +2805,28 @@ int main(int argc, char **argv)
                                         h2o_iovec_init(H2O_STRLIT("default")),
                                         ANYPORT);
 
+    /* HTTP route for reads, which don't touch the log */
+    pathconf = h2o_config_register_path(hostconf, "/status", 0);
+    handler = h2o_create_handler(pathconf, sizeof(*handler));
+    handler->on_req = __http_get_status;
+
     /* HTTP route for receiving entries from clients */
     pathconf = h2o_config_register_path(hostconf, "/", 0);
     h2o_chunked_register(pathconf);
     handler = h2o_create_handler(pathconf, sizeof(*handler));
     handler->on_req = __http_get_id;
 
-    /* lock and condition to support HTTP client blocking */
+    /* lock and queue of HTTP requests waiting on Raft */
     uv_mutex_init(&sv->raft_lock);
-    uv_cond_init(&sv->appendentries_received);
+    uv_mutex_init(&sv->read_lock);
+    sv->completions_tail = &sv->completions;
+    segment_alloc_init(&sv->segment, opts.prefetch_threshold);
+    membership_init(&sv->members);
+    segment_alloc_set_sizing(&sv->segment, opts.segment_size, opts.segment_min,
+                             opts.segment_max, opts.lease_interval);
+    if (ID_MODE_FEISTEL == opts.id_mode)
+        feistel_init(&sv->feistel, opts.id_bits, opts.feistel_key,
+                     strlen(opts.feistel_key));
 
     uv_tcp_t http_listen, peer_listen;
     uv_multiplex_t m;
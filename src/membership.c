@@ -0,0 +1,98 @@
+/*************************************************************************
+  > File Name: membership.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 11:04:52 PM UTC
+ ************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "membership.h"
+
+void membership_init(membership_t *m)
+{
+  m->count = 0;
+  m->members = NULL;
+}
+void membership_deinit(membership_t *m)
+{
+  free(m->members);
+  membership_init(m);
+}
+member_t *membership_find(membership_t *m, int node_id)
+{
+  for (int i = 0; i < m->count; i++)
+  {
+    if (m->members[i].node_id == node_id)
+    {
+      return &m->members[i];
+    }
+  }
+  return NULL;
+}
+int membership_add(membership_t *m, const member_t *mb)
+{
+  member_t *cur = membership_find(m, mb->node_id);
+  if (cur != NULL)
+  {
+    *cur = *mb;
+    return 0;
+  }
+  member_t *members = realloc(m->members, sizeof(*members) * (m->count + 1));
+  if (members == NULL)
+  {
+    return -1;
+  }
+  members[m->count++] = *mb;
+  m->members = members;
+  return 0;
+}
+void membership_remove(membership_t *m, int node_id)
+{
+  member_t *cur = membership_find(m, node_id);
+  if (cur == NULL)
+  {
+    return;
+  }
+  // order doesn't matter, the last member fills the hole
+  *cur = m->members[--m->count];
+}
+int membership_set(membership_t *m, const member_t *members, int count)
+{
+  member_t *copy = NULL;
+  if (count > 0)
+  {
+    copy = malloc(sizeof(*copy) * count);
+    if (copy == NULL)
+    {
+      return -1;
+    }
+    memcpy(copy, members, sizeof(*copy) * count);
+  }
+  free(m->members);
+  m->members = copy;
+  m->count = count;
+  return 0;
+}
+int membership_save(membership_t *m, storage_t *st, void *txn, const char *key)
+{
+  return st->ops->put_meta(st, txn, key, m->members, sizeof(member_t) * m->count);
+}
+int membership_load(membership_t *m, storage_t *st, const char *key)
+{
+  member_t first;
+  membership_deinit(m);
+  int len = st->ops->get_meta(st, key, &first, sizeof(first));
+  if (len <= 0 || len % sizeof(member_t) != 0)
+  {
+    return -1;
+  }
+  m->members = malloc(len);
+  if (m->members == NULL)
+  {
+    return -1;
+  }
+  st->ops->get_meta(st, key, m->members, len);
+  m->count = len / sizeof(member_t);
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*************************************************************************
+  > File Name: membership.h
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 11:02:17 PM UTC
+ ************************************************************************/
+
+#ifndef _MEMBERSHIP_H
+#define _MEMBERSHIP_H
+#include "storage.h"
+
+#define MEMBER_HOST_LEN 16
+
+// a node of the raft cluster, as the cfg change entry that added it
+typedef struct
+{
+  int node_id;
+  int raft_port;
+  int http_port;
+  // 0 while the node catches up as a non voting member
+  int voting;
+  char host[MEMBER_HOST_LEN];
+} member_t;
+
+// the cluster as of a snapshot. cfg change entries are folded in before
+// they are compacted away, so a node restarting from its snapshot, or
+// catching up through one, still knows its peers
+typedef struct
+{
+  int count;
+  member_t *members;
+} membership_t;
+
+void membership_init(membership_t *m);
+void membership_deinit(membership_t *m);
+member_t *membership_find(membership_t *m, int node_id);
+// add a member, or update the one with the same node_id
+int membership_add(membership_t *m, const member_t *mb);
+void membership_remove(membership_t *m, int node_id);
+// replace the members with the count members from members
+int membership_set(membership_t *m, const member_t *members, int count);
+// the members go under key as one value, within txn
+int membership_save(membership_t *m, storage_t *st, void *txn, const char *key);
+// 0 if there are members under key, -1 leaves m empty
+int membership_load(membership_t *m, storage_t *st, const char *key);
+#endif
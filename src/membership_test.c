@@ -0,0 +1,96 @@
+/*************************************************************************
+  > File Name: membership_test.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 11:20:36 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "membership.h"
+
+#define MEMBERSHIP_TEST_DIR "/tmp/membership_test"
+
+static member_t member(int node_id, int raft_port, int voting)
+{
+  member_t mb = {.node_id = node_id, .raft_port = raft_port, .http_port = raft_port + 1, .voting = voting};
+  strcpy(mb.host, "127.0.0.1");
+  return mb;
+}
+static void test_restart(const char *backend)
+{
+  storage_t st;
+  membership_t m;
+  void *txn;
+
+  system("rm -rf " MEMBERSHIP_TEST_DIR);
+  mkdir(MEMBERSHIP_TEST_DIR, 0755);
+  assert(storage_init(&st, backend) == 0);
+  assert(st.ops->open(&st, MEMBERSHIP_TEST_DIR) == 0);
+
+  // nothing was compacted yet
+  membership_init(&m);
+  assert(membership_load(&m, &st, "snapshot_members") == -1 && m.count == 0);
+
+  // the cfg entries of a 3 node cluster are compacted away
+  member_t a = member(1, 9001, 1), b = member(2, 9011, 0), c = member(3, 9021, 0);
+  assert(membership_add(&m, &a) == 0);
+  assert(membership_add(&m, &b) == 0);
+  assert(membership_add(&m, &c) == 0);
+  b.voting = 1;
+  assert(membership_add(&m, &b) == 0);
+  c.voting = 1;
+  assert(membership_add(&m, &c) == 0);
+  assert(m.count == 3);
+  assert(st.ops->begin(&st, &txn) == 0);
+  assert(membership_save(&m, &st, txn, "snapshot_members") == 0);
+  assert(st.ops->commit(&st, txn) == 0);
+  membership_deinit(&m);
+  st.ops->close(&st);
+
+  // the restarted node knows its peers without the entries
+  assert(storage_init(&st, backend) == 0);
+  assert(st.ops->open(&st, MEMBERSHIP_TEST_DIR) == 0);
+  assert(membership_load(&m, &st, "snapshot_members") == 0);
+  assert(m.count == 3);
+  assert(membership_find(&m, 2)->voting == 1);
+  assert(membership_find(&m, 3)->raft_port == 9021);
+  assert(strcmp(membership_find(&m, 1)->host, "127.0.0.1") == 0);
+  membership_deinit(&m);
+  st.ops->close(&st);
+  fprintf(stdout, "%s ok\n", backend);
+}
+int main(int argc, char *argv[])
+{
+  membership_t m, n;
+  membership_init(&m);
+  member_t a = member(1, 9001, 1), b = member(2, 9011, 0);
+  assert(membership_add(&m, &a) == 0);
+  assert(membership_add(&m, &b) == 0);
+  assert(membership_find(&m, 2)->voting == 0);
+
+  // an add node entry for a known node promotes it
+  b.voting = 1;
+  assert(membership_add(&m, &b) == 0);
+  assert(m.count == 2 && membership_find(&m, 2)->voting == 1);
+
+  membership_remove(&m, 1);
+  membership_remove(&m, 7);
+  assert(m.count == 1 && membership_find(&m, 1) == NULL);
+
+  // an installed snapshot replaces the members
+  membership_init(&n);
+  assert(membership_set(&n, m.members, m.count) == 0);
+  assert(n.count == 1 && membership_find(&n, 2) != NULL);
+  assert(membership_set(&n, NULL, 0) == 0 && n.count == 0);
+  membership_deinit(&n);
+  membership_deinit(&m);
+
+  test_restart("lmdb");
+  test_restart("kv_db");
+  system("rm -rf " MEMBERSHIP_TEST_DIR);
+  return 0;
+}
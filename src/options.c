@@ -13,10 +13,44 @@
 
 #include "options.h"
 #define _GNU_SOURCE
+#define DEFAULT_SEGMENT_SIZE 10000
+#define DEFAULT_PREFETCH_THRESHOLD 50
+#define DEFAULT_LEASE_INTERVAL 10
+#define DEFAULT_SEGMENT_MIN 1000
+#define DEFAULT_SEGMENT_MAX 10000000
+#define DEFAULT_ID_BITS 62
+#define DEFAULT_GROUP_WINDOW 0
+#define DEFAULT_GROUP_MAX 1000
+#define DEFAULT_HEARTBEAT_MS 200
+#define DEFAULT_ELECTION_MS 2000
+#define DEFAULT_APPEND_MAX_ENTRIES 256
+#define DEFAULT_APPEND_MAX_BYTES (1 << 20)
+#define DEFAULT_APPEND_MAX_INFLIGHT 4
+#define DEFAULT_SNAPSHOT_ENTRIES 10000
+#define DEFAULT_READ_LEASE_MS 1500
+#define DEFAULT_WAL_SEGMENT_MB 64
+#define DEFAULT_STORAGE "lmdb"
 
 int options_init(options_t *opts, int argc, char *argv[])
 {
   memset(opts, 0, sizeof(*opts));
+  opts->segment_size = DEFAULT_SEGMENT_SIZE;
+  opts->prefetch_threshold = DEFAULT_PREFETCH_THRESHOLD;
+  opts->lease_interval = DEFAULT_LEASE_INTERVAL;
+  opts->segment_min = DEFAULT_SEGMENT_MIN;
+  opts->segment_max = DEFAULT_SEGMENT_MAX;
+  opts->id_bits = DEFAULT_ID_BITS;
+  opts->group_window = DEFAULT_GROUP_WINDOW;
+  opts->group_max = DEFAULT_GROUP_MAX;
+  opts->heartbeat_ms = DEFAULT_HEARTBEAT_MS;
+  opts->election_ms = DEFAULT_ELECTION_MS;
+  opts->append_max_entries = DEFAULT_APPEND_MAX_ENTRIES;
+  opts->append_max_bytes = DEFAULT_APPEND_MAX_BYTES;
+  opts->append_max_inflight = DEFAULT_APPEND_MAX_INFLIGHT;
+  opts->snapshot_entries = DEFAULT_SNAPSHOT_ENTRIES;
+  opts->read_lease_ms = DEFAULT_READ_LEASE_MS;
+  opts->wal_segment_mb = DEFAULT_WAL_SEGMENT_MB;
+  opts->storage = strdup(DEFAULT_STORAGE);
   int c = 0;
 
   int long_index = 0;
@@ -28,11 +62,30 @@ int options_init(options_t *opts, int argc, char *argv[])
       {"join", required_argument, 0, 'j'},
       {"leave", required_argument, 0, 'l'},
       {"peer", required_argument, 0, 'p'},
+      {"mode", required_argument, 0, 'm'},
+      {"segment_size", required_argument, 0, 'z'},
+      {"prefetch_threshold", required_argument, 0, 't'},
+      {"lease_interval", required_argument, 0, 'e'},
+      {"segment_min", required_argument, 0, 'n'},
+      {"segment_max", required_argument, 0, 'x'},
+      {"feistel_key", required_argument, 0, 'k'},
+      {"id_bits", required_argument, 0, 'b'},
+      {"group_window", required_argument, 0, 'w'},
+      {"group_max", required_argument, 0, 'g'},
+      {"heartbeat_ms", required_argument, 0, 'H'},
+      {"election_ms", required_argument, 0, 'E'},
+      {"append_max_entries", required_argument, 0, 'a'},
+      {"append_max_bytes", required_argument, 0, 'y'},
+      {"append_max_inflight", required_argument, 0, 'f'},
+      {"snapshot_entries", required_argument, 0, 'c'},
+      {"read_lease_ms", required_argument, 0, 'r'},
+      {"wal_segment_mb", required_argument, 0, 'W'},
+      {"storage", required_argument, 0, 'S'},
       {0, 0, 0, 0}};
 
   char service_port[32] = {'\0'};
   int i_service_port = 0;
-  while ((c = getopt_long(argc, argv, "s:i:j:l",
+  while ((c = getopt_long(argc, argv, "s:i:j:lm:",
                           long_options, &long_index)) != -1)
   {
     if (c == 's' || c == 'l' || c == 'j')
@@ -52,7 +105,7 @@ int options_init(options_t *opts, int argc, char *argv[])
       free(arg_ptr);
       arg_ptr = NULL;
     }
-    else
+    else if (c == 'i')
     {
       opts->id = strdup(optarg);
     }
@@ -72,8 +125,85 @@ int options_init(options_t *opts, int argc, char *argv[])
       opts->type_info.type = OPTION_JOIN;
       break;
     case 'p':
-      opts->peer = strdup(arg_ptr);
+      opts->peer = strdup(optarg);
       break; 
+    case 'm':
+      if (strcmp(optarg, "random") == 0)
+      {
+        opts->id_mode = ID_MODE_RANDOM;
+      }
+      else if (strcmp(optarg, "segment") == 0)
+      {
+        opts->id_mode = ID_MODE_SEGMENT;
+      }
+      else if (strcmp(optarg, "counter") == 0)
+      {
+        opts->id_mode = ID_MODE_COUNTER;
+      }
+      else if (strcmp(optarg, "feistel") == 0)
+      {
+        opts->id_mode = ID_MODE_FEISTEL;
+      }
+      else
+      {
+        return -1;
+      }
+      break;
+    case 'z':
+      opts->segment_size = atoi(optarg);
+      break;
+    case 't':
+      opts->prefetch_threshold = atoi(optarg);
+      break;
+    case 'e':
+      opts->lease_interval = atoi(optarg);
+      break;
+    case 'n':
+      opts->segment_min = atoi(optarg);
+      break;
+    case 'x':
+      opts->segment_max = atoi(optarg);
+      break;
+    case 'k':
+      opts->feistel_key = strdup(optarg);
+      break;
+    case 'b':
+      opts->id_bits = atoi(optarg);
+      break;
+    case 'w':
+      opts->group_window = atoi(optarg);
+      break;
+    case 'g':
+      opts->group_max = atoi(optarg);
+      break;
+    case 'H':
+      opts->heartbeat_ms = atoi(optarg);
+      break;
+    case 'E':
+      opts->election_ms = atoi(optarg);
+      break;
+    case 'a':
+      opts->append_max_entries = atoi(optarg);
+      break;
+    case 'y':
+      opts->append_max_bytes = atoi(optarg);
+      break;
+    case 'f':
+      opts->append_max_inflight = atoi(optarg);
+      break;
+    case 'c':
+      opts->snapshot_entries = atoi(optarg);
+      break;
+    case 'r':
+      opts->read_lease_ms = atoi(optarg);
+      break;
+    case 'W':
+      opts->wal_segment_mb = atoi(optarg);
+      break;
+    case 'S':
+      free(opts->storage);
+      opts->storage = strdup(optarg);
+      break;
     }
   }
   if (opts->host == NULL || (opts->type_info.type < OPTION_START || opts->type_info.type > OPTION_LEAVE))
@@ -84,6 +214,50 @@ int options_init(options_t *opts, int argc, char *argv[])
   {
     return -1;
   }
+  if (opts->segment_size == 0 || opts->prefetch_threshold < 0 || opts->prefetch_threshold > 100)
+  {
+    return -1;
+  }
+  if (opts->lease_interval < 0 || opts->segment_min == 0 || opts->segment_min > opts->segment_max)
+  {
+    return -1;
+  }
+  if (opts->group_window < 0 || opts->group_max == 0)
+  {
+    return -1;
+  }
+  // followers must hear from the leader well within an election timeout
+  if (opts->heartbeat_ms <= 0 || opts->election_ms <= opts->heartbeat_ms)
+  {
+    return -1;
+  }
+  if (opts->append_max_entries < 0 || opts->append_max_bytes < 0 || opts->append_max_inflight < 1)
+  {
+    return -1;
+  }
+  if (opts->snapshot_entries < 0)
+  {
+    return -1;
+  }
+  // the lease has to run out before a follower stops refusing pre-votes
+  if (opts->read_lease_ms < 0 || opts->read_lease_ms + opts->heartbeat_ms >= opts->election_ms)
+  {
+    return -1;
+  }
+  if (opts->wal_segment_mb <= 0)
+  {
+    return -1;
+  }
+  if (strcmp(opts->storage, "lmdb") != 0 && strcmp(opts->storage, "kv_db") != 0)
+  {
+    return -1;
+  }
+  // feistel ids keep the top bit to themselves, and the permutation works
+  // on halves of equal width
+  if (opts->id_mode == ID_MODE_FEISTEL && (opts->feistel_key == NULL || opts->id_bits < 32 || opts->id_bits > 62 || opts->id_bits % 2 != 0))
+  {
+    return -1;
+  }
   return 0;
 }
 void options_dump(options_t *opt)
@@ -96,6 +270,24 @@ void options_dump(options_t *opt)
     fprintf(stdout, "raft_port:%s\n", opt->raft_port);
     fprintf(stdout, "service_port:%s\n", opt->service_port);
     fprintf(stdout, "type:%s-%d\n", opt->type_info.name, opt->type_info.type);
+    fprintf(stdout, "id_mode:%d\n", opt->id_mode);
+    fprintf(stdout, "segment_size:%u\n", opt->segment_size);
+    fprintf(stdout, "prefetch_threshold:%d\n", opt->prefetch_threshold);
+    fprintf(stdout, "lease_interval:%d\n", opt->lease_interval);
+    fprintf(stdout, "segment_min:%u\n", opt->segment_min);
+    fprintf(stdout, "segment_max:%u\n", opt->segment_max);
+    fprintf(stdout, "id_bits:%d\n", opt->id_bits);
+    fprintf(stdout, "group_window:%d\n", opt->group_window);
+    fprintf(stdout, "group_max:%u\n", opt->group_max);
+    fprintf(stdout, "heartbeat_ms:%d\n", opt->heartbeat_ms);
+    fprintf(stdout, "election_ms:%d\n", opt->election_ms);
+    fprintf(stdout, "append_max_entries:%d\n", opt->append_max_entries);
+    fprintf(stdout, "append_max_bytes:%d\n", opt->append_max_bytes);
+    fprintf(stdout, "append_max_inflight:%d\n", opt->append_max_inflight);
+    fprintf(stdout, "snapshot_entries:%d\n", opt->snapshot_entries);
+    fprintf(stdout, "read_lease_ms:%d\n", opt->read_lease_ms);
+    fprintf(stdout, "wal_segment_mb:%d\n", opt->wal_segment_mb);
+    fprintf(stdout, "storage:%s\n", opt->storage);
   }
 }
 #ifdef TEST
@@ -16,6 +16,17 @@ typedef enum {
 	OPTION_DROP,
 }option_type_e;
 
+// how ids handed to clients are generated
+typedef enum {
+	ID_MODE_RANDOM=0,
+	// lease [lo,hi) ranges through raft and serve ids out of memory
+	ID_MODE_SEGMENT,
+	// every request advances a replicated high-water mark
+	ID_MODE_COUNTER,
+	// segment ids run through a keyed feistel permutation
+	ID_MODE_FEISTEL,
+}id_mode_e;
+
 typedef struct  {
 	char *name;
 	int  type;
@@ -35,6 +46,48 @@ typedef struct
 	char *service_port;
 	// 主节点的地址
 	char *peer;
+	int id_mode;
+	// ids leased per raft entry in segment mode, until there's an
+	// allocation rate to size leases by
+	unsigned int segment_size;
+	// aim for one lease every lease_interval seconds, 0 keeps segment_size
+	int lease_interval;
+	unsigned int segment_min;
+	unsigned int segment_max;
+	// feistel mode, every node must use the same key and width. ids are
+	// id_bits wide below the top bit, which is always set
+	char *feistel_key;
+	int id_bits;
+	// random and counter modes gather requests arriving within
+	// group_window microseconds into one entry. 0, the default, appends
+	// each on its own without waiting
+	int group_window;
+	// stop gathering once the group has asked for this many ids
+	unsigned int group_max;
+	// the leader sends heartbeats every heartbeat_ms, followers start an
+	// election after election_ms without one. committed entries are applied
+	// as soon as they commit, not on these timers
+	int heartbeat_ms;
+	int election_ms;
+	// most entries, and bytes of entry data, sent to a follower per
+	// appendentries message. 0 means no limit
+	int append_max_entries;
+	int append_max_bytes;
+	// unacknowledged appendentries batches per follower before we wait
+	int append_max_inflight;
+	// entries kept in the log, it's compacted into a snapshot once twice
+	// that many have been applied since the last one. 0 never compacts
+	int snapshot_entries;
+	// the leader answers reads on its own for this long after a majority
+	// heard from it. 0 confirms every read with a round of heartbeats
+	int read_lease_ms;
+	// raft log entries go to preallocated wal segment files of this many
+	// megabytes, old entries are dropped a segment at a time
+	int wal_segment_mb;
+	// where tickets and raft's metadata are kept, "lmdb" or "kv_db"
+	char *storage;
+	// percent of the active segment handed out before the next one is leased
+	int prefetch_threshold;
 
 } options_t;
 /*
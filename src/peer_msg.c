@@ -0,0 +1,9 @@
+#include <stddef.h>
+#include "peer_msg.h"
+
+void peer_msg_appendentries(msg_t *msg, const msg_appendentries_t *ae)
+{
+    msg->type = MSG_APPENDENTRIES;
+    msg->ae = *ae;
+    msg->ae.entries = NULL;
+}
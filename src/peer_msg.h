@@ -0,0 +1,91 @@
+#ifndef PEER_MSG_H
+#define PEER_MSG_H
+
+#include "raft.h"
+
+#define IP_STR_LEN 16
+
+typedef enum
+{
+    HANDSHAKE_FAILURE,
+    HANDSHAKE_SUCCESS,
+} handshake_state_e;
+
+/** Message types used for peer to peer traffic
+ * These values are used to identify message types during deserialization */
+typedef enum
+{
+    /** Handshake is a special non-raft message type
+     * We send a handshake so that we can identify ourselves to our peers */
+    MSG_HANDSHAKE,
+    /** Successful responses mean we can start the Raft periodic callback */
+    MSG_HANDSHAKE_RESPONSE,
+    /** Tell leader we want to leave the cluster */
+    /* When instance is ctrl-c'd we have to gracefuly disconnect */
+    MSG_LEAVE,
+    /* Receiving a leave response means we can shutdown */
+    MSG_LEAVE_RESPONSE,
+    MSG_REQUESTVOTE,
+    MSG_REQUESTVOTE_RESPONSE,
+    MSG_APPENDENTRIES,
+    MSG_APPENDENTRIES_RESPONSE,
+    /** Followed by the state machine's state, see raft_send_installsnapshot_cb */
+    MSG_INSTALLSNAPSHOT,
+    /** The leader is handing over to us, start an election now */
+    MSG_TIMEOUTNOW,
+} peer_message_type_e;
+
+/** Peer protocol handshake
+ * Send handshake after connecting so that our peer can identify us */
+typedef struct
+{
+    int raft_port;
+    int http_port;
+    int node_id;
+} msg_handshake_t;
+
+typedef struct
+{
+    int success;
+
+    /* leader's Raft port */
+    int leader_port;
+
+    /* the responding node's HTTP port */
+    int http_port;
+
+    /* my Raft node ID.
+     * Sometimes we don't know who we did the handshake with */
+    int node_id;
+
+    char leader_host[IP_STR_LEN];
+} msg_handshake_response_t;
+
+typedef struct
+{
+    int type;
+    union
+    {
+        msg_handshake_t hs;
+        msg_handshake_response_t hsr;
+        msg_requestvote_t rv;
+        msg_requestvote_response_t rvr;
+        msg_appendentries_t ae;
+        msg_appendentries_response_t aer;
+        msg_installsnapshot_t is;
+        msg_timeoutnow_t tn;
+    };
+    int padding[100];
+} msg_t;
+
+/** tpl formats of the raft messages' headers, as sent to peers.
+ * Entries and snapshot state follow the header as tpl images of their own */
+#define PEER_MSG_APPENDENTRIES_FMT "S(I$(IIIIuuI))"
+#define PEER_MSG_APPENDENTRIES_RESPONSE_FMT "S(I$(IIIIIIuu))"
+#define PEER_MSG_INSTALLSNAPSHOT_FMT "S(I$(IIIuu))"
+
+/** Fill in an appendentries message's header.
+ * The entries aren't part of the header, they're sent after it */
+void peer_msg_appendentries(msg_t *msg, const msg_appendentries_t *ae);
+
+#endif /* PEER_MSG_H */
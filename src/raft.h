@@ -83,6 +83,10 @@ typedef struct
 
     /** term of candidate's last log entry */
     int last_log_term;
+
+    /** true if this is a pre-vote, asking whether we would vote for the
+     * candidate in term. Nobody's term or vote changes because of it */
+    int prevote;
 } msg_requestvote_t;
 
 /** Vote request response message.
@@ -94,6 +98,9 @@ typedef struct
 
     /** true means candidate received vote */
     int vote_granted;
+
+    /** true if this answers a pre-vote */
+    int prevote;
 } msg_requestvote_response_t;
 
 /** Appendentries message.
@@ -117,6 +124,14 @@ typedef struct
      * cluster. Entries up to this index will be applied to the FSM */
     int leader_commit;
 
+    /** the leader's clock when it sent this message, echoed back in the
+     * response. See raft_read_lease_remaining() */
+    unsigned int sent_at;
+
+    /** the leader's read sequence when it sent this message, echoed back in
+     * the response. See raft_read_index_start() */
+    unsigned int read_seq;
+
     /** number of entries within this message */
     int n_entries;
 
@@ -144,8 +159,70 @@ typedef struct
 
     /** The first idx that we received within the appendentries message */
     int first_idx;
+
+    /** On failure, the term of our entry at prevLogIdx, or 0 if our log
+     * doesn't reach that far */
+    int conflict_term;
+
+    /** On failure, the first idx we hold of conflict_term, or the idx just
+     * past our log if conflict_term is 0. Lets the leader skip a whole term
+     * per round trip rather than a single entry */
+    int conflict_idx;
+
+    /** sent_at of the message this responds to */
+    unsigned int sent_at;
+
+    /** read_seq of the message this responds to */
+    unsigned int read_seq;
 } msg_appendentries_response_t;
 
+/** InstallSnapshot message.
+ * Sent instead of appendentries when the entries a follower needs have been
+ * compacted away. The state machine's state goes along with it, in whatever
+ * form the send_installsnapshot callback chooses.
+ * The follower answers with an appendentries response. */
+typedef struct
+{
+    /** currentTerm, to force other leader/candidate to step down */
+    int term;
+
+    /** the snapshot replaces all entries up to and including this idx */
+    int last_idx;
+
+    /** term of the entry at last_idx */
+    int last_term;
+
+    /** the leader's clock when it sent this message, as in appendentries */
+    unsigned int sent_at;
+
+    /** the leader's read sequence when it sent this message, as in
+     * appendentries */
+    unsigned int read_seq;
+} msg_installsnapshot_t;
+
+/** A read being confirmed with raft_read_index_start() */
+typedef struct
+{
+    /** the term the read started in */
+    int term;
+
+    /** the read sees the state machine as of this entry */
+    int idx;
+
+    /** the leader's read sequence when the read started */
+    unsigned int seq;
+} raft_read_index_t;
+
+/** TimeoutNow message.
+ * Sent by a leader handing leadership over, once the receiver's log has
+ * caught up with its own. The receiver starts an election right away
+ * instead of waiting for its election timeout. */
+typedef struct
+{
+    /** currentTerm of the leader handing over */
+    int term;
+} msg_timeoutnow_t;
+
 typedef void* raft_server_t;
 typedef void* raft_node_t;
 
@@ -179,6 +256,38 @@ typedef int (
     msg_appendentries_t* msg
     );
 
+/** Callback for sending installsnapshot messages.
+ * The user sends the state machine's state as of msg->last_idx along with
+ * the message.
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] node The node's ID that we are sending this message to
+ * @param[in] msg The installsnapshot message to be sent
+ * @return 0 on success */
+typedef int (
+*func_send_installsnapshot_f
+)   (
+    raft_server_t* raft,
+    void *user_data,
+    raft_node_t* node,
+    msg_installsnapshot_t* msg
+    );
+
+/** Callback for sending timeoutnow messages.
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] node The node's ID that we are sending this message to
+ * @param[in] msg The timeoutnow message to be sent
+ * @return 0 on success */
+typedef int (
+*func_send_timeoutnow_f
+)   (
+    raft_server_t* raft,
+    void *user_data,
+    raft_node_t* node,
+    msg_timeoutnow_t* msg
+    );
+
 /** Callback for detecting when non-voting nodes have obtained enough logs.
  * This triggers only when there are no pending configuration changes.
  * @param[in] raft The Raft server making this callback
@@ -214,7 +323,7 @@ typedef void (
  * @param[in] raft The Raft server making this callback
  * @param[in] user_data User data that is passed from Raft server
  * @param[in] ety Log entry to be applied
- * @return 0 on success */
+ * @return 0 on success; otherwise the entry is passed in again later */
 typedef int (
 *func_applylog_f
 )   (
@@ -223,6 +332,25 @@ typedef int (
     raft_entry_t* ety
     );
 
+/** Callback for applying a run of committed entries to the state machine in
+ * one go.
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] entries Log entries to be applied, contiguous in memory
+ * @param[in] entry_idx The first entry's index in the log
+ * @param[in] n_entries The number of entries
+ * @return 0 on success; otherwise none of the entries may have been applied,
+ *  they are passed in again later */
+typedef int (
+*func_applylog_batch_f
+)   (
+    raft_server_t* raft,
+    void *user_data,
+    raft_entry_t* entries,
+    int entry_idx,
+    int n_entries
+    );
+
 /** Callback for saving who we voted for to disk.
  * For safety reasons this callback MUST flush the change to disk.
  * @param[in] raft The Raft server making this callback
@@ -237,6 +365,23 @@ typedef int (
     int node
     );
 
+/** Callback for saving the current term and who we voted for in it, in
+ * one go.
+ * For safety reasons this callback MUST flush the change to disk.
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] term The current term
+ * @param[in] voted_for The node we voted for, -1 if none
+ * @return 0 on success */
+typedef int (
+*func_persist_term_vote_f
+)   (
+    raft_server_t* raft,
+    void *user_data,
+    int term,
+    int voted_for
+    );
+
 /** Callback for saving log entry changes.
  *
  * This callback is used for:
@@ -264,6 +409,28 @@ typedef int (
     int entry_idx
     );
 
+/** Callback for saving a run of new entries to the log in one go.
+ *
+ * For safety reasons this callback MUST flush the change to disk.
+ *
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] entries The entries, contiguous in memory. As with log_offer
+ *    the user is allowed to change the memory pointed to in their
+ *    raft_entry_data_t, and MUST do so if the memory is temporary.
+ * @param[in] entry_idx The first entry's index in the log
+ * @param[in] n_entries The number of entries
+ * @return 0 on success */
+typedef int (
+*func_logentry_batch_event_f
+)   (
+    raft_server_t* raft,
+    void *user_data,
+    raft_entry_t *entries,
+    int entry_idx,
+    int n_entries
+    );
+
 typedef struct
 {
     /** Callback for sending request vote messages */
@@ -272,9 +439,21 @@ typedef struct
     /** Callback for sending appendentries messages */
     func_send_appendentries_f send_appendentries;
 
+    /** Callback for sending installsnapshot messages, to followers that need
+     * entries we have compacted away */
+    func_send_installsnapshot_f send_installsnapshot;
+
+    /** Callback for sending timeoutnow messages, when handing leadership
+     * over with raft_transfer_leadership */
+    func_send_timeoutnow_f send_timeoutnow;
+
     /** Callback for finite state machine application */
     func_applylog_f applylog;
 
+    /** Callback for applying several entries at once, eg. when catching up
+     * after a restart. If set it's called instead of applylog */
+    func_applylog_batch_f applylog_batch;
+
     /** Callback for persisting vote data
      * For safety reasons this callback MUST flush the change to disk. */
     func_persist_int_f persist_vote;
@@ -283,10 +462,21 @@ typedef struct
      * For safety reasons this callback MUST flush the change to disk. */
     func_persist_int_f persist_term;
 
+    /** Callback for persisting term and vote data together. If set it's
+     * called instead of persist_term and persist_vote, so that a new term
+     * and our vote in it cost a single flush.
+     * For safety reasons this callback MUST flush the change to disk. */
+    func_persist_term_vote_f persist_term_vote;
+
     /** Callback for adding an entry to the log
      * For safety reasons this callback MUST flush the change to disk. */
     func_logentry_event_f log_offer;
 
+    /** Callback for adding several entries to the log at once, eg. all of
+     * an appendentries message. If set it's called instead of log_offer
+     * For safety reasons this callback MUST flush the change to disk. */
+    func_logentry_batch_event_f log_offer_batch;
+
     /** Callback for removing the oldest entry from the log
      * For safety reasons this callback MUST flush the change to disk.
      * @note If memory was malloc'd in log_offer then this should be the right
@@ -374,6 +564,61 @@ void raft_set_election_timeout(raft_server_t* me, int msec);
  * @param[in] msec Request timeout in milliseconds */
 void raft_set_request_timeout(raft_server_t* me, int msec);
 
+/** Set the most entries an appendentries message carries.
+ * A lagging follower catches up this many entries per round trip.
+ * @param[in] n_entries Maximum number of entries, 0 for no limit */
+void raft_set_appendentries_max_entries(raft_server_t* me, int n_entries);
+
+/** Set the most entry data an appendentries message carries.
+ * A message always carries at least one entry, however big it is.
+ * @param[in] bytes Maximum size of the entries' data, 0 for no limit */
+void raft_set_appendentries_max_bytes(raft_server_t* me, int bytes);
+
+/** Set how many appendentries batches a follower can have in flight.
+ * A follower's next index moves past a batch as soon as it is sent, so new
+ * entries don't wait for the previous batch to be acknowledged. Once this
+ * many batches are unacknowledged only heartbeats are sent.
+ * @param[in] n_batches Unacknowledged batches per follower, at least 1 */
+void raft_set_appendentries_max_inflight(raft_server_t* me, int n_batches);
+
+/** Hold a pre-vote before each election.
+ * A node whose election timeout runs out first asks the others whether
+ * they would vote for it, and only becomes a candidate (incrementing its
+ * term) once a majority would. Nodes that have heard from a leader within
+ * their election timeout say no, so a node which was cut off from the
+ * cluster can't depose a healthy leader when it comes back.
+ * @param[in] prevote 1 to hold pre-votes, 0 (the default) to not */
+void raft_set_prevote(raft_server_t* me, int prevote);
+
+/** Let the leader serve reads locally for msec after a majority has
+ * acknowledged one of its messages, see raft_read_lease_remaining().
+ * This relies on nodes refusing pre-votes while they hear from a leader, so
+ * pre-votes must be on, and msec must be less than the election timeout by
+ * enough to cover the nodes' clocks drifting apart.
+ * @param[in] msec The lease in milliseconds, 0 (the default) for none */
+void raft_set_read_lease(raft_server_t* me, int msec);
+
+/** How much longer the leader can answer reads from its state machine
+ * without asking the cluster, ie. no other node can have become leader in
+ * the meantime. There's no lease until the leader has committed an entry of
+ * its own term and applied every committed entry.
+ * @return lease left in milliseconds; 0 if there's none */
+int raft_read_lease_remaining(raft_server_t* me);
+
+/** Start a ReadIndex read, which doesn't rely on clocks. Heartbeats are
+ * sent, the read can be served once raft_read_index_ready() says so.
+ * @param[out] rd The read, to pass to raft_read_index_ready()
+ * @return 0 on success; -1 if we aren't leader or haven't committed an
+ *  entry of our term yet */
+int raft_read_index_start(raft_server_t* me, raft_read_index_t* rd);
+
+/** Tell if a ReadIndex read can be served: a majority has acknowledged
+ * heartbeats sent after it started, so we were still leader, and the state
+ * machine is up to date with what was committed then.
+ * @param[in] rd The read
+ * @return 1 if it can be served; 0 if not yet; -1 if we lost leadership */
+int raft_read_index_ready(raft_server_t* me, raft_read_index_t* rd);
+
 /** Process events that are dependent on time passing.
  * @param[in] msec_elapsed Time in milliseconds since the last call
  * @return 0 on success */
@@ -383,7 +628,9 @@ int raft_periodic(raft_server_t* me, int msec_elapsed);
  *
  * Will block (ie. by syncing to disk) if we need to append a message.
  *
- * Might call malloc once to increase the log entry array size.
+ * Might call malloc once to add a chunk of entries to the log, when the
+ * last chunk is full and no spare chunk is left over from compaction. The
+ * table of chunks is grown with realloc every so often too.
  *
  * The log_offer callback will be called.
  *
@@ -402,6 +649,7 @@ int raft_recv_appendentries(raft_server_t* me,
                             msg_appendentries_response_t *r);
 
 /** Receive a response from an appendentries message we sent.
+ * Entries committed by the response are applied before this returns.
  * @param[in] node Index of the node who sent us this message
  * @param[in] r The appendentries response message
  * @return 0 on success */
@@ -409,6 +657,60 @@ int raft_recv_appendentries_response(raft_server_t* me,
                                      raft_node_t* node,
                                      msg_appendentries_response_t* r);
 
+/** Receive an installsnapshot message.
+ *
+ * If the snapshot is ahead of our log, our log is emptied and the snapshot
+ * takes its place. The caller MUST then replace the state machine's state
+ * with the one that came with the message, and discard the entries it has
+ * persisted. The log_pop callback isn't called for them.
+ *
+ * @param[in] node Index of the node who sent us this message
+ * @param[in] is The installsnapshot message
+ * @param[out] r The resulting response
+ * @return 0 if the caller has to load the snapshot's state;
+ *  1 if we already have the snapshot's entries; -1 if rejected */
+int raft_recv_installsnapshot(raft_server_t* me,
+                              raft_node_t* node,
+                              msg_installsnapshot_t* is,
+                              msg_appendentries_response_t *r);
+
+/** Compact the log up to and including idx.
+ * The state machine's state as of idx becomes the snapshot sent to followers
+ * that need the discarded entries. The log_poll callback is called for each
+ * entry discarded.
+ * @param[in] idx The last entry to discard, it must have been applied
+ * @return 0 on success; -1 if idx hasn't been applied or is already
+ *  compacted */
+int raft_compact_log(raft_server_t* me, int idx);
+
+/** Resume from a snapshot, ie. on startup before loading the entries that
+ * follow it. The log is emptied and the snapshot's entries count as
+ * applied.
+ * @param[in] last_idx The last entry covered by the snapshot
+ * @param[in] last_term The term of that entry */
+void raft_load_snapshot(raft_server_t* me, int last_idx, int last_term);
+
+/** Hand leadership over to node, eg. before restarting this server.
+ *
+ * We stop accepting entries, bring node's log up to date and then send it a
+ * timeoutnow message so that it starts an election without waiting for its
+ * election timeout. If nobody has taken over within an election timeout
+ * the transfer is abandoned and we accept entries again.
+ *
+ * @param[in] node The node to hand over to, it must be a voting node
+ * @return 0 on success; -1 if we aren't the leader, a transfer is already
+ *  under way, or node can't be leader */
+int raft_transfer_leadership(raft_server_t* me, raft_node_t* node);
+
+/** Receive a timeoutnow message, starting an election right away.
+ * @param[in] node Index of the node who sent us this message
+ * @param[in] tn The timeoutnow message
+ * @return 0 on success; -1 if the message is from an old term or we can't
+ *  stand for election */
+int raft_recv_timeoutnow(raft_server_t* me,
+                         raft_node_t* node,
+                         msg_timeoutnow_t* tn);
+
 /** Receive a requestvote message.
  * @param[in] node Index of the node who sent us this message
  * @param[in] vr The requestvote message
@@ -433,18 +735,28 @@ int raft_recv_requestvote_response(raft_server_t* me,
  *
  * Will block (ie. by syncing to disk) if we need to append a message.
  *
- * Might call malloc once to increase the log entry array size.
+ * Might call malloc once to add a chunk of entries to the log, when the
+ * last chunk is full and no spare chunk is left over from compaction. The
+ * table of chunks is grown with realloc every so often too.
  *
- * The log_offer callback will be called.
+ * The log_offer callback will be called, after the entry has been sent to
+ * the followers so that persisting it overlaps with replicating it. We only
+ * count ourselves towards the entry's quorum once log_offer has returned 0.
  *
  * @note The memory pointer (ie. raft_entry_data_t) in msg_entry_t is
  *  copied directly. If the memory is temporary you MUST either make the
  *  memory permanent (ie. via malloc) OR re-assign the memory within the
  *  log_offer callback.
  *
+ * @note If log_offer fails the entry stays in the log, as it's been sent
+ *  already, and is offered again along with the next entry. A log_offer
+ *  that fails MUST NOT leave the entry pointing at temporary memory, if it
+ *  can't do that it has to treat the failure as fatal.
+ *
  * Will fail:
  * <ul>
  *      <li>if the server is not the leader
+ *      <li>if leadership is being transferred to another node
  * </ul>
  *
  * @param[in] node Index of the node who sent us this message
@@ -483,6 +795,14 @@ int raft_get_current_idx(raft_server_t* me);
  * @return commit index */
 int raft_get_commit_idx(raft_server_t* me_);
 
+/**
+ * @return index of the last entry covered by the snapshot, 0 if none */
+int raft_get_snapshot_last_idx(raft_server_t* me);
+
+/**
+ * @return term of the last entry covered by the snapshot */
+int raft_get_snapshot_last_term(raft_server_t* me);
+
 /**
  * @return 1 if follower; 0 otherwise */
 int raft_is_follower(raft_server_t* me);
@@ -556,6 +876,10 @@ int raft_get_voted_for(raft_server_t* me);
  *   -1 if the leader is unknown */
 int raft_get_current_leader(raft_server_t* me);
 
+/**
+ * @return the node we are handing leadership over to; NULL if we aren't */
+raft_node_t* raft_get_transfer_leader_node(raft_server_t* me);
+
 /** Get what this node thinks the node of the leader is.
  * @return node of what this node thinks is the valid leader;
  *   NULL if the leader is unknown */
@@ -581,8 +905,10 @@ void raft_vote_for_nodeid(raft_server_t* me_, const int nodeid);
 
 /** Set the current term.
  * This should be used to reload persistent state, ie. the current_term field.
- * @param[in] term The new current term */
-void raft_set_current_term(raft_server_t* me, const int term);
+ * @param[in] term The new current term
+ * @return 0 on success; -1 if the term couldn't be persisted. The term is
+ *  taken on all the same, we never vote in it without persisting it again */
+int raft_set_current_term(raft_server_t* me, const int term);
 
 /** Set the commit idx.
  * This should be used to reload persistent state, ie. the commit_idx field.
@@ -628,8 +954,12 @@ void raft_node_set_voting(raft_node_t* node, int voting);
  * @return 1 if this is a voting node. Otherwise 0. */
 int raft_node_is_voting(raft_node_t* me_);
 
-/** Apply all entries up to the commit index */
-void raft_apply_all(raft_server_t* me_);
+/** Apply all entries up to the commit index.
+ * With an applylog_batch callback each contiguous run of entries is applied
+ * with one call.
+ * @return 0 on success; -1 if an apply callback failed. The entries it was
+ *  given aren't counted as applied, the next call tries them again */
+int raft_apply_all(raft_server_t* me_);
 
 /** Become leader
  * WARNING: this is a dangerous function call. It could lead to your cluster
@@ -18,63 +18,98 @@
 #include "raft_private.h"
 #include "raft_log.h"
 
-#define INITIAL_CAPACITY 10
-#define in(x) ((log_private_t*)x)
+/* entries live in fixed size chunks, so the log never moves an entry once
+ * it's been appended. Must be a power of 2 */
+#define LOG_CHUNK_ENTRIES 1024
+#define INITIAL_CHUNKS 8
 
 typedef struct
 {
-    /* size of array */
-    int size;
+    /* chunks of LOG_CHUNK_ENTRIES entries; chunks[first] holds the oldest
+     * entry and chunks[last - 1] the youngest */
+    raft_entry_t** chunks;
+    int n_chunks;
+    int first, last;
 
-    /* the amount of elements in the array */
+    /* the amount of elements in the log */
     int count;
 
-    /* position of the queue */
-    int front, back;
+    /* position of the oldest entry within chunks[first] */
+    int front;
 
     /* we compact the log, and thus need to increment the Base Log Index */
     int base;
 
-    raft_entry_t* entries;
+    /* a chunk that was released, kept so that a log which is appended to
+     * and compacted at a steady rate doesn't allocate at all */
+    raft_entry_t* spare;
 
     /* callbacks */
     raft_cbs_t *cb;
     void* raft;
 } log_private_t;
 
-static void __ensurecapacity(log_private_t * me)
+/** @return the entry at position pos, counting from the oldest entry */
+static raft_entry_t* __entry(log_private_t* me, int pos)
 {
-    int i, j;
-    raft_entry_t *temp;
+    pos += me->front;
+    return &me->chunks[me->first + pos / LOG_CHUNK_ENTRIES]
+        [pos & (LOG_CHUNK_ENTRIES - 1)];
+}
 
-    if (me->count < me->size)
-        return;
+static void __release_chunk(log_private_t* me, raft_entry_t* chunk)
+{
+    free(me->spare);
+    me->spare = chunk;
+}
 
-    temp = (raft_entry_t*)calloc(1, sizeof(raft_entry_t) * me->size * 2);
+/** Make room for one more entry at the back, adding a chunk if need be */
+static void __ensurecapacity(log_private_t * me)
+{
+    if (me->front + me->count < (me->last - me->first) * LOG_CHUNK_ENTRIES)
+        return;
 
-    for (i = 0, j = me->front; i < me->count; i++, j++)
+    if (me->last == me->n_chunks)
     {
-        if (j == me->size)
-            j = 0;
-        memcpy(&temp[i], &me->entries[j], sizeof(raft_entry_t));
+        /* compaction left room at the start of the table */
+        if (me->n_chunks / 2 <= me->first)
+        {
+            memmove(me->chunks, &me->chunks[me->first],
+                    sizeof(raft_entry_t*) * (me->last - me->first));
+            me->last -= me->first;
+            me->first = 0;
+        }
+        else
+        {
+            me->n_chunks *= 2;
+            me->chunks = (raft_entry_t**)realloc(
+                me->chunks, sizeof(raft_entry_t*) * me->n_chunks);
+        }
     }
 
-    /* clean up old entries */
-    free(me->entries);
+    if (me->spare)
+    {
+        me->chunks[me->last++] = me->spare;
+        me->spare = NULL;
+    }
+    else
+        me->chunks[me->last++] = (raft_entry_t*)malloc(
+            LOG_CHUNK_ENTRIES * sizeof(raft_entry_t));
+}
 
-    me->size *= 2;
-    me->entries = temp;
-    me->front = 0;
-    me->back = me->count;
+/** Add an entry which has been persisted, or doesn't need to be */
+static void __push(log_private_t* me, raft_entry_t* c)
+{
+    __ensurecapacity(me);
+    memcpy(__entry(me, me->count), c, sizeof(raft_entry_t));
+    me->count++;
 }
 
 log_t* log_new()
 {
     log_private_t* me = (log_private_t*)calloc(1, sizeof(log_private_t));
-    me->size = INITIAL_CAPACITY;
-    me->count = 0;
-    me->back = in(me)->front = 0;
-    me->entries = (raft_entry_t*)calloc(1, sizeof(raft_entry_t) * me->size);
+    me->n_chunks = INITIAL_CHUNKS;
+    me->chunks = (raft_entry_t**)calloc(me->n_chunks, sizeof(raft_entry_t*));
     return (log_t*)me;
 }
 
@@ -93,66 +128,127 @@ int log_append_entry(log_t* me_, raft_entry_t* c)
     if (0 == c->id)
         return -1;
 
-    __ensurecapacity(me);
-
+    /* entries are handed to callbacks by their position in the whole log,
+     * which stays put as the front is compacted away */
     if (me->cb && me->cb->log_offer)
-        me->cb->log_offer(me->raft, raft_get_udata(me->raft), c, me->back);
-    memcpy(&me->entries[me->back], c, sizeof(raft_entry_t));
-    me->count++;
-    me->back++;
+        me->cb->log_offer(me->raft, raft_get_udata(me->raft), c,
+                          me->base + me->count);
+    __push(me, c);
     return 0;
 }
 
-raft_entry_t* log_get_from_idx(log_t* me_, int idx, int *n_etys)
+/** Persist the run of entries [idx, idx + n), which are contiguous in
+ * memory, with log_offer_batch or else with log_offer one at a time */
+static int __offer_batch(log_private_t* me, raft_entry_t* entries, int idx,
+                         int n)
+{
+    int i;
+
+    if (!me->cb)
+        return 0;
+
+    if (me->cb->log_offer_batch)
+        return me->cb->log_offer_batch(me->raft, raft_get_udata(me->raft),
+                                       entries, idx - 1, n);
+
+    if (me->cb->log_offer)
+        for (i = 0; i < n; i++)
+            if (-1 == me->cb->log_offer(me->raft, raft_get_udata(me->raft),
+                                        &entries[i], idx - 1 + i))
+                return -1;
+    return 0;
+}
+
+int log_append_batch(log_t* me_, raft_entry_t* entries, int n)
 {
     log_private_t* me = (log_private_t*)me_;
     int i;
 
-    assert(0 <= idx - 1);
+    for (i = 0; i < n; i++)
+        if (0 == entries[i].id)
+            return -1;
 
-    if (me->base + me->count < idx || idx < me->base)
-    {
-        return NULL;
-    }
-      
+    /* nothing goes into the log unless all of it made it to disk */
+    if (-1 == __offer_batch(me, entries, me->base + me->count + 1, n))
+        return -1;
 
-    /* idx starts at 1 */
-    idx -= 1;
+    for (i = 0; i < n; i++)
+        __push(me, &entries[i]);
+    return 0;
+}
 
-    i = (me->front + idx - me->base) % me->size;
+int log_append_entry_unpersisted(log_t* me_, raft_entry_t* c)
+{
+    log_private_t* me = (log_private_t*)me_;
 
-    int logs_till_end_of_log;
+    if (0 == c->id)
+        return -1;
+
+    __push(me, c);
+    return 0;
+}
 
-    if (i < me->back) {
-        logs_till_end_of_log = me->back - i;
+int log_persist_entries(log_t* me_, int idx, int n)
+{
+    log_private_t* me = (log_private_t*)me_;
 
+    /* the entries might span several chunks */
+    while (0 < n)
+    {
+        int n_etys;
+        raft_entry_t* e = log_get_from_idx(me_, idx, &n_etys);
+        if (!e)
+            return -1;
+        if (n < n_etys)
+            n_etys = n;
+
+        if (-1 == __offer_batch(me, e, idx, n_etys))
+            return -1;
+
+        idx += n_etys;
+        n -= n_etys;
     }
-    else{
-        logs_till_end_of_log = me->size - i;
+    return 0;
+}
 
+raft_entry_t* log_get_from_idx(log_t* me_, int idx, int *n_etys)
+{
+    log_private_t* me = (log_private_t*)me_;
+    int pos;
+
+    assert(0 <= idx - 1);
+
+    if (me->base + me->count < idx || idx <= me->base)
+    {
+        return NULL;
     }
 
-    *n_etys = logs_till_end_of_log;
-    return &me->entries[i];
+    /* idx starts at 1 */
+    pos = idx - 1 - me->base;
+
+    /* entries are only contiguous up to the end of their chunk */
+    int logs_till_end_of_chunk =
+        LOG_CHUNK_ENTRIES - ((me->front + pos) & (LOG_CHUNK_ENTRIES - 1));
+
+    if (me->count - pos < logs_till_end_of_chunk)
+        *n_etys = me->count - pos;
+    else
+        *n_etys = logs_till_end_of_chunk;
+    return __entry(me, pos);
 }
 
 raft_entry_t* log_get_at_idx(log_t* me_, int idx)
 {
     log_private_t* me = (log_private_t*)me_;
-    int i;
 
     assert(0 <= idx - 1);
 
-    if (me->base + me->count < idx || idx < me->base){
+    /* compacted entries are gone */
+    if (me->base + me->count < idx || idx <= me->base)
         return NULL;
-    }
-       
 
     /* idx starts at 1 */
-    idx -= 1;
-
-    i = (me->front + idx - me->base) % me->size;
-    return &me->entries[i];
+    return __entry(me, idx - 1 - me->base);
 
 }
 
@@ -174,9 +270,14 @@ void log_delete(log_t* me_, int idx)
     {
         if (me->cb && me->cb->log_pop)
             me->cb->log_pop(me->raft, raft_get_udata(me->raft),
-                            &me->entries[me->back - 1], me->back);
-        me->back--;
+                            __entry(me, me->count - 1),
+                            me->base + me->count - 1);
         me->count--;
+
+        /* the youngest chunk is empty */
+        if (me->front + me->count <=
+            (me->last - me->first - 1) * LOG_CHUNK_ENTRIES)
+            __release_chunk(me, me->chunks[--me->last]);
     }
 }
 
@@ -187,13 +288,23 @@ void *log_poll(log_t * me_)
     if (0 == log_count(me_))
         return NULL;
 
-    const void *elem = &me->entries[me->front];
+    const void *elem = __entry(me, 0);
     if (me->cb && me->cb->log_poll)
         me->cb->log_poll(me->raft, raft_get_udata(me->raft),
-                         &me->entries[me->front], me->front);
+                         __entry(me, 0), me->base);
     me->front++;
     me->count--;
     me->base++;
+
+    /* the oldest chunk is empty, it's kept as the spare so elem stays valid
+     * until the next chunk is released */
+    if (LOG_CHUNK_ENTRIES == me->front || 0 == me->count)
+    {
+        __release_chunk(me, me->chunks[me->first++]);
+        me->front = 0;
+        if (me->first == me->last)
+            me->first = me->last = 0;
+    }
     return (void*)elem;
 }
 
@@ -204,26 +315,41 @@ raft_entry_t *log_peektail(log_t * me_)
     if (0 == log_count(me_))
         return NULL;
 
-    if (0 == me->back)
-        return &me->entries[me->size - 1];
-    else
-        return &me->entries[me->back - 1];
+    return __entry(me, me->count - 1);
 }
 
 void log_empty(log_t * me_)
 {
     log_private_t* me = (log_private_t*)me_;
 
+    while (me->first < me->last)
+        __release_chunk(me, me->chunks[--me->last]);
+    me->first = me->last = 0;
     me->front = 0;
-    me->back = 0;
     me->count = 0;
 }
 
+void log_load_from_snapshot(log_t* me_, int idx)
+{
+    log_private_t* me = (log_private_t*)me_;
+
+    log_empty(me_);
+    me->base = idx;
+}
+
+int log_get_base(log_t* me_)
+{
+    return ((log_private_t*)me_)->base;
+}
+
 void log_free(log_t * me_)
 {
     log_private_t* me = (log_private_t*)me_;
 
-    free(me->entries);
+    while (me->first < me->last)
+        free(me->chunks[--me->last]);
+    free(me->chunks);
+    free(me->spare);
     free(me);
 }
 
@@ -16,6 +16,27 @@ void log_free(log_t* me_);
  * @return 0 if unsucessful; 1 otherwise */
 int log_append_entry(log_t* me_, raft_entry_t* c);
 
+/**
+ * Add n entries to the log, persisting them with a single log_offer_batch
+ * call when there is one.
+ * @return 0 on success; -1 if they couldn't be persisted, none are added */
+int log_append_batch(log_t* me_, raft_entry_t* entries, int n);
+
+/**
+ * Add entry to log without calling log_offer, the entry isn't durable until
+ * log_persist_entries is called for it.
+ * @return 0 on success */
+int log_append_entry_unpersisted(log_t* me_, raft_entry_t* c);
+
+/**
+ * Persist the n entries from idx onwards, which were added by
+ * log_append_entry_unpersisted. The log is kept in chunks of
+ * LOG_CHUNK_ENTRIES entries, this is one log_offer_batch call for each chunk
+ * that they span.
+ * @return 0 on success; -1 if there are no such entries or persisting them
+ *  failed */
+int log_persist_entries(log_t* me_, int idx, int n);
+
 /**
  * @return number of entries held within log */
 int log_count(log_t* me_);
@@ -33,6 +54,15 @@ void log_empty(log_t * me_);
  * @return oldest entry */
 void *log_poll(log_t * me_);
 
+/**
+ * Empty the log, the next entry appended will have idx + 1.
+ * Entries up to and including idx are in a snapshot. */
+void log_load_from_snapshot(log_t* me_, int idx);
+
+/**
+ * @return idx of the last entry that has been compacted away */
+int log_get_base(log_t* me_);
+
 raft_entry_t* log_get_from_idx(log_t* me_, int idx, int *n_etys);
 
 raft_entry_t* log_get_at_idx(log_t* me_, int idx);
@@ -0,0 +1,87 @@
+/*************************************************************************
+  > File Name: raft_log_bench.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 02:12:45 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "raft.h"
+#include "raft_log.h"
+
+// how long each log operation took, in nanoseconds
+static uint64_t *samples;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, int n)
+{
+  qsort(samples, n, sizeof(*samples), cmp_u64);
+  fprintf(stdout, "%-8s n=%d p50=%luns p99=%luns p99.99=%luns max=%luns\n", name,
+          n, samples[n / 2], samples[(int)(n * 0.99)],
+          samples[(int)(n * 0.9999)], samples[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 10000000;
+  log_t *l = log_new();
+  raft_entry_t e;
+  memset(&e, 0, sizeof(e));
+  e.data.buf = "ticket";
+  e.data.len = 6;
+  samples = calloc(n, sizeof(*samples));
+
+  // the log only ever grows
+  for (int i = 0; i < n; i++)
+  {
+    e.id = i + 1;
+    uint64_t start = now_ns();
+    log_append_entry(l, &e);
+    samples[i] = now_ns() - start;
+  }
+  report("append", n);
+
+  for (int i = 0; i < n; i++)
+  {
+    uint64_t start = now_ns();
+    raft_entry_t *ety = log_get_at_idx(l, i + 1);
+    samples[i] = now_ns() - start;
+    if (ety->id != i + 1)
+    {
+      fprintf(stderr, "entry %d has id %d\n", i + 1, ety->id);
+      return 1;
+    }
+  }
+  report("get", n);
+
+  // steady state: compact an entry for every one appended
+  for (int i = 0; i < n; i++)
+  {
+    e.id = n + i + 1;
+    uint64_t start = now_ns();
+    log_append_entry(l, &e);
+    log_poll(l);
+    samples[i] = now_ns() - start;
+  }
+  report("compact", n);
+
+  log_free(l);
+  free(samples);
+  return 0;
+}
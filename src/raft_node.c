@@ -27,6 +27,16 @@ typedef struct
     int next_idx;
     int match_idx;
 
+    /* appendentries batches sent but not acknowledged yet */
+    int inflight;
+
+    /* the leader's clock when it sent the latest message acknowledged */
+    unsigned int acked_at;
+
+    /* the leader's read sequence when it sent the latest message
+     * acknowledged */
+    unsigned int acked_read_seq;
+
     int flags;
 
     int id;
@@ -69,6 +79,40 @@ void raft_node_set_match_idx(raft_node_t* me_, int matchIdx)
     me->match_idx = matchIdx;
 }
 
+int raft_node_get_inflight(raft_node_t* me_)
+{
+    raft_node_private_t* me = (raft_node_private_t*)me_;
+    return me->inflight;
+}
+
+void raft_node_set_inflight(raft_node_t* me_, int inflight)
+{
+    raft_node_private_t* me = (raft_node_private_t*)me_;
+    me->inflight = inflight < 0 ? 0 : inflight;
+}
+
+unsigned int raft_node_get_acked_at(raft_node_t* me_)
+{
+    return ((raft_node_private_t*)me_)->acked_at;
+}
+
+void raft_node_set_acked_at(raft_node_t* me_, unsigned int sent_at)
+{
+    raft_node_private_t* me = (raft_node_private_t*)me_;
+    me->acked_at = sent_at;
+}
+
+unsigned int raft_node_get_acked_read_seq(raft_node_t* me_)
+{
+    return ((raft_node_private_t*)me_)->acked_read_seq;
+}
+
+void raft_node_set_acked_read_seq(raft_node_t* me_, unsigned int read_seq)
+{
+    raft_node_private_t* me = (raft_node_private_t*)me_;
+    me->acked_read_seq = read_seq;
+}
+
 void* raft_node_get_udata(raft_node_t* me_)
 {
     raft_node_private_t* me = (raft_node_private_t*)me_;
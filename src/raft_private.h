@@ -12,6 +12,11 @@
  * @version 0.1
  */
 
+/* appendentries limits, see raft_set_appendentries_max_entries() */
+#define RAFT_DEFAULT_AE_MAX_ENTRIES 256
+#define RAFT_DEFAULT_AE_MAX_BYTES (1 << 20)
+#define RAFT_DEFAULT_AE_MAX_INFLIGHT 4
+
 typedef struct {
     /* Persistent state: */
 
@@ -46,6 +51,13 @@ typedef struct {
     int election_timeout;
     int request_timeout;
 
+    /* limits on the entries carried by a single appendentries message */
+    int ae_max_entries;
+    int ae_max_bytes;
+
+    /* batches we send a follower before waiting for it to acknowledge them */
+    int ae_max_inflight;
+
     /* what this node thinks is the node ID of the current leader, or -1 if
      * there isn't a known current leader. */
     raft_node_t* current_leader;
@@ -59,17 +71,57 @@ typedef struct {
 
     /* the log which has a voting cfg change, otherwise -1 */
     int voting_cfg_change_log_idx;
+
+    /* the last entry of ours that log_offer has made durable. The leader
+     * only counts itself towards an entry's quorum up to here */
+    int persisted_idx;
+
+    /* the last entry compacted into a snapshot, and its term */
+    int snapshot_last_idx;
+    int snapshot_last_term;
+
+    /* the node we're handing leadership over to, or NULL. transfer_elapsed
+     * is how long ago we started, we give up after an election timeout */
+    raft_node_t* transfer_leader;
+    int transfer_elapsed;
+
+    /* hold pre-votes before elections; prevoting is set while we are
+     * waiting on the answers to ours */
+    int prevote;
+    int prevoting;
+
+    /* the sum of the time passed to raft_periodic. Our messages are stamped
+     * with it and followers echo it back */
+    unsigned int now;
+
+    /* see raft_set_read_lease(). Acknowledgements of messages sent before
+     * lease_from don't count towards a lease */
+    int read_lease;
+    unsigned int lease_from;
+
+    /* bumped by every raft_read_index_start(). Our messages are stamped with
+     * it too, so reads don't have to move the clock along */
+    unsigned int read_seq;
 } raft_server_private_t;
 
 void raft_election_start(raft_server_t* me);
 
-void raft_become_candidate(raft_server_t* me);
+/**
+ * @return 0 on success; -1 if our new term and vote couldn't be persisted */
+int raft_become_candidate(raft_server_t* me);
+
+void raft_become_precandidate(raft_server_t* me);
 
 void raft_become_follower(raft_server_t* me);
 
 void raft_vote(raft_server_t* me, raft_node_t* node);
 
-void raft_set_current_term(raft_server_t* me,int term);
+int raft_set_current_term(raft_server_t* me,int term);
+
+/** Move to term and vote for nodeid in it, persisting both at once
+ * @return 0 on success; -1 if they couldn't be persisted, in which case the
+ *  term and vote are left as they were */
+int raft_set_current_term_and_vote(raft_server_t* me, int term, int nodeid);
 
 /**
  * @return 0 on error */
@@ -77,6 +129,8 @@ int raft_send_requestvote(raft_server_t* me, raft_node_t* node);
 
 int raft_send_appendentries(raft_server_t* me, raft_node_t* node);
 
+int raft_send_timeoutnow(raft_server_t* me, raft_node_t* node);
+
 void raft_send_appendentries_all(raft_server_t* me_);
 
 /**
@@ -90,6 +144,11 @@ int raft_apply_entry(raft_server_t* me_);
  * @return 0 if unsuccessful */
 int raft_append_entry(raft_server_t* me_, raft_entry_t* c);
 
+/**
+ * Appends n entries, persisting them with one log_offer_batch call
+ * @return 0 on success; -1 if they couldn't be persisted */
+int raft_append_entries(raft_server_t* me_, raft_entry_t* etys, int n);
+
 void raft_set_last_applied_idx(raft_server_t* me, int idx);
 
 void raft_set_state(raft_server_t* me_, int state);
@@ -104,6 +163,20 @@ void raft_node_set_match_idx(raft_node_t* node, int matchIdx);
 
 int raft_node_get_match_idx(raft_node_t* me_);
 
+int raft_node_get_inflight(raft_node_t* me_);
+
+void raft_node_set_inflight(raft_node_t* me_, int inflight);
+
+unsigned int raft_node_get_acked_at(raft_node_t* me_);
+
+/** Remember the sent_at of the latest message the node acknowledged */
+void raft_node_set_acked_at(raft_node_t* me_, unsigned int sent_at);
+
+unsigned int raft_node_get_acked_read_seq(raft_node_t* me_);
+
+/** Remember the read_seq of the latest message the node acknowledged */
+void raft_node_set_acked_read_seq(raft_node_t* me_, unsigned int read_seq);
+
 void raft_node_vote_for_me(raft_node_t* me_, const int vote);
 
 int raft_node_has_vote_for_me(raft_node_t* me_);
@@ -48,6 +48,9 @@ raft_server_t* raft_new()
     me->timeout_elapsed = 0;
     me->request_timeout = 200;
     me->election_timeout = 1000;
+    me->ae_max_entries = RAFT_DEFAULT_AE_MAX_ENTRIES;
+    me->ae_max_bytes = RAFT_DEFAULT_AE_MAX_BYTES;
+    me->ae_max_inflight = RAFT_DEFAULT_AE_MAX_INFLIGHT;
     me->log = log_new();
     me->voting_cfg_change_log_idx = -1;
     raft_set_state((raft_server_t*)me, RAFT_STATE_FOLLOWER);
@@ -80,7 +83,10 @@ void raft_election_start(raft_server_t* me_)
           me->election_timeout, me->timeout_elapsed, me->current_term,
           raft_get_current_idx(me_));
 
-    raft_become_candidate(me_);
+    if (me->prevote)
+        raft_become_precandidate(me_);
+    else
+        raft_become_candidate(me_);
 }
 
 void raft_become_leader(raft_server_t* me_)
@@ -91,6 +97,13 @@ void raft_become_leader(raft_server_t* me_)
     __log(me_, NULL, "becoming leader term:%d", raft_get_current_term(me_));
 
     raft_set_state(me_, RAFT_STATE_LEADER);
+    me->transfer_leader = NULL;
+    me->lease_from = me->now;
+
+    /* followers persist entries as they append them, whatever log we have
+     * is on disk */
+    me->persisted_idx = raft_get_current_idx(me_);
+
     for (i = 0; i < me->num_nodes; i++)
     {
         if (me->node == me->nodes[i] || !raft_node_is_voting(me->nodes[i]))
@@ -101,21 +114,55 @@ void raft_become_leader(raft_server_t* me_)
         raft_node_t* node = me->nodes[i];
         raft_node_set_next_idx(node, raft_get_current_idx(me_) + 1);
         raft_node_set_match_idx(node, 0);
+        raft_node_set_inflight(node, 0);
+        raft_node_set_acked_at(node, me->now - 1);
+        raft_node_set_acked_read_seq(node, me->read_seq - 1);
         raft_send_appendentries(me_, node);
     }
 }
 
-void raft_become_candidate(raft_server_t* me_)
+void raft_become_precandidate(raft_server_t* me_)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    int i;
+
+    __log(me_, NULL, "becoming pre-candidate");
+
+    /* we remain a follower, with our term and vote untouched, until a
+     * majority says we could win an election */
+    for (i = 0; i < me->num_nodes; i++)
+        raft_node_vote_for_me(me->nodes[i], 0);
+    raft_node_vote_for_me(me->node, 1);
+    me->prevoting = 1;
+    me->current_leader = NULL;
+
+    me->timeout_elapsed = rand() % me->election_timeout;
+
+    for (i = 0; i < me->num_nodes; i++)
+        if (me->node != me->nodes[i] && raft_node_is_voting(me->nodes[i]))
+            raft_send_requestvote(me_, me->nodes[i]);
+}
+
+int raft_become_candidate(raft_server_t* me_)
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
     int i;
 
     __log(me_, NULL, "becoming candidate");
+    me->prevoting = 0;
+
+    if (-1 == raft_set_current_term_and_vote(me_,
+                                             raft_get_current_term(me_) + 1,
+                                             me->node ? raft_node_get_id(me->node) : -1))
+    {
+        /* try again once another election timeout has passed */
+        __log(me_, NULL, "couldn't persist our vote, not standing");
+        me->timeout_elapsed = 0;
+        return -1;
+    }
 
-    raft_set_current_term(me_, raft_get_current_term(me_) + 1);
     for (i = 0; i < me->num_nodes; i++)
         raft_node_vote_for_me(me->nodes[i], 0);
-    raft_vote(me_, me->node);
     me->current_leader = NULL;
     raft_set_state(me_, RAFT_STATE_CANDIDATE);
 
@@ -126,12 +173,16 @@ void raft_become_candidate(raft_server_t* me_)
     for (i = 0; i < me->num_nodes; i++)
         if (me->node != me->nodes[i] && raft_node_is_voting(me->nodes[i]))
             raft_send_requestvote(me_, me->nodes[i]);
+    return 0;
 }
 
 void raft_become_follower(raft_server_t* me_)
 {
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
     __log(me_, NULL, "becoming follower");
     raft_set_state(me_, RAFT_STATE_FOLLOWER);
+    me->transfer_leader = NULL;
 }
 
 int raft_periodic(raft_server_t* me_, int msec_since_last_period)
@@ -139,11 +190,28 @@ int raft_periodic(raft_server_t* me_, int msec_since_last_period)
     raft_server_private_t* me = (raft_server_private_t*)me_;
 
     me->timeout_elapsed += msec_since_last_period;
+    me->now += msec_since_last_period;
 
     if (me->state == RAFT_STATE_LEADER)
     {
         if (me->request_timeout <= me->timeout_elapsed)
             raft_send_appendentries_all(me_);
+
+        /* nobody took over, carry on as leader */
+        if (me->transfer_leader)
+        {
+            me->transfer_elapsed += msec_since_last_period;
+            if (me->election_timeout <= me->transfer_elapsed)
+            {
+                __log(me_, me->transfer_leader, "leadership transfer timed out");
+                me->transfer_leader = NULL;
+
+                /* the node might still win an election it started on our
+                 * timeoutnow, and followers don't hold back their votes
+                 * from such an election while they hear from us */
+                me->lease_from = me->now + me->election_timeout;
+            }
+        }
     }
     else if (me->election_timeout <= me->timeout_elapsed)
     {
@@ -164,6 +232,21 @@ raft_entry_t* raft_get_entry_from_idx(raft_server_t* me_, int etyidx)
     return log_get_at_idx(me->log, etyidx);
 }
 
+/** Walk back from idx to our last entry of term.
+ * @return 0 if we don't have any entry of that term */
+static int __last_idx_of_term(raft_server_t* me_, int term, int idx)
+{
+    for (; 0 < idx; idx--)
+    {
+        raft_entry_t* e = raft_get_entry_from_idx(me_, idx);
+        if (!e || e->term < term)
+            break;
+        if (e->term == term)
+            return idx;
+    }
+    return 0;
+}
+
 int raft_recv_appendentries_response(raft_server_t* me_,
                                      raft_node_t* node,
                                      msg_appendentries_response_t* r)
@@ -177,9 +260,28 @@ int raft_recv_appendentries_response(raft_server_t* me_,
           r->current_idx,
           r->first_idx);
 
-    /* Stale response -- ignore */
-    if (r->current_idx != 0 && r->current_idx <= raft_node_get_match_idx(node))
+    /* the node still took us for leader when it got our message */
+    if (node && raft_is_leader(me_) && r->term == me->current_term &&
+        0 < (int)(r->sent_at - raft_node_get_acked_at(node)))
+        raft_node_set_acked_at(node, r->sent_at);
+    if (node && raft_is_leader(me_) && r->term == me->current_term &&
+        0 < (int)(r->read_seq - raft_node_get_acked_read_seq(node)))
+        raft_node_set_acked_read_seq(node, r->read_seq);
+
+    /* Stale response -- ignore. With batches pipelined a rejection can
+     * follow an acknowledgement, it's only stale if the follower has since
+     * acknowledged the entry the rejected batch followed on from */
+    int match_idx = raft_node_get_match_idx(node);
+    if (r->success || 0 == r->first_idx ?
+        r->current_idx != 0 && r->current_idx <= match_idx :
+        r->first_idx <= match_idx + 1)
+    {
+        /* though the follower has everything we sent it, so nothing can be
+         * in flight anymore */
+        if (r->success && raft_node_get_next_idx(node) == r->current_idx + 1)
+            raft_node_set_inflight(node, 0);
         return 0;
+    }
 
     if (!raft_is_leader(me_))
         return -1;
@@ -201,13 +303,31 @@ int raft_recv_appendentries_response(raft_server_t* me_,
 
     if (0 == r->success)
     {
+        /* The batches sent after the rejected one don't follow on from the
+         * follower's log either, we roll back and send them again */
+        raft_node_set_inflight(node, 0);
+
         /* If AppendEntries fails because of log inconsistency:
            decrement nextIndex and retry (§5.3) */
         assert(0 <= raft_node_get_next_idx(node));
 
-        int next_idx = raft_node_get_next_idx(node);
+        /* roll back from the rejected batch, rather than from where the
+         * batches sent since then have moved next_idx to */
+        int next_idx = r->first_idx ? r->first_idx : raft_node_get_next_idx(node);
         assert(0 <= next_idx);
-        if (r->current_idx < next_idx - 1)
+        if (0 < r->conflict_idx)
+        {
+            /* Skip the follower's whole conflicting term at once. If we have
+             * entries of that term the logs agree up to our last one of them,
+             * otherwise none of the follower's entries of that term are any
+             * good */
+            int idx = 0;
+            if (0 < r->conflict_term)
+                idx = __last_idx_of_term(me_, r->conflict_term, next_idx - 1);
+            idx = idx ? idx + 1 : r->conflict_idx;
+            raft_node_set_next_idx(node, max(1, min(idx, next_idx - 1)));
+        }
+        else if (r->current_idx < next_idx - 1)
             raft_node_set_next_idx(node, min(r->current_idx + 1, raft_get_current_idx(me_)));
         else
             raft_node_set_next_idx(node, next_idx - 1);
@@ -219,9 +339,22 @@ int raft_recv_appendentries_response(raft_server_t* me_,
 
     assert(r->current_idx <= raft_get_current_idx(me_));
 
-    raft_node_set_next_idx(node, r->current_idx + 1);
+    /* batches sent after this one have moved next_idx further already */
+    if (raft_node_get_next_idx(node) <= r->current_idx)
+        raft_node_set_next_idx(node, r->current_idx + 1);
     raft_node_set_match_idx(node, r->current_idx);
 
+    /* the node we're handing over to has caught up */
+    if (node == me->transfer_leader &&
+        r->current_idx == raft_get_current_idx(me_))
+        raft_send_timeoutnow(me_, node);
+
+    /* heartbeats don't take up room in the window */
+    if (r->first_idx <= r->current_idx)
+        raft_node_set_inflight(node, raft_node_get_inflight(node) - 1);
+    if (raft_node_get_next_idx(node) == r->current_idx + 1)
+        raft_node_set_inflight(node, 0);
+
     if (!raft_node_is_voting(node) &&
         -1 == me->voting_cfg_change_log_idx &&
         raft_get_current_idx(me_) <= r->current_idx + 1 &&
@@ -234,8 +367,8 @@ int raft_recv_appendentries_response(raft_server_t* me_,
     }
 
     /* Update commit idx */
-    int votes = 1; /* include me */
     int point = r->current_idx;
+    int votes = point <= me->persisted_idx; /* include me, once on disk */
     int i;
     for (i = 0; i < me->num_nodes; i++)
     {
@@ -247,23 +380,42 @@ int raft_recv_appendentries_response(raft_server_t* me_,
         if (0 < match_idx)
         {
             raft_entry_t* ety = raft_get_entry_from_idx(me_, match_idx);
-            if (ety->term == me->current_term && point <= match_idx)
+            if (ety && ety->term == me->current_term && point <= match_idx)
                 votes++;
         }
     }
 
+    int committed = 0;
     if (me->num_nodes / 2 < votes && raft_get_commit_idx(me_) < point)
+    {
         raft_set_commit_idx(me_, point);
+        committed = 1;
+    }
 
     /* Aggressively send remaining entries */
     if (raft_get_entry_from_idx(me_, raft_node_get_next_idx(node)))
         raft_send_appendentries(me_, node);
 
-    /* periodic applies committed entries lazily */
+    /* apply newly committed entries now rather than on the next period, so
+     * that clients waiting on them don't wait on a timer */
+    if (committed)
+        raft_apply_all(me_);
 
     return 0;
 }
 
+/** Walk back from idx to the first entry of the same term */
+static int __first_idx_of_term(raft_server_t* me_, int idx)
+{
+    raft_entry_t* e = raft_get_entry_from_idx(me_, idx);
+    raft_entry_t* prev;
+
+    while (1 < idx && (prev = raft_get_entry_from_idx(me_, idx - 1)) &&
+           prev->term == e->term)
+        idx--;
+    return idx;
+}
+
 int raft_recv_appendentries(
     raft_server_t* me_,
     raft_node_t* node,
@@ -286,6 +438,10 @@ int raft_recv_appendentries(
               ae->n_entries);
 
     r->term = me->current_term;
+    r->conflict_term = 0;
+    r->conflict_idx = 0;
+    r->sent_at = ae->sent_at;
+    r->read_seq = ae->read_seq;
 
     if (raft_is_candidate(me_) && me->current_term == ae->term)
     {
@@ -307,27 +463,30 @@ int raft_recv_appendentries(
     }
 
     /* Not the first appendentries we've received */
-    /* NOTE: the log starts at 1 */
-    if (0 < ae->prev_log_idx)
+    /* NOTE: the log starts at 1. Entries up to our snapshot are committed, so
+     * they are bound to match the leader's */
+    if (me->snapshot_last_idx < ae->prev_log_idx)
     {
         raft_entry_t* e = raft_get_entry_from_idx(me_, ae->prev_log_idx);
 
         if (!e)
         {
             __log(me_, node, "AE no log at prev_idx %d", ae->prev_log_idx);
-            goto fail_with_current_idx;
+            goto fail_short_log;
         }
 
         /* 2. Reply false if log doesn't contain an entry at prevLogIndex
            whose term matches prevLogTerm (§5.3) */
         if (raft_get_current_idx(me_) < ae->prev_log_idx)
-            goto fail_with_current_idx;
+            goto fail_short_log;
 
         if (e->term != ae->prev_log_term)
         {
             __log(me_, node, "AE term doesn't match prev_term (ie. %d vs %d) ci:%d pli:%d",
                   e->term, ae->prev_log_term, raft_get_current_idx(me_), ae->prev_log_idx);
             assert(me->commit_idx < ae->prev_log_idx);
+            r->conflict_term = e->term;
+            r->conflict_idx = __first_idx_of_term(me_, ae->prev_log_idx);
             /* Delete all the following log entries because they don't match */
             log_delete(me->log, ae->prev_log_idx);
             r->current_idx = ae->prev_log_idx - 1;
@@ -353,6 +512,9 @@ int raft_recv_appendentries(
         int ety_index = ae->prev_log_idx + 1 + i;
         raft_entry_t* existing_ety = raft_get_entry_from_idx(me_, ety_index);
         r->current_idx = ety_index;
+        /* already in our snapshot */
+        if (ety_index <= me->snapshot_last_idx)
+            continue;
         if (existing_ety && existing_ety->term != ety->term)
         {
             assert(me->commit_idx < ety_index);
@@ -363,14 +525,15 @@ int raft_recv_appendentries(
             break;
     }
 
-    /* Pick up remainder in case of mismatch or missing entry */
-    for (; i < ae->n_entries; i++)
+    /* Pick up remainder in case of mismatch or missing entry, it's
+     * persisted in one go */
+    if (i < ae->n_entries)
     {
-        int e = raft_append_entry(me_, &ae->entries[i]);
+        int e = raft_append_entries(me_, &ae->entries[i], ae->n_entries - i);
         if (-1 == e)
             goto fail_with_current_idx;
 
-        r->current_idx = ae->prev_log_idx + 1 + i;
+        r->current_idx = ae->prev_log_idx + ae->n_entries;
     }
 
     /* 4. If leaderCommit > commitIndex, set commitIndex =
@@ -379,56 +542,185 @@ int raft_recv_appendentries(
     {
         int last_log_idx = max(raft_get_current_idx(me_), 1);
         raft_set_commit_idx(me_, min(last_log_idx, ae->leader_commit));
+        raft_apply_all(me_);
     }
 
     /* update current leader because we accepted appendentries from it */
     me->current_leader = node;
+    me->prevoting = 0;
 
     r->success = 1;
     r->first_idx = ae->prev_log_idx + 1;
     return 0;
 
+fail_short_log:
+    r->conflict_term = 0;
+    r->conflict_idx = raft_get_current_idx(me_) + 1;
 fail_with_current_idx:
     r->current_idx = raft_get_current_idx(me_);
 fail:
     r->success = 0;
-    r->first_idx = 0;
+    /* tells a pipelining leader which batch we rejected */
+    r->first_idx = ae->prev_log_idx + 1;
     return -1;
 }
 
-int raft_already_voted(raft_server_t* me_)
+int raft_recv_installsnapshot(
+    raft_server_t* me_,
+    raft_node_t* node,
+    msg_installsnapshot_t* is,
+    msg_appendentries_response_t *r
+    )
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
-    return -1 != me->voted_for;
+
+    me->timeout_elapsed = 0;
+
+    __log(me_, node, "recvd installsnapshot from: %lx, t:%d ci:%d li:%d lt:%d",
+          node,
+          is->term,
+          raft_get_current_idx(me_),
+          is->last_idx,
+          is->last_term);
+
+    r->term = me->current_term;
+    r->success = 0;
+    r->current_idx = raft_get_current_idx(me_);
+    /* a snapshot doesn't take up room in the leader's window */
+    r->first_idx = is->last_idx + 1;
+    r->conflict_term = 0;
+    r->conflict_idx = 0;
+    r->sent_at = is->sent_at;
+    r->read_seq = is->read_seq;
+
+    if (is->term < me->current_term)
+    {
+        __log(me_, node, "IS term %d is less than current term %d",
+              is->term, me->current_term);
+        return -1;
+    }
+
+    if (me->current_term < is->term)
+    {
+        raft_set_current_term(me_, is->term);
+        r->term = is->term;
+    }
+    if (!raft_is_follower(me_))
+        raft_become_follower(me_);
+    me->current_leader = node;
+
+    r->success = 1;
+    r->current_idx = is->last_idx;
+
+    /* we have got that far on our own */
+    if (is->last_idx <= me->commit_idx)
+        return 1;
+
+    /* our log already has the snapshot's entries, we only need to commit
+     * them */
+    raft_entry_t* e = raft_get_entry_from_idx(me_, is->last_idx);
+    if (e && e->term == is->last_term)
+    {
+        raft_set_commit_idx(me_, is->last_idx);
+        raft_apply_all(me_);
+        return 1;
+    }
+
+    raft_load_snapshot(me_, is->last_idx, is->last_term);
+    return 0;
 }
 
-static int __should_grant_vote(raft_server_private_t* me, msg_requestvote_t* vr)
+int raft_compact_log(raft_server_t* me_, int idx)
 {
-    if (vr->term < raft_get_current_term((void*)me))
-        return 0;
+    raft_server_private_t* me = (raft_server_private_t*)me_;
 
-    /* TODO: if voted for is candiate return 1 (if below checks pass) */
-    if (raft_already_voted((void*)me))
-        return 0;
+    /* the state machine has to have caught up with the snapshot */
+    if (idx <= me->snapshot_last_idx || me->last_applied_idx < idx)
+        return -1;
+
+    raft_entry_t* e = raft_get_entry_from_idx(me_, idx);
+    assert(e);
+    int term = e->term;
+
+    __log(me_, NULL, "compacting log: %d to %d",
+          log_get_base(me->log), idx);
+
+    while (log_get_base(me->log) < idx)
+        log_poll(me->log);
+
+    me->snapshot_last_idx = idx;
+    me->snapshot_last_term = term;
+    return 0;
+}
+
+void raft_load_snapshot(raft_server_t* me_, int last_idx, int last_term)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
 
-    /* Below we check if log is more up-to-date... */
+    log_load_from_snapshot(me->log, last_idx);
+    me->persisted_idx = last_idx;
+    me->snapshot_last_idx = last_idx;
+    me->snapshot_last_term = last_term;
+    me->commit_idx = last_idx;
+    me->last_applied_idx = last_idx;
 
+    if (me->voting_cfg_change_log_idx <= last_idx)
+        me->voting_cfg_change_log_idx = -1;
+}
+
+int raft_already_voted(raft_server_t* me_)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    return -1 != me->voted_for;
+}
+
+/** @return 1 if the candidate's log is at least as up-to-date as ours */
+static int __log_is_up_to_date(raft_server_private_t* me, msg_requestvote_t* vr)
+{
     int current_idx = raft_get_current_idx((void*)me);
 
     /* Our log is definitely not more up-to-date if it's empty! */
     if (0 == current_idx)
         return 1;
 
-    raft_entry_t* e = raft_get_entry_from_idx((void*)me, current_idx);
-    if (e->term < vr->last_log_term)
+    /* the last entry might only be in our snapshot */
+    int last_log_term = raft_get_last_log_term((void*)me);
+    if (last_log_term < vr->last_log_term)
         return 1;
 
-    if (vr->last_log_term == e->term && current_idx <= vr->last_log_idx)
+    if (vr->last_log_term == last_log_term && current_idx <= vr->last_log_idx)
         return 1;
 
     return 0;
 }
 
+static int __should_grant_vote(raft_server_private_t* me, msg_requestvote_t* vr)
+{
+    if (vr->term < raft_get_current_term((void*)me))
+        return 0;
+
+    /* TODO: if voted for is candiate return 1 (if below checks pass) */
+    if (raft_already_voted((void*)me))
+        return 0;
+
+    return __log_is_up_to_date(me, vr);
+}
+
+static int __should_grant_prevote(raft_server_private_t* me,
+                                  msg_requestvote_t* vr)
+{
+    /* an election couldn't make the candidate leader of a newer term */
+    if (vr->term <= raft_get_current_term((void*)me))
+        return 0;
+
+    /* the leader we have is alive and well */
+    if (raft_is_leader((void*)me) ||
+        (me->current_leader && me->timeout_elapsed < me->election_timeout))
+        return 0;
+
+    return __log_is_up_to_date(me, vr);
+}
+
 int raft_recv_requestvote(raft_server_t* me_,
                           raft_node_t* node,
                           msg_requestvote_t* vr,
@@ -436,19 +728,36 @@ int raft_recv_requestvote(raft_server_t* me_,
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
 
-    if (raft_get_current_term(me_) < vr->term)
+    /* a pre-vote doesn't change anything, it's a what if */
+    if (vr->prevote)
+    {
+        r->vote_granted = __should_grant_prevote(me, vr);
+        r->prevote = 1;
+
+        __log(me_, node, "node requested pre-vote: %d replying: %s",
+              node, r->vote_granted == 1 ? "granted" : "not granted");
+
+        r->term = raft_get_current_term(me_);
+        return 0;
+    }
+
+    int new_term = raft_get_current_term(me_) < vr->term;
+    if (new_term)
     {
-        raft_set_current_term(me_, vr->term);
+        /* saved below, along with our vote if we grant it */
+        me->current_term = vr->term;
+        me->voted_for = -1;
         raft_become_follower(me_);
     }
 
-    if (__should_grant_vote(me, vr))
+    /* the vote is only granted once it's been persisted */
+    if (__should_grant_vote(me, vr) &&
+        0 == raft_set_current_term_and_vote(me_, vr->term, vr->candidate_id))
     {
         /* It shouldn't be possible for a leader or candidate to grant a vote
          * Both states would have voted for themselves */
         assert(!(raft_is_leader(me_) || raft_is_candidate(me_)));
 
-        raft_vote_for_nodeid(me_, vr->candidate_id);
         r->vote_granted = 1;
 
         /* there must be in an election. */
@@ -457,7 +766,12 @@ int raft_recv_requestvote(raft_server_t* me_,
         me->timeout_elapsed = 0;
     }
     else
+    {
+        if (new_term)
+            raft_set_current_term_and_vote(me_, vr->term, -1);
         r->vote_granted = 0;
+    }
+    r->prevote = 0;
 
     __log(me_, node, "node requested vote: %d replying: %s",
           node, r->vote_granted == 1 ? "granted" : "not granted");
@@ -483,6 +797,34 @@ int raft_recv_requestvote_response(raft_server_t* me_,
     __log(me_, node, "node responded to requestvote status: %s",
           r->vote_granted == 1 ? "granted" : "not granted");
 
+    if (r->prevote)
+    {
+        if (!me->prevoting || !raft_is_follower(me_))
+            return 0;
+
+        /* we're behind, the pre-vote can't win */
+        if (raft_get_current_term(me_) < r->term)
+        {
+            raft_set_current_term(me_, r->term);
+            me->prevoting = 0;
+            return 0;
+        }
+
+        if (1 == r->vote_granted && node)
+        {
+            raft_node_vote_for_me(node, 1);
+
+            int i, votes = 0;
+            for (i = 0; i < me->num_nodes; i++)
+                if (raft_node_is_voting(me->nodes[i]) &&
+                    raft_node_has_vote_for_me(me->nodes[i]))
+                    votes++;
+            if (raft_votes_is_majority(me->num_nodes, votes))
+                raft_become_candidate(me_);
+        }
+        return 0;
+    }
+
     if (!raft_is_candidate(me_))
     {
         return 0;
@@ -530,7 +872,9 @@ int raft_recv_entry(raft_server_t* me_,
         if (-1 != me->voting_cfg_change_log_idx)
             return -1;
 
-    if (!raft_is_leader(me_))
+    /* the entry could be lost once the node we're handing over to takes
+     * over, and it stops us from catching that node up */
+    if (!raft_is_leader(me_) || me->transfer_leader)
         return -1;
 
     __log(me_, NULL, "received entry t:%d id: %d idx: %d",
@@ -541,7 +885,13 @@ int raft_recv_entry(raft_server_t* me_,
     ety.id = e->id;
     ety.type = e->type;
     memcpy(&ety.data, &e->data, sizeof(raft_entry_data_t));
-    raft_append_entry(me_, &ety);
+
+    /* The entry goes out to the followers before we persist it, so that our
+     * disk write overlaps with theirs rather than adding to it */
+    if (-1 == log_append_entry_unpersisted(me->log, &ety))
+        return -1;
+    int idx = raft_get_current_idx(me_);
+
     for (i = 0; i < me->num_nodes; i++)
     {
         if (me->node == me->nodes[i] || !me->nodes[i] ||
@@ -554,15 +904,22 @@ int raft_recv_entry(raft_server_t* me_,
          * Don't send the entry to peers who are behind, to prevent them from
          * becoming congested. */
         int next_idx = raft_node_get_next_idx(me->nodes[i]);
-        if (next_idx == raft_get_current_idx(me_)) 
+        if (next_idx == raft_get_current_idx(me_) &&
+            raft_node_get_inflight(me->nodes[i]) < me->ae_max_inflight)
         {
             raft_send_appendentries(me_, me->nodes[i]);
         }
     }
 
+    /* We only count towards the entry's quorum once it's durable. An entry
+     * whose write failed before is retried along with this one */
+    if (0 == log_persist_entries(me->log, me->persisted_idx + 1,
+                                 idx - me->persisted_idx))
+        me->persisted_idx = idx;
+
     /* if we're the only node, we can consider the entry committed */
-    if (1 == me->num_nodes)
-        me->commit_idx = raft_get_current_idx(me_);
+    if (1 == me->num_nodes && me->commit_idx < me->persisted_idx)
+        me->commit_idx = me->persisted_idx;
 
     r->id = e->id;
     r->idx = raft_get_current_idx(me_);
@@ -574,6 +931,163 @@ int raft_recv_entry(raft_server_t* me_,
     return 0;
 }
 
+int raft_transfer_leadership(raft_server_t* me_, raft_node_t* node)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    if (!raft_is_leader(me_) || me->transfer_leader || !node ||
+        node == me->node || !raft_node_is_voting(node))
+        return -1;
+
+    __log(me_, node, "transferring leadership");
+
+    me->transfer_leader = node;
+    me->transfer_elapsed = 0;
+
+    /* otherwise we send the timeoutnow once its log has caught up */
+    if (raft_node_get_match_idx(node) == raft_get_current_idx(me_))
+        raft_send_timeoutnow(me_, node);
+    else
+        raft_send_appendentries(me_, node);
+    return 0;
+}
+
+int raft_send_timeoutnow(raft_server_t* me_, raft_node_t* node)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    msg_timeoutnow_t tn;
+
+    assert(node);
+    assert(node != me->node);
+
+    __log(me_, node, "sending timeoutnow to: %d", node);
+
+    tn.term = me->current_term;
+    if (me->cb.send_timeoutnow)
+        me->cb.send_timeoutnow(me_, me->udata, node, &tn);
+    return 0;
+}
+
+int raft_recv_timeoutnow(raft_server_t* me_,
+                         raft_node_t* node,
+                         msg_timeoutnow_t* tn)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    if (tn->term < me->current_term || raft_is_leader(me_) ||
+        !me->node || !raft_node_is_voting(me->node))
+        return -1;
+
+    __log(me_, node, "received timeoutnow, starting election");
+
+    /* the leader is handing over to us, there's no need to ask first */
+    return raft_become_candidate(me_);
+}
+
+/** @return 1 if we've committed an entry of our current term, until then
+ * our commit idx might be behind the previous leader's */
+static int __committed_in_term(raft_server_private_t* me)
+{
+    if (0 == me->commit_idx)
+        return 0;
+
+    raft_entry_t* ety = raft_get_entry_from_idx((void*)me, me->commit_idx);
+    if (ety)
+        return ety->term == me->current_term;
+    return me->commit_idx == me->snapshot_last_idx &&
+        me->snapshot_last_term == me->current_term;
+}
+
+/** @return 1 if a majority, us included, has acknowledged a message we sent
+ * with a stamp at or after since
+ * @param[in] acked Gets the stamp of a node's latest acknowledged message */
+static int __majority_acked(raft_server_private_t* me,
+                            unsigned int (*acked)(raft_node_t*),
+                            unsigned int since)
+{
+    int i, votes = 1;
+
+    for (i = 0; i < me->num_nodes; i++)
+    {
+        if (me->node == me->nodes[i] || !raft_node_is_voting(me->nodes[i]))
+            continue;
+        if (0 <= (int)(acked(me->nodes[i]) - since))
+            votes++;
+    }
+    return me->num_nodes / 2 < votes;
+}
+
+static int __majority_acked_since(raft_server_private_t* me, unsigned int since)
+{
+    return __majority_acked(me, raft_node_get_acked_at, since);
+}
+
+int raft_read_lease_remaining(raft_server_t* me_)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    unsigned int since = 0;
+    int i, found = 0;
+
+    if (!raft_is_leader(me_) || me->transfer_leader || 0 == me->read_lease ||
+        !__committed_in_term(me) || me->last_applied_idx < me->commit_idx)
+        return 0;
+
+    if (__majority_acked_since(me, me->now + 1))
+        return me->read_lease;
+
+    /* the lease runs from the latest message a majority has acknowledged */
+    for (i = 0; i < me->num_nodes; i++)
+    {
+        if (me->node == me->nodes[i] || !raft_node_is_voting(me->nodes[i]))
+            continue;
+
+        unsigned int acked_at = raft_node_get_acked_at(me->nodes[i]);
+        if ((int)(acked_at - me->lease_from) < 0 ||
+            (found && (int)(acked_at - since) <= 0))
+            continue;
+        if (__majority_acked_since(me, acked_at))
+        {
+            since = acked_at;
+            found = 1;
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    int left = me->read_lease - (int)(me->now - since);
+    return 0 < left ? left : 0;
+}
+
+int raft_read_index_start(raft_server_t* me_, raft_read_index_t* rd)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    if (!raft_is_leader(me_) || !__committed_in_term(me))
+        return -1;
+
+    rd->term = me->current_term;
+    rd->idx = me->commit_idx;
+
+    /* only acknowledgements of messages sent after now confirm the read */
+    rd->seq = me->read_seq++;
+    raft_send_appendentries_all(me_);
+    return 0;
+}
+
+int raft_read_index_ready(raft_server_t* me_, raft_read_index_t* rd)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    if (!raft_is_leader(me_) || me->current_term != rd->term)
+        return -1;
+
+    if (!__majority_acked(me, raft_node_get_acked_read_seq, rd->seq + 1) ||
+        me->last_applied_idx < rd->idx)
+        return 0;
+    return 1;
+}
+
 int raft_send_requestvote(raft_server_t* me_, raft_node_t* node)
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
@@ -588,6 +1102,11 @@ int raft_send_requestvote(raft_server_t* me_, raft_node_t* node)
     rv.last_log_idx = raft_get_current_idx(me_);
     rv.last_log_term = raft_get_last_log_term(me_);
     rv.candidate_id = raft_get_nodeid(me_);
+
+    /* a pre-vote is for the term we'd stand in */
+    rv.prevote = me->prevoting;
+    if (rv.prevote)
+        rv.term++;
     if (me->cb.send_requestvote)
         me->cb.send_requestvote(me_, me->udata, node, &rv);
     return 0;
@@ -600,7 +1119,25 @@ int raft_append_entry(raft_server_t* me_, raft_entry_t* ety)
     if (raft_entry_is_voting_cfg_change(ety))
         me->voting_cfg_change_log_idx = raft_get_current_idx(me_);
 
-    return log_append_entry(me->log, ety);
+    int e = log_append_entry(me->log, ety);
+    if (0 == e)
+        me->persisted_idx = raft_get_current_idx(me_);
+    return e;
+}
+
+int raft_append_entries(raft_server_t* me_, raft_entry_t* etys, int n)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (raft_entry_is_voting_cfg_change(&etys[i]))
+            me->voting_cfg_change_log_idx = raft_get_current_idx(me_) + i;
+
+    int e = log_append_batch(me->log, etys, n);
+    if (0 == e)
+        me->persisted_idx = raft_get_current_idx(me_);
+    return e;
 }
 
 int raft_apply_entry(raft_server_t* me_)
@@ -621,8 +1158,15 @@ int raft_apply_entry(raft_server_t* me_)
           me->last_applied_idx, e->id, e->data.len);
 
     me->last_applied_idx++;
-    if (me->cb.applylog)
-        me->cb.applylog(me_, me->udata, e);
+    if (me->cb.applylog_batch ?
+        0 != me->cb.applylog_batch(me_, me->udata, e, log_idx, 1) :
+        me->cb.applylog && 0 != me->cb.applylog(me_, me->udata, e))
+    {
+        /* it's applied again next time round */
+        __log(me_, NULL, "failed to apply log: %d", log_idx);
+        me->last_applied_idx--;
+        return -1;
+    }
 
     /* voting cfg change is now complete */
     if (log_idx == me->voting_cfg_change_log_idx)
@@ -637,6 +1181,26 @@ raft_entry_t* raft_get_entries_from_idx(raft_server_t* me_, int idx, int* n_etys
     return log_get_from_idx(me->log, idx, n_etys);
 }
 
+/** Trim a run of entries down to what fits into one appendentries message.
+ * @return number of entries to send */
+static int __appendentries_batch(raft_server_private_t* me,
+                                 raft_entry_t* etys,
+                                 int n_etys)
+{
+    int i, bytes = 0;
+
+    if (0 < me->ae_max_entries && me->ae_max_entries < n_etys)
+        n_etys = me->ae_max_entries;
+
+    for (i = 0; i < n_etys; i++)
+    {
+        bytes += etys[i].data.len;
+        if (0 < i && 0 < me->ae_max_bytes && me->ae_max_bytes < bytes)
+            break;
+    }
+    return i;
+}
+
 int raft_send_appendentries(raft_server_t* me_, raft_node_t* node)
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
@@ -656,30 +1220,67 @@ int raft_send_appendentries(raft_server_t* me_, raft_node_t* node)
     ae.prev_log_term = 0;
     ae.n_entries = 0;
     ae.entries = NULL;
+    ae.sent_at = me->now;
+    ae.read_seq = me->read_seq;
 
     int next_idx = raft_node_get_next_idx(node);
 
-    ae.entries = raft_get_entries_from_idx(me_, next_idx, &ae.n_entries);
+    /* the entries the follower needs have been compacted away */
+    if (next_idx <= me->snapshot_last_idx && me->cb.send_installsnapshot)
+    {
+        msg_installsnapshot_t is;
+        is.term = me->current_term;
+        is.last_idx = me->snapshot_last_idx;
+        is.sent_at = me->now;
+        is.read_seq = me->read_seq;
+        is.last_term = me->snapshot_last_term;
+
+        __log(me_, node, "sending installsnapshot node: t:%d li:%d lt:%d",
+              is.term, is.last_idx, is.last_term);
+
+        me->cb.send_installsnapshot(me_, me->udata, node, &is);
+
+        /* appendentries follow on from the snapshot, if it doesn't get
+         * installed the follower rejects them and we end up back here */
+        raft_node_set_next_idx(node, me->snapshot_last_idx + 1);
+        return 0;
+    }
+
+    /* the window is full, we only send a heartbeat */
+    if (raft_node_get_inflight(node) < me->ae_max_inflight)
+        ae.entries = raft_get_entries_from_idx(me_, next_idx, &ae.n_entries);
+    if (ae.entries)
+        ae.n_entries = __appendentries_batch(me, ae.entries, ae.n_entries);
 
     /* previous log is the log just before the new logs */
     if (1 < next_idx)
     {
         raft_entry_t* prev_ety = raft_get_entry_from_idx(me_, next_idx - 1);
         ae.prev_log_idx = next_idx - 1;
-        if (prev_ety){
+        if (prev_ety)
             ae.prev_log_term = prev_ety->term;
-        }
+        else if (ae.prev_log_idx == me->snapshot_last_idx)
+            ae.prev_log_term = me->snapshot_last_term;
     }
 
-    __log(me_, node, "sending appendentries node: ci:%d t:%d lc:%d pli:%d plt:%d",
+    __log(me_, node, "sending appendentries node: ci:%d t:%d lc:%d pli:%d plt:%d #%d",
           raft_get_current_idx(me_),
           ae.term,
           ae.leader_commit,
           ae.prev_log_idx,
-          ae.prev_log_term);
+          ae.prev_log_term,
+          ae.n_entries);
 
     me->cb.send_appendentries(me_, me->udata, node, &ae);
 
+    /* Pipeline: assume the batch gets appended, the next one follows on from
+     * it without waiting for the response. A rejection rolls us back. */
+    if (0 < ae.n_entries)
+    {
+        raft_node_set_next_idx(node, next_idx + ae.n_entries);
+        raft_node_set_inflight(node, raft_node_get_inflight(node) + 1);
+    }
+
     return 0;
 }
 
@@ -792,10 +1393,47 @@ int raft_msg_entry_response_committed(raft_server_t* me_,
     return r->idx <= raft_get_commit_idx(me_);
 }
 
-void raft_apply_all(raft_server_t* me_)
+int raft_apply_all(raft_server_t* me_)
 {
-    while (raft_get_last_applied_idx(me_) < raft_get_commit_idx(me_))
-        raft_apply_entry(me_);
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    if (!me->cb.applylog_batch)
+    {
+        while (raft_get_last_applied_idx(me_) < raft_get_commit_idx(me_))
+            if (-1 == raft_apply_entry(me_))
+                return -1;
+        return 0;
+    }
+
+    while (me->last_applied_idx < me->commit_idx)
+    {
+        int n_etys, log_idx = me->last_applied_idx + 1;
+
+        raft_entry_t* e = log_get_from_idx(me->log, log_idx, &n_etys);
+        if (!e)
+            return -1;
+        if (me->commit_idx - me->last_applied_idx < n_etys)
+            n_etys = me->commit_idx - me->last_applied_idx;
+
+        __log(me_, NULL, "applying logs: %d to %d", log_idx,
+              log_idx + n_etys - 1);
+
+        me->last_applied_idx += n_etys;
+        if (0 != me->cb.applylog_batch(me_, me->udata, e, log_idx, n_etys))
+        {
+            /* the whole run is applied again next time round */
+            __log(me_, NULL, "failed to apply logs: %d to %d", log_idx,
+                  log_idx + n_etys - 1);
+            me->last_applied_idx -= n_etys;
+            return -1;
+        }
+
+        /* voting cfg change is now complete */
+        if (log_idx <= me->voting_cfg_change_log_idx &&
+            me->voting_cfg_change_log_idx < log_idx + n_etys)
+            me->voting_cfg_change_log_idx = -1;
+    }
+    return 0;
 }
 
 int raft_entry_is_voting_cfg_change(raft_entry_t* ety)
@@ -32,6 +32,36 @@ void raft_set_request_timeout(raft_server_t* me_, int millisec)
     me->request_timeout = millisec;
 }
 
+void raft_set_appendentries_max_entries(raft_server_t* me_, int n_entries)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    me->ae_max_entries = n_entries;
+}
+
+void raft_set_appendentries_max_bytes(raft_server_t* me_, int bytes)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    me->ae_max_bytes = bytes;
+}
+
+void raft_set_appendentries_max_inflight(raft_server_t* me_, int n_batches)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    me->ae_max_inflight = n_batches < 1 ? 1 : n_batches;
+}
+
+void raft_set_prevote(raft_server_t* me_, int prevote)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    me->prevote = prevote;
+}
+
+void raft_set_read_lease(raft_server_t* me_, int msec)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    me->read_lease = msec;
+}
+
 int raft_get_nodeid(raft_server_t* me_)
 {
     return raft_node_get_id(((raft_server_private_t*)me_)->node);
@@ -69,16 +99,52 @@ int raft_get_voted_for(raft_server_t* me_)
     return me->voted_for;
 }
 
-void raft_set_current_term(raft_server_t* me_, const int term)
+/** @return 0 on success; -1 if a callback couldn't save the change */
+static int __persist_term_vote(raft_server_t* me_, int vote_changed)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+
+    /* the reset vote is saved too, else a restart brings back the vote
+     * of an old term */
+    if (me->cb.persist_term_vote)
+        return 0 == me->cb.persist_term_vote(me_, me->udata, me->current_term,
+                                             me->voted_for) ? 0 : -1;
+    if (me->cb.persist_term &&
+        0 != me->cb.persist_term(me_, me->udata, me->current_term))
+        return -1;
+    if (vote_changed && me->cb.persist_vote &&
+        0 != me->cb.persist_vote(me_, me->udata, me->voted_for))
+        return -1;
+    return 0;
+}
+
+int raft_set_current_term(raft_server_t* me_, const int term)
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
     if (me->current_term < term)
     {
         me->current_term = term;
         me->voted_for = -1;
-        if (me->cb.persist_term)
-            me->cb.persist_term(me_, me->udata, term);
+        return __persist_term_vote(me_, 0);
     }
+    return 0;
+}
+
+int raft_set_current_term_and_vote(raft_server_t* me_, const int term,
+                                   const int nodeid)
+{
+    raft_server_private_t* me = (raft_server_private_t*)me_;
+    int old_term = me->current_term, old_vote = me->voted_for;
+
+    me->current_term = term;
+    me->voted_for = nodeid;
+    if (0 == __persist_term_vote(me_, 1))
+        return 0;
+
+    /* a vote that might not survive a restart mustn't be cast */
+    me->current_term = old_term;
+    me->voted_for = old_vote;
+    return -1;
 }
 
 int raft_get_current_term(raft_server_t* me_)
@@ -116,6 +182,16 @@ int raft_get_commit_idx(raft_server_t* me_)
     return ((raft_server_private_t*)me_)->commit_idx;
 }
 
+int raft_get_snapshot_last_idx(raft_server_t* me_)
+{
+    return ((raft_server_private_t*)me_)->snapshot_last_idx;
+}
+
+int raft_get_snapshot_last_term(raft_server_t* me_)
+{
+    return ((raft_server_private_t*)me_)->snapshot_last_term;
+}
+
 void raft_set_state(raft_server_t* me_, int state)
 {
     raft_server_private_t* me = (raft_server_private_t*)me_;
@@ -162,6 +238,11 @@ raft_node_t* raft_get_current_leader_node(raft_server_t* me_)
     return me->current_leader;
 }
 
+raft_node_t* raft_get_transfer_leader_node(raft_server_t* me_)
+{
+    return ((raft_server_private_t*)me_)->transfer_leader;
+}
+
 void* raft_get_udata(raft_server_t* me_)
 {
     return ((raft_server_private_t*)me_)->udata;
@@ -190,6 +271,9 @@ int raft_get_last_log_term(raft_server_t* me_)
         raft_entry_t* ety = raft_get_entry_from_idx(me_, current_idx);
         if (ety)
             return ety->term;
+        /* everything has been compacted away */
+        if (current_idx == raft_get_snapshot_last_idx(me_))
+            return raft_get_snapshot_last_term(me_);
     }
     return 0;
 }
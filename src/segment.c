@@ -0,0 +1,165 @@
+/*************************************************************************
+  > File Name: segment.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 09:12:44 AM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "segment.h"
+
+inline static uint64_t segment_remaining(segment_t *seg)
+{
+  return seg->hi - seg->next;
+}
+inline static void segment_set(segment_t *seg, uint64_t lo, uint64_t hi)
+{
+  seg->lo = seg->next = lo;
+  seg->hi = hi;
+}
+inline static uint64_t segment_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+void rate_window_add(rate_window_t *rw, uint64_t now, uint64_t n)
+{
+  int i = now % RATE_WINDOW_SLOTS;
+  if (rw->sec[i] != now)
+  {
+    rw->sec[i] = now;
+    rw->count[i] = 0;
+  }
+  if (rw->first == 0)
+  {
+    rw->first = now;
+  }
+  rw->count[i] += n;
+}
+uint64_t rate_window_qps(rate_window_t *rw, uint64_t now)
+{
+  uint64_t total = 0;
+  int i = 0;
+  for (; i < RATE_WINDOW_SLOTS; i++)
+  {
+    if (rw->sec[i] <= now && now - rw->sec[i] < RATE_WINDOW_SLOTS)
+    {
+      total += rw->count[i];
+    }
+  }
+  // don't dilute the rate with seconds from before we started counting
+  uint64_t span = RATE_WINDOW_SLOTS;
+  if (rw->first != 0 && now - rw->first + 1 < span)
+  {
+    span = now - rw->first + 1;
+  }
+  return total / span;
+}
+int segment_alloc_init(segment_alloc_t *sa, int prefetch_threshold)
+{
+  if (sa == NULL || prefetch_threshold < 0 || prefetch_threshold > 100)
+  {
+    return -1;
+  }
+  memset(sa, 0, sizeof(*sa));
+  sa->prefetch_threshold = prefetch_threshold;
+  sa->lease_size = sa->lease_min = sa->lease_max = 1;
+  return pthread_mutex_init(&sa->lock, NULL);
+}
+void segment_alloc_deinit(segment_alloc_t *sa)
+{
+  if (sa != NULL)
+  {
+    pthread_mutex_destroy(&sa->lock);
+  }
+}
+void segment_alloc_set_sizing(segment_alloc_t *sa, uint64_t lease_size, uint64_t lease_min,
+                              uint64_t lease_max, int lease_interval)
+{
+  assert(0 < lease_min && lease_min <= lease_max);
+  pthread_mutex_lock(&sa->lock);
+  sa->lease_size = lease_size;
+  sa->lease_min = lease_min;
+  sa->lease_max = lease_max;
+  sa->lease_interval = lease_interval;
+  pthread_mutex_unlock(&sa->lock);
+}
+uint64_t segment_alloc_lease_size(segment_alloc_t *sa)
+{
+  pthread_mutex_lock(&sa->lock);
+  uint64_t size = sa->lease_size;
+  if (sa->lease_interval > 0)
+  {
+    uint64_t qps = rate_window_qps(&sa->rate, segment_now());
+    if (qps > 0)
+    {
+      size = qps * sa->lease_interval;
+    }
+    if (size < sa->lease_min)
+    {
+      size = sa->lease_min;
+    }
+    else if (size > sa->lease_max)
+    {
+      size = sa->lease_max;
+    }
+  }
+  pthread_mutex_unlock(&sa->lock);
+  return size;
+}
+void segment_alloc_install(segment_alloc_t *sa, uint64_t lo, uint64_t hi)
+{
+  assert(lo <= hi);
+  pthread_mutex_lock(&sa->lock);
+  if (segment_remaining(&sa->cur) == 0)
+  {
+    segment_set(&sa->cur, lo, hi);
+  }
+  else
+  {
+    segment_set(&sa->next, lo, hi);
+  }
+  pthread_mutex_unlock(&sa->lock);
+}
+int segment_alloc_next(segment_alloc_t *sa, uint64_t *id)
+{
+  return segment_alloc_take(sa, 1, id);
+}
+int segment_alloc_take(segment_alloc_t *sa, uint64_t n, uint64_t *lo)
+{
+  int ret = -1;
+  assert(n > 0);
+  pthread_mutex_lock(&sa->lock);
+  if (segment_remaining(&sa->cur) == 0 && segment_remaining(&sa->next) > 0)
+  {
+    sa->cur = sa->next;
+    segment_set(&sa->next, 0, 0);
+  }
+  if (segment_remaining(&sa->cur) >= n)
+  {
+    *lo = sa->cur.next;
+    sa->cur.next += n;
+    ret = 0;
+    rate_window_add(&sa->rate, segment_now(), n);
+    // only the block that crosses the threshold asks for the reserve segment
+    uint64_t size = sa->cur.hi - sa->cur.lo;
+    uint64_t mark = sa->cur.lo + size * sa->prefetch_threshold / 100;
+    if (*lo <= mark && mark < *lo + n && segment_remaining(&sa->next) == 0)
+    {
+      ret = 1;
+    }
+  }
+  pthread_mutex_unlock(&sa->lock);
+  return ret;
+}
+uint64_t segment_alloc_remaining(segment_alloc_t *sa)
+{
+  pthread_mutex_lock(&sa->lock);
+  uint64_t remaining = segment_remaining(&sa->cur) + segment_remaining(&sa->next);
+  pthread_mutex_unlock(&sa->lock);
+  return remaining;
+}
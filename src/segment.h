@@ -0,0 +1,72 @@
+/*************************************************************************
+  > File Name: segment.h
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 09:12:40 AM UTC
+ ************************************************************************/
+
+#ifndef _SEGMENT_H
+#define _SEGMENT_H
+#include <stdint.h>
+#include <pthread.h>
+
+// allocation rate is averaged over the last RATE_WINDOW_SLOTS seconds
+#define RATE_WINDOW_SLOTS 60
+
+// a range of ids [lo, hi) leased to this node through the raft log,
+// ids below next have already been handed out
+typedef struct
+{
+  uint64_t lo;
+  uint64_t next;
+  uint64_t hi;
+} segment_t;
+
+// per-second allocation counts, slot i holds the second sec[i]
+typedef struct
+{
+  uint64_t sec[RATE_WINDOW_SLOTS];
+  uint64_t count[RATE_WINDOW_SLOTS];
+  uint64_t first;
+} rate_window_t;
+
+// ids are served out of memory from the active segment. a second segment
+// is kept in reserve, it is leased in the background once the active one
+// passes prefetch_threshold percent, so running dry never waits on raft
+typedef struct
+{
+  pthread_mutex_t lock;
+  segment_t cur;
+  segment_t next;
+  int prefetch_threshold;
+  // lease sizing, see segment_alloc_lease_size
+  rate_window_t rate;
+  uint64_t lease_size;
+  uint64_t lease_min;
+  uint64_t lease_max;
+  int lease_interval;
+} segment_alloc_t;
+
+void rate_window_add(rate_window_t *rw, uint64_t now, uint64_t n);
+uint64_t rate_window_qps(rate_window_t *rw, uint64_t now);
+
+int segment_alloc_init(segment_alloc_t *sa, int prefetch_threshold);
+void segment_alloc_deinit(segment_alloc_t *sa);
+// size leases so that one is needed every lease_interval seconds at the
+// observed rate, clamped to [lease_min, lease_max]. lease_size is used until
+// there is a rate to go by, or always if lease_interval is 0
+void segment_alloc_set_sizing(segment_alloc_t *sa, uint64_t lease_size, uint64_t lease_min,
+                              uint64_t lease_max, int lease_interval);
+uint64_t segment_alloc_lease_size(segment_alloc_t *sa);
+// install a freshly committed lease [lo,hi), it becomes the active segment
+// if that is exhausted, otherwise the reserve one
+void segment_alloc_install(segment_alloc_t *sa, uint64_t lo, uint64_t hi);
+// take one id, switching to the reserve segment when the active one is
+// exhausted. return -1 when both are empty, 1 when this id crossed the
+// prefetch threshold and the caller should lease the reserve segment
+int segment_alloc_next(segment_alloc_t *sa, uint64_t *id);
+// same as segment_alloc_next but takes n contiguous ids [*lo, *lo+n). a
+// block never spans both segments, -1 means the active one is too short
+int segment_alloc_take(segment_alloc_t *sa, uint64_t n, uint64_t *lo);
+uint64_t segment_alloc_remaining(segment_alloc_t *sa);
+#endif
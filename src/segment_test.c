@@ -0,0 +1,67 @@
+/*************************************************************************
+  > File Name: segment_test.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 09:40:02 AM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <assert.h>
+#include "segment.h"
+
+int main(int argc, char *argv[])
+{
+  segment_alloc_t sa;
+  uint64_t id = 0;
+  assert(segment_alloc_init(&sa, 50) == 0);
+  // nothing leased yet
+  assert(segment_alloc_next(&sa, &id) == -1);
+
+  segment_alloc_install(&sa, 100, 104);
+  assert(segment_alloc_remaining(&sa) == 4);
+  assert(segment_alloc_next(&sa, &id) == 0 && id == 100);
+  assert(segment_alloc_next(&sa, &id) == 0 && id == 101);
+  // half of the segment is gone, time to lease the reserve one
+  assert(segment_alloc_next(&sa, &id) == 1 && id == 102);
+
+  // the reserve lease commits while the active segment is still in use
+  segment_alloc_install(&sa, 200, 202);
+  assert(segment_alloc_remaining(&sa) == 3);
+  assert(segment_alloc_next(&sa, &id) == 0 && id == 103);
+  // switching over doesn't wait for anything
+  assert(segment_alloc_next(&sa, &id) == 0 && id == 200);
+  assert(segment_alloc_next(&sa, &id) == 1 && id == 201);
+  assert(segment_alloc_next(&sa, &id) == -1);
+  assert(segment_alloc_remaining(&sa) == 0);
+
+  // once both are empty a lease becomes the active segment again
+  segment_alloc_install(&sa, 300, 301);
+  assert(segment_alloc_next(&sa, &id) == 1 && id == 300);
+
+  // blocks come out of the active segment only
+  segment_alloc_install(&sa, 400, 410);
+  assert(segment_alloc_take(&sa, 3, &id) == 0 && id == 400);
+  assert(segment_alloc_take(&sa, 3, &id) == 1 && id == 403);
+  segment_alloc_install(&sa, 500, 510);
+  assert(segment_alloc_take(&sa, 5, &id) == -1);
+  assert(segment_alloc_take(&sa, 4, &id) == 0 && id == 406);
+  assert(segment_alloc_take(&sa, 5, &id) == 0 && id == 500);
+
+  // rate is averaged over the seconds we have seen so far
+  rate_window_t rw = {0};
+  rate_window_add(&rw, 1000, 50);
+  rate_window_add(&rw, 1001, 150);
+  assert(rate_window_qps(&rw, 1001) == 100);
+  // and forgets what fell out of the window
+  rate_window_add(&rw, 1000 + RATE_WINDOW_SLOTS, 60);
+  assert(rate_window_qps(&rw, 1000 + RATE_WINDOW_SLOTS) == (150 + 60) / RATE_WINDOW_SLOTS);
+
+  // a handful of ids handed out so far, lease size is clamped to the minimum
+  segment_alloc_set_sizing(&sa, 5000, 100, 1000, 1);
+  assert(segment_alloc_lease_size(&sa) == 100);
+  segment_alloc_set_sizing(&sa, 5000, 100, 1000, 0);
+  assert(segment_alloc_lease_size(&sa) == 5000);
+  segment_alloc_deinit(&sa);
+  fprintf(stdout, "segment test succ\n");
+  return 0;
+}
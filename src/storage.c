@@ -0,0 +1,58 @@
+/*************************************************************************
+  > File Name: storage.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 08:02:44 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "storage.h"
+
+static const storage_ops_t *storage_backends[] = {
+    &storage_lmdb_ops,
+    &storage_kv_ops,
+};
+
+int storage_init(storage_t *st, const char *backend)
+{
+  size_t i = 0;
+  memset(st, 0, sizeof(*st));
+  for (; i < sizeof(storage_backends) / sizeof(storage_backends[0]); i++)
+  {
+    if (strcmp(storage_backends[i]->name, backend) == 0)
+    {
+      st->ops = storage_backends[i];
+      return 0;
+    }
+  }
+  return -1;
+}
+int storage_put_int(storage_t *st, void *txn, const char *key, int val)
+{
+  return st->ops->put_meta(st, txn, key, &val, sizeof(val));
+}
+int storage_get_int(storage_t *st, const char *key, int *val)
+{
+  int tmp = 0;
+  if (st->ops->get_meta(st, key, &tmp, sizeof(tmp)) != sizeof(tmp))
+  {
+    return -1;
+  }
+  *val = tmp;
+  return 0;
+}
+int storage_set_meta(storage_t *st, const char *key, const void *val, size_t len)
+{
+  void *txn = NULL;
+  if (st->ops->begin(st, &txn) != 0)
+  {
+    return -1;
+  }
+  if (st->ops->put_meta(st, txn, key, val, len) != 0)
+  {
+    st->ops->abort(st, txn);
+    return -1;
+  }
+  return st->ops->commit(st, txn);
+}
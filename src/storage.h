@@ -0,0 +1,63 @@
+/*************************************************************************
+  > File Name: storage.h
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 08:02:37 PM UTC
+ ************************************************************************/
+
+#ifndef _STORAGE_H
+#define _STORAGE_H
+#include <stdint.h>
+#include <stddef.h>
+
+// where the state machine (the issued tickets) and raft's durable metadata
+// (term, vote, commit and snapshot indexes, the lease high-water mark) live.
+// the raft log itself is kept in the wal whichever backend is picked
+typedef struct storage_s storage_t;
+
+typedef int (*storage_ticket_cb)(void *arg, uint32_t ticket);
+
+typedef struct
+{
+  const char *name;
+  // the backend keeps its files under dir
+  int (*open)(storage_t *st, const char *dir);
+  void (*close)(storage_t *st);
+  // forget everything that was stored, and close
+  int (*drop)(storage_t *st);
+  // writes go through a transaction, they are durable once commit returns
+  int (*begin)(storage_t *st, void **txn);
+  int (*commit)(storage_t *st, void *txn);
+  void (*abort)(storage_t *st, void *txn);
+  // record an issued ticket, -1 if the store is full
+  int (*put_ticket)(storage_t *st, void *txn, uint32_t ticket);
+  int (*drop_tickets)(storage_t *st, void *txn);
+  // 1 if the ticket has been issued, 0 if not
+  int (*has_ticket)(storage_t *st, uint32_t ticket);
+  // call cb for every issued ticket until it returns non zero
+  int (*each_ticket)(storage_t *st, storage_ticket_cb cb, void *arg);
+  // metadata is keyed by name, put_meta returns -1 if the store is full
+  int (*put_meta)(storage_t *st, void *txn, const char *key, const void *val, size_t len);
+  // copy up to len bytes of the value to val, return its length or -1 if
+  // there is none
+  int (*get_meta)(storage_t *st, const char *key, void *val, size_t len);
+} storage_ops_t;
+
+struct storage_s
+{
+  const storage_ops_t *ops;
+  // the backend's own state
+  void *ctx;
+};
+
+extern const storage_ops_t storage_lmdb_ops;
+extern const storage_ops_t storage_kv_ops;
+
+// pick the backend by name, "lmdb" or "kv_db"
+int storage_init(storage_t *st, const char *backend);
+int storage_put_int(storage_t *st, void *txn, const char *key, int val);
+// 0 if there is such an int, -1 leaves *val alone
+int storage_get_int(storage_t *st, const char *key, int *val);
+// write one value in a transaction of its own
+int storage_set_meta(storage_t *st, const char *key, const void *val, size_t len);
+#endif
@@ -0,0 +1,220 @@
+/*************************************************************************
+  > File Name: storage_kv.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 08:21:50 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "kv_db.h"
+#include "storage.h"
+
+#define wt_fatal(e) { \
+  fprintf(stderr, "%s:%d - err:%d: %s\n", __FILE__, __LINE__, e, wiredtiger_strerror(e)); \
+  exit(1); }
+
+typedef struct
+{
+  kv_db_t *db;
+  kv_schema_t *tickets;
+  kv_schema_t *state;
+  // writes to both schemas go through this session so that a transaction
+  // spans them. reads go through the calling thread's own session, so http
+  // workers can look tickets up while raft is writing
+  kv_session_t *session;
+} storage_kv_t;
+
+inline static void kv_item_init(WT_ITEM *item, const void *data, size_t size)
+{
+  item->data = data;
+  item->size = size;
+}
+// the cache filling up is the only error a caller can do something about
+inline static int kv_check_put(int e)
+{
+  if (e == 0)
+  {
+    return 0;
+  }
+  if (e == WT_CACHE_FULL || e == WT_ROLLBACK)
+  {
+    return -1;
+  }
+  wt_fatal(e);
+}
+static int kv_open(storage_t *st, const char *dir)
+{
+  storage_kv_t *k = calloc(1, sizeof(*k));
+  if (k == NULL)
+  {
+    return -1;
+  }
+  k->db = kv_db_alloc("kv_db", dir);
+  if (k->db == NULL)
+  {
+    free(k);
+    return -1;
+  }
+  k->tickets = kv_schema_alloc("docs", k->db, false);
+  k->state = kv_schema_alloc("state", k->db, false);
+  kv_db_register_schema(k->db, k->tickets);
+  kv_db_register_schema(k->db, k->state);
+
+  k->session = kv_session_alloc(k->db);
+  assert(k->session != NULL);
+  st->ctx = k;
+  return 0;
+}
+static void kv_close(storage_t *st)
+{
+  storage_kv_t *k = st->ctx;
+  kv_session_destroy(k->session);
+  kv_db_destroy(k->db);
+  free(k);
+  st->ctx = NULL;
+}
+// remove every record the cursor's table holds
+static int kv_truncate(WT_CURSOR *cursor)
+{
+  int e;
+  cursor->reset(cursor);
+  while ((e = cursor->next(cursor)) == 0)
+  {
+    if ((e = cursor->remove(cursor)) != 0)
+    {
+      return e;
+    }
+  }
+  cursor->reset(cursor);
+  return e == WT_NOTFOUND ? 0 : e;
+}
+static int kv_drop(storage_t *st)
+{
+  storage_kv_t *k = st->ctx;
+  int e = kv_db_begin(k->session);
+  if (e == 0 && (e = kv_truncate(kv_session_cursor(k->session, k->tickets))) == 0 &&
+      (e = kv_truncate(kv_session_cursor(k->session, k->state))) == 0)
+  {
+    e = kv_db_commit(k->session, KV_DB_SYNC);
+  }
+  else
+  {
+    kv_db_rollback(k->session);
+  }
+  if (e != 0)
+    wt_fatal(e);
+  kv_close(st);
+  return 0;
+}
+static int kv_begin(storage_t *st, void **txn)
+{
+  storage_kv_t *k = st->ctx;
+  int e = kv_db_begin(k->session);
+  if (e != 0)
+    wt_fatal(e);
+  *txn = k->session;
+  return 0;
+}
+static int kv_commit(storage_t *st, void *txn)
+{
+  // synced to the log before we return, like an lmdb commit
+  int e = kv_db_commit(txn, KV_DB_SYNC);
+  if (e != 0)
+    wt_fatal(e);
+  return 0;
+}
+static void kv_abort(storage_t *st, void *txn)
+{
+  kv_db_rollback(txn);
+}
+static int kv_put_ticket(storage_t *st, void *txn, uint32_t ticket)
+{
+  storage_kv_t *k = st->ctx;
+  return kv_check_put(kv_db_txn_set(txn, k->tickets, &ticket, sizeof(ticket), "", 0));
+}
+static int kv_drop_tickets(storage_t *st, void *txn)
+{
+  storage_kv_t *k = st->ctx;
+  int e = kv_truncate(kv_session_cursor(txn, k->tickets));
+  if (e != 0)
+    wt_fatal(e);
+  return 0;
+}
+static int kv_has_ticket(storage_t *st, uint32_t ticket)
+{
+  storage_kv_t *k = st->ctx;
+  WT_CURSOR *c = kv_session_cursor(kv_db_session(k->db), k->tickets);
+  WT_ITEM key;
+  kv_item_init(&key, &ticket, sizeof(ticket));
+  c->set_key(c, &key);
+  int e = c->search(c);
+  c->reset(c);
+  if (e != 0 && e != WT_NOTFOUND)
+    wt_fatal(e);
+  return e == 0;
+}
+static int kv_each_ticket(storage_t *st, storage_ticket_cb cb, void *arg)
+{
+  storage_kv_t *k = st->ctx;
+  kv_iter_t it;
+  uint32_t ticket;
+  int ret = 0;
+  // sending a snapshot walks every ticket, the scan lets go of its
+  // wiredtiger snapshot between batches instead of pinning it all along
+  int e = kv_iter_open(&it, kv_db_session(k->db), k->tickets, NULL);
+  if (e != 0)
+    wt_fatal(e);
+  while (ret == 0 && (e = kv_iter_next(&it)) == 1)
+  {
+    memcpy(&ticket, it.key.data, sizeof(ticket));
+    ret = cb(arg, ticket);
+  }
+  kv_iter_close(&it);
+  if (ret == 0 && e != 0)
+    wt_fatal(e);
+  return ret;
+}
+static int kv_put_meta(storage_t *st, void *txn, const char *key, const void *val, size_t len)
+{
+  storage_kv_t *k = st->ctx;
+  return kv_check_put(kv_db_txn_set(txn, k->state, (void *)key, strlen(key), (void *)val, len));
+}
+static int kv_get_meta(storage_t *st, const char *key, void *val, size_t len)
+{
+  storage_kv_t *k = st->ctx;
+  WT_CURSOR *c = kv_session_cursor(kv_db_session(k->db), k->state);
+  WT_ITEM key_item, val_item;
+  kv_item_init(&key_item, key, strlen(key));
+  c->set_key(c, &key_item);
+  int e = c->search(c);
+  if (e == WT_NOTFOUND)
+  {
+    return -1;
+  }
+  if (e != 0)
+    wt_fatal(e);
+  c->get_value(c, &val_item);
+  // the value is only valid while the cursor stays put
+  memcpy(val, val_item.data, val_item.size < len ? val_item.size : len);
+  c->reset(c);
+  return val_item.size;
+}
+
+const storage_ops_t storage_kv_ops = {
+    .name = "kv_db",
+    .open = kv_open,
+    .close = kv_close,
+    .drop = kv_drop,
+    .begin = kv_begin,
+    .commit = kv_commit,
+    .abort = kv_abort,
+    .put_ticket = kv_put_ticket,
+    .drop_tickets = kv_drop_tickets,
+    .has_ticket = kv_has_ticket,
+    .each_ticket = kv_each_ticket,
+    .put_meta = kv_put_meta,
+    .get_meta = kv_get_meta,
+};
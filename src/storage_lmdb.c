@@ -0,0 +1,186 @@
+/*************************************************************************
+  > File Name: storage_lmdb.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 08:10:05 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "lmdb.h"
+#include "lmdb_helpers.h"
+#include "storage.h"
+
+// lmdb maps the whole database, it can't grow past this
+#define LMDB_MAP_SIZE_MB 1000
+
+typedef struct
+{
+  MDB_env *env;
+  // issued tickets are keys with an empty value
+  MDB_dbi tickets;
+  MDB_dbi state;
+} storage_lmdb_t;
+
+// map full is the only error a caller can do something about
+inline static int lmdb_check_put(int e)
+{
+  switch (e)
+  {
+  case 0:
+    return 0;
+  case MDB_MAP_FULL:
+    return -1;
+  default:
+    mdb_fatal(e);
+  }
+}
+static int lmdb_open(storage_t *st, const char *dir)
+{
+  char path[PATH_MAX];
+  storage_lmdb_t *l = calloc(1, sizeof(*l));
+  if (l == NULL)
+  {
+    return -1;
+  }
+  snprintf(path, PATH_MAX, "%s/lmdb", dir);
+  mdb_db_env_create(&l->env, 0, path, LMDB_MAP_SIZE_MB);
+  mdb_db_create(&l->tickets, l->env, "docs");
+  mdb_db_create(&l->state, l->env, "state");
+  st->ctx = l;
+  return 0;
+}
+static void lmdb_close(storage_t *st)
+{
+  storage_lmdb_t *l = st->ctx;
+  mdb_env_close(l->env);
+  free(l);
+  st->ctx = NULL;
+}
+static int lmdb_drop(storage_t *st)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_dbi dbs[] = {l->tickets, l->state};
+  // closes the env as well
+  mdb_drop_dbs(l->env, dbs, sizeof(dbs) / sizeof(dbs[0]));
+  free(l);
+  st->ctx = NULL;
+  return 0;
+}
+static int lmdb_begin(storage_t *st, void **txn)
+{
+  storage_lmdb_t *l = st->ctx;
+  int e = mdb_txn_begin(l->env, NULL, 0, (MDB_txn **)txn);
+  if (0 != e)
+    mdb_fatal(e);
+  return 0;
+}
+static int lmdb_commit(storage_t *st, void *txn)
+{
+  int e = mdb_txn_commit(txn);
+  if (0 != e)
+    mdb_fatal(e);
+  return 0;
+}
+static void lmdb_abort(storage_t *st, void *txn)
+{
+  mdb_txn_abort(txn);
+}
+static int lmdb_put_ticket(storage_t *st, void *txn, uint32_t ticket)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_val key = {.mv_size = sizeof(ticket), .mv_data = &ticket};
+  MDB_val val = {.mv_size = 0, .mv_data = "\0"};
+  return lmdb_check_put(mdb_put(txn, l->tickets, &key, &val, 0));
+}
+static int lmdb_drop_tickets(storage_t *st, void *txn)
+{
+  storage_lmdb_t *l = st->ctx;
+  int e = mdb_drop(txn, l->tickets, 0);
+  if (0 != e)
+    mdb_fatal(e);
+  return 0;
+}
+static int lmdb_has_ticket(storage_t *st, uint32_t ticket)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_txn *txn;
+  MDB_val v, k = {.mv_size = sizeof(ticket), .mv_data = &ticket};
+
+  int e = mdb_txn_begin(l->env, NULL, MDB_RDONLY, &txn);
+  if (0 != e)
+    mdb_fatal(e);
+  e = mdb_get(txn, l->tickets, &k, &v);
+  mdb_txn_abort(txn);
+  if (0 != e && MDB_NOTFOUND != e)
+    mdb_fatal(e);
+  return 0 == e;
+}
+static int lmdb_each_ticket(storage_t *st, storage_ticket_cb cb, void *arg)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_txn *txn;
+  MDB_cursor *curs;
+  MDB_val k, v;
+  uint32_t ticket;
+  int ret = 0;
+
+  int e = mdb_txn_begin(l->env, NULL, MDB_RDONLY, &txn);
+  if (0 != e)
+    mdb_fatal(e);
+  e = mdb_cursor_open(txn, l->tickets, &curs);
+  if (0 != e)
+    mdb_fatal(e);
+
+  e = mdb_cursor_get(curs, &k, &v, MDB_FIRST);
+  while (0 == e && 0 == ret)
+  {
+    memcpy(&ticket, k.mv_data, sizeof(ticket));
+    ret = cb(arg, ticket);
+    e = mdb_cursor_get(curs, &k, &v, MDB_NEXT);
+  }
+  if (0 != e && MDB_NOTFOUND != e)
+    mdb_fatal(e);
+
+  mdb_cursor_close(curs);
+  mdb_txn_abort(txn);
+  return ret;
+}
+static int lmdb_put_meta(storage_t *st, void *txn, const char *key, const void *val, size_t len)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_val k = {.mv_size = strlen(key), .mv_data = (void *)key};
+  MDB_val v = {.mv_size = len, .mv_data = (void *)val};
+  return lmdb_check_put(mdb_put(txn, l->state, &k, &v, 0));
+}
+static int lmdb_get_meta(storage_t *st, const char *key, void *val, size_t len)
+{
+  storage_lmdb_t *l = st->ctx;
+  MDB_val v;
+  mdb_gets(l->env, l->state, (char *)key, &v);
+  if (v.mv_data == NULL)
+  {
+    return -1;
+  }
+  memcpy(val, v.mv_data, v.mv_size < len ? v.mv_size : len);
+  return v.mv_size;
+}
+
+const storage_ops_t storage_lmdb_ops = {
+    .name = "lmdb",
+    .open = lmdb_open,
+    .close = lmdb_close,
+    .drop = lmdb_drop,
+    .begin = lmdb_begin,
+    .commit = lmdb_commit,
+    .abort = lmdb_abort,
+    .put_ticket = lmdb_put_ticket,
+    .drop_tickets = lmdb_drop_tickets,
+    .has_ticket = lmdb_has_ticket,
+    .each_ticket = lmdb_each_ticket,
+    .put_meta = lmdb_put_meta,
+    .get_meta = lmdb_get_meta,
+};
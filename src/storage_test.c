@@ -0,0 +1,98 @@
+/*************************************************************************
+  > File Name: storage_test.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 09:12:08 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "storage.h"
+
+#define STORAGE_TEST_DIR "/tmp/storage_test"
+
+static int sum_cb(void *arg, uint32_t ticket)
+{
+  *(uint64_t *)arg += ticket;
+  return 0;
+}
+static int stop_cb(void *arg, uint32_t ticket)
+{
+  (*(int *)arg)++;
+  return 1;
+}
+static void test_backend(const char *backend)
+{
+  storage_t st;
+  void *txn;
+  uint32_t i;
+  uint64_t sum = 0;
+  int val = 0, calls = 0;
+  char buf[16] = {0};
+
+  system("rm -rf " STORAGE_TEST_DIR);
+  mkdir(STORAGE_TEST_DIR, 0755);
+  assert(storage_init(&st, backend) == 0);
+  assert(st.ops->open(&st, STORAGE_TEST_DIR) == 0);
+
+  assert(st.ops->begin(&st, &txn) == 0);
+  for (i = 1; i <= 100; i++)
+  {
+    assert(st.ops->put_ticket(&st, txn, i) == 0);
+  }
+  assert(storage_put_int(&st, txn, "commit_idx", 42) == 0);
+  assert(st.ops->put_meta(&st, txn, "raft_port", "9001", 4) == 0);
+  assert(st.ops->commit(&st, txn) == 0);
+
+  assert(st.ops->has_ticket(&st, 50) == 1);
+  assert(st.ops->has_ticket(&st, 101) == 0);
+  assert(st.ops->each_ticket(&st, sum_cb, &sum) == 0 && sum == 5050);
+  // a callback can stop the walk
+  assert(st.ops->each_ticket(&st, stop_cb, &calls) == 1 && calls == 1);
+  assert(storage_get_int(&st, "commit_idx", &val) == 0 && val == 42);
+  assert(st.ops->get_meta(&st, "raft_port", buf, sizeof(buf)) == 4 && strcmp(buf, "9001") == 0);
+  assert(storage_get_int(&st, "term", &val) == -1 && val == 42);
+
+  // nothing of an aborted transaction is left behind
+  assert(st.ops->begin(&st, &txn) == 0);
+  assert(st.ops->put_ticket(&st, txn, 1000) == 0);
+  assert(st.ops->drop_tickets(&st, txn) == 0);
+  st.ops->abort(&st, txn);
+  assert(st.ops->has_ticket(&st, 1000) == 0 && st.ops->has_ticket(&st, 1) == 1);
+
+  assert(storage_set_meta(&st, "term", &i, sizeof(i)) == 0);
+  st.ops->close(&st);
+
+  // everything is there after a restart
+  assert(storage_init(&st, backend) == 0);
+  assert(st.ops->open(&st, STORAGE_TEST_DIR) == 0);
+  assert(storage_get_int(&st, "term", &val) == 0 && val == 101);
+  assert(st.ops->has_ticket(&st, 100) == 1);
+
+  // a snapshot replaces the tickets
+  assert(st.ops->begin(&st, &txn) == 0);
+  assert(st.ops->drop_tickets(&st, txn) == 0);
+  assert(st.ops->put_ticket(&st, txn, 7) == 0);
+  assert(st.ops->commit(&st, txn) == 0);
+  sum = 0;
+  assert(st.ops->each_ticket(&st, sum_cb, &sum) == 0 && sum == 7);
+
+  assert(st.ops->drop(&st) == 0);
+  assert(st.ops->open(&st, STORAGE_TEST_DIR) == 0);
+  assert(st.ops->has_ticket(&st, 7) == 0);
+  assert(storage_get_int(&st, "term", &val) == -1);
+  st.ops->close(&st);
+  fprintf(stdout, "%s ok\n", backend);
+}
+int main(int argc, char *argv[])
+{
+  storage_t st;
+  assert(storage_init(&st, "rocksdb") == -1);
+  test_backend("lmdb");
+  test_backend("kv_db");
+  system("rm -rf " STORAGE_TEST_DIR);
+  return 0;
+}
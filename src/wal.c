@@ -0,0 +1,445 @@
+/*************************************************************************
+  > File Name: wal.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 06:05:18 PM UTC
+ ************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wal.h"
+
+// buffers a record can be made of, besides its frame
+#define WAL_MAX_IOV 8
+
+// every record follows a frame, frames are 8 byte aligned
+typedef struct
+{
+  // length of the record, 0 marks the end of the records in a segment
+  uint32_t len;
+  // crc32c of the rest of the frame and of the record
+  uint32_t crc;
+  uint64_t idx;
+  uint32_t epoch;
+  // size of the previous frame and record in the segment, 0 for the first
+  uint32_t prev;
+} wal_frame_t;
+
+static uint32_t crc32c_table[256];
+
+inline static void crc32c_init()
+{
+  uint32_t i, j, c;
+  for (i = 0; i < 256; i++)
+  {
+    for (c = i, j = 0; j < 8; j++)
+    {
+      c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+    crc32c_table[i] = c;
+  }
+}
+uint32_t wal_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  if (crc32c_table[1] == 0)
+  {
+    crc32c_init();
+  }
+  crc = ~crc;
+  while (len--)
+  {
+    crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+inline static uint64_t wal_frame_size(uint32_t len)
+{
+  return (sizeof(wal_frame_t) + (uint64_t)len + 7) & ~7ull;
+}
+inline static uint32_t wal_frame_crc(wal_frame_t *f, const char *rec)
+{
+  uint32_t crc = wal_crc32c(0, &f->idx, sizeof(*f) - offsetof(wal_frame_t, idx));
+  return wal_crc32c(crc, rec, f->len);
+}
+inline static void wal_segment_path(wal_t *w, uint64_t first_idx, char *path)
+{
+  snprintf(path, PATH_MAX, "%s/%016" PRIx64 ".wal", w->dir, first_idx);
+}
+// creating and deleting segments only survives a crash once the directory
+// has been synced
+static int wal_sync_dir(wal_t *w)
+{
+  int fd = open(w->dir, O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  int ret = fsync(fd);
+  close(fd);
+  return ret;
+}
+static int wal_segment_map(wal_segment_t *seg)
+{
+  seg->map = mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+  if (seg->map == MAP_FAILED)
+  {
+    seg->map = NULL;
+    return -1;
+  }
+  return 0;
+}
+static void wal_segment_push(wal_t *w, wal_segment_t *seg)
+{
+  if (w->n_segs == w->cap_segs)
+  {
+    w->cap_segs = w->cap_segs ? w->cap_segs * 2 : 8;
+    w->segs = realloc(w->segs, sizeof(*w->segs) * w->cap_segs);
+  }
+  w->segs[w->n_segs++] = *seg;
+}
+inline static void wal_segment_release(wal_segment_t *seg)
+{
+  if (seg->map != NULL)
+  {
+    munmap(seg->map, seg->size);
+  }
+  if (seg->fd >= 0)
+  {
+    close(seg->fd);
+  }
+}
+static void wal_segment_remove(wal_t *w, int i)
+{
+  char path[PATH_MAX];
+  wal_segment_release(&w->segs[i]);
+  wal_segment_path(w, w->segs[i].first_idx, path);
+  unlink(path);
+  memmove(&w->segs[i], &w->segs[i + 1], sizeof(*w->segs) * (w->n_segs - i - 1));
+  w->n_segs--;
+  if (w->dirty > i)
+  {
+    w->dirty--;
+  }
+  if (w->dirty >= w->n_segs)
+  {
+    w->dirty = -1;
+  }
+}
+static int wal_segment_create(wal_t *w, uint64_t first_idx, uint64_t min_size)
+{
+  char path[PATH_MAX];
+  wal_segment_t seg = {.first_idx = first_idx};
+  seg.size = w->segment_size < min_size ? min_size : w->segment_size;
+  wal_segment_path(w, first_idx, path);
+  seg.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (seg.fd < 0)
+  {
+    return -1;
+  }
+  // the blocks are allocated up front, so appending never changes the size
+  // of the file and fdatasync has no metadata to flush
+  if (posix_fallocate(seg.fd, 0, seg.size) != 0 || fsync(seg.fd) != 0 ||
+      wal_segment_map(&seg) != 0 || wal_sync_dir(w) != 0)
+  {
+    wal_segment_release(&seg);
+    unlink(path);
+    return -1;
+  }
+  wal_segment_push(w, &seg);
+  return 0;
+}
+static int wal_segment_open(wal_t *w, wal_segment_t *seg)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  wal_segment_path(w, seg->first_idx, path);
+  seg->fd = open(path, O_RDWR);
+  if (seg->fd < 0 || fstat(seg->fd, &st) != 0)
+  {
+    return -1;
+  }
+  seg->size = st.st_size;
+  // too short to hold a record, it was cut short while being created
+  if (seg->size < sizeof(wal_frame_t))
+  {
+    return 0;
+  }
+  return wal_segment_map(seg);
+}
+// follow the records of the segment on from the last one we have seen
+static void wal_segment_scan(wal_t *w, wal_segment_t *seg)
+{
+  uint64_t off = 0, idx = seg->first_idx;
+  uint32_t epoch = w->epoch;
+  seg->end = seg->last = 0;
+  while (off + sizeof(wal_frame_t) <= seg->size)
+  {
+    wal_frame_t *f = (wal_frame_t *)(seg->map + off);
+    uint64_t sz = wal_frame_size(f->len);
+    if (f->len == 0 || sz > seg->size - off || f->idx != idx || f->epoch < epoch ||
+        f->crc != wal_frame_crc(f, seg->map + off + sizeof(*f)))
+    {
+      break;
+    }
+    epoch = f->epoch;
+    seg->last = off;
+    off += sz;
+    seg->end = off;
+    idx++;
+  }
+  if (seg->end != 0)
+  {
+    w->epoch = epoch;
+    w->next_idx = idx;
+  }
+}
+// whatever lies past the last record was written by appends that didn't make
+// it to disk, some of it might look like records. hand it back to the file
+// system and preallocate it afresh as zeroes
+static int wal_segment_clean(wal_segment_t *seg)
+{
+  if (ftruncate(seg->fd, seg->end) != 0 || posix_fallocate(seg->fd, 0, seg->size) != 0)
+  {
+    return -1;
+  }
+  return fsync(seg->fd);
+}
+static int wal_segment_cmp(const void *a, const void *b)
+{
+  const wal_segment_t *x = a, *y = b;
+  return x->first_idx < y->first_idx ? -1 : x->first_idx > y->first_idx;
+}
+int wal_open(wal_t *w, const char *dir, uint64_t segment_size)
+{
+  memset(w, 0, sizeof(*w));
+  w->dirty = -1;
+  w->segment_size = segment_size;
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+  {
+    return -1;
+  }
+  w->dir = strdup(dir);
+
+  DIR *d = opendir(dir);
+  if (d == NULL)
+  {
+    return -1;
+  }
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL)
+  {
+    wal_segment_t seg = {.fd = -1};
+    int n = 0;
+    if (sscanf(de->d_name, "%16" SCNx64 ".wal%n", &seg.first_idx, &n) == 1 &&
+        n == (int)strlen(de->d_name) && n == 20)
+    {
+      wal_segment_push(w, &seg);
+    }
+  }
+  closedir(d);
+  if (w->n_segs > 0)
+  {
+    qsort(w->segs, w->n_segs, sizeof(*w->segs), wal_segment_cmp);
+  }
+
+  // the records carry on from segment to segment, the first one that
+  // doesn't check out is where a crash tore the tail off
+  int i = 0;
+  for (; i < w->n_segs; i++)
+  {
+    wal_segment_t *seg = &w->segs[i];
+    if (w->next_idx != 0 && seg->first_idx != w->next_idx)
+    {
+      break;
+    }
+    if (wal_segment_open(w, seg) != 0)
+    {
+      wal_close(w);
+      return -1;
+    }
+    wal_segment_scan(w, seg);
+    if (seg->end == 0)
+    {
+      break;
+    }
+  }
+  int torn = i < w->n_segs;
+  while (i < w->n_segs)
+  {
+    wal_segment_remove(w, w->n_segs - 1);
+  }
+  if ((w->n_segs > 0 && wal_segment_clean(&w->segs[w->n_segs - 1]) != 0) ||
+      (torn && wal_sync_dir(w) != 0))
+  {
+    wal_close(w);
+    return -1;
+  }
+  return 0;
+}
+void wal_close(wal_t *w)
+{
+  int i;
+  for (i = 0; i < w->n_segs; i++)
+  {
+    wal_segment_release(&w->segs[i]);
+  }
+  free(w->segs);
+  free(w->dir);
+  memset(w, 0, sizeof(*w));
+  w->dirty = -1;
+}
+int wal_append(wal_t *w, uint64_t idx, const struct iovec *iov, int iovcnt, const char **rec)
+{
+  struct iovec v[WAL_MAX_IOV + 1];
+  wal_frame_t f = {.idx = idx, .epoch = w->epoch};
+  int i;
+  if (iovcnt > WAL_MAX_IOV || (w->next_idx != 0 && idx != w->next_idx))
+  {
+    return -1;
+  }
+  for (i = 0; i < iovcnt; i++)
+  {
+    f.len += iov[i].iov_len;
+    v[i + 1] = iov[i];
+  }
+  if (f.len == 0)
+  {
+    return -1;
+  }
+
+  uint64_t sz = wal_frame_size(f.len);
+  wal_segment_t *seg = w->n_segs > 0 ? &w->segs[w->n_segs - 1] : NULL;
+  if (seg == NULL || sz > seg->size - seg->end)
+  {
+    if (wal_segment_create(w, idx, sz) != 0)
+    {
+      return -1;
+    }
+    seg = &w->segs[w->n_segs - 1];
+  }
+  f.prev = seg->end - seg->last;
+
+  f.crc = wal_crc32c(0, &f.idx, sizeof(f) - offsetof(wal_frame_t, idx));
+  for (i = 0; i < iovcnt; i++)
+  {
+    f.crc = wal_crc32c(f.crc, iov[i].iov_base, iov[i].iov_len);
+  }
+  v[0].iov_base = &f;
+  v[0].iov_len = sizeof(f);
+  if (pwritev(seg->fd, v, iovcnt + 1, seg->end) != (ssize_t)(sizeof(f) + f.len))
+  {
+    return -1;
+  }
+
+  if (rec != NULL)
+  {
+    *rec = seg->map + seg->end + sizeof(f);
+  }
+  seg->last = seg->end;
+  seg->end += sz;
+  w->next_idx = idx + 1;
+  if (w->dirty < 0)
+  {
+    w->dirty = w->n_segs - 1;
+  }
+  return 0;
+}
+int wal_sync(wal_t *w)
+{
+  int i;
+  if (w->dirty < 0)
+  {
+    return 0;
+  }
+  for (i = w->dirty; i < w->n_segs; i++)
+  {
+    if (fdatasync(w->segs[i].fd) != 0)
+    {
+      return -1;
+    }
+  }
+  w->dirty = -1;
+  return 0;
+}
+int wal_truncate_tail(wal_t *w, uint64_t idx)
+{
+  if (w->next_idx == 0 || idx >= w->next_idx)
+  {
+    return 0;
+  }
+  while (w->n_segs > 0 && w->segs[w->n_segs - 1].first_idx >= idx)
+  {
+    w->next_idx = w->segs[w->n_segs - 1].first_idx;
+    wal_segment_remove(w, w->n_segs - 1);
+  }
+  if (w->n_segs == 0)
+  {
+    w->next_idx = 0;
+  }
+  else
+  {
+    // walk back from the last record, the segment keeps at least one
+    wal_segment_t *seg = &w->segs[w->n_segs - 1];
+    for (; w->next_idx > idx; w->next_idx--)
+    {
+      wal_frame_t *f = (wal_frame_t *)(seg->map + seg->last);
+      seg->end = seg->last;
+      seg->last -= f->prev;
+    }
+  }
+  // the records we just dropped are still on disk past the new tail
+  w->epoch++;
+  return 0;
+}
+int wal_truncate_head(wal_t *w, uint64_t idx)
+{
+  int removed = 0;
+  while (w->n_segs > 1 && w->segs[1].first_idx <= idx)
+  {
+    wal_segment_remove(w, 0);
+    removed = 1;
+  }
+  // a segment coming back after a crash would break the chain of records
+  return removed ? wal_sync_dir(w) : 0;
+}
+int wal_reset(wal_t *w)
+{
+  while (w->n_segs > 0)
+  {
+    wal_segment_remove(w, w->n_segs - 1);
+  }
+  w->next_idx = 0;
+  w->epoch++;
+  return wal_sync_dir(w);
+}
+int wal_replay(wal_t *w, wal_replay_cb cb, void *arg)
+{
+  int i;
+  for (i = 0; i < w->n_segs; i++)
+  {
+    wal_segment_t *seg = &w->segs[i];
+    uint64_t off = 0;
+    while (off < seg->end)
+    {
+      wal_frame_t *f = (wal_frame_t *)(seg->map + off);
+      if (cb(arg, f->idx, seg->map + off + sizeof(*f), f->len) != 0)
+      {
+        return -1;
+      }
+      off += wal_frame_size(f->len);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+/*************************************************************************
+  > File Name: wal.h
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 06:05:12 PM UTC
+ ************************************************************************/
+
+#ifndef _WAL_H
+#define _WAL_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// after a failed sync there is no telling what made it to disk, give up
+#define wal_fatal() { \
+  fprintf(stderr, "%s:%d - wal: %s\n", __FILE__, __LINE__, strerror(errno)); \
+  exit(1); }
+
+// an append only log of records numbered by consecutive indexes, kept in
+// preallocated segment files named after the index of their first record.
+// records are framed with their index and a crc32c, so a torn write at the
+// tail is found and dropped on open. dropping old records deletes whole
+// segments, nothing is ever rewritten
+typedef struct
+{
+  uint64_t first_idx;
+  int fd;
+  // the segment is mapped read only, records are handed out as pointers
+  // into it and stay valid until they are truncated away
+  char *map;
+  uint64_t size;
+  // bytes taken by records, and where the last record starts
+  uint64_t end;
+  uint64_t last;
+} wal_segment_t;
+
+typedef struct
+{
+  char *dir;
+  uint64_t segment_size;
+  // oldest first, records are appended to the last one
+  wal_segment_t *segs;
+  int n_segs;
+  int cap_segs;
+  // index of the next record, 0 if the wal is empty and any index can come
+  uint64_t next_idx;
+  // stamped on every record, bumped when the tail is truncated so that the
+  // records left behind past the new tail can't pass for new ones
+  uint32_t epoch;
+  // first segment appended to since the last sync, -1 if none
+  int dirty;
+} wal_t;
+
+typedef int (*wal_replay_cb)(void *arg, uint64_t idx, const char *rec, uint32_t len);
+
+// open the wal in dir, creating it if need be. a torn tail left by a crash
+// is dropped
+int wal_open(wal_t *w, const char *dir, uint64_t segment_size);
+void wal_close(wal_t *w);
+// append a record made of the iov buffers. idx must follow on from the last
+// record. *rec points at the record in its segment. it isn't durable until
+// wal_sync is called
+int wal_append(wal_t *w, uint64_t idx, const struct iovec *iov, int iovcnt, const char **rec);
+// make every record appended so far durable, one fdatasync per segment that
+// was appended to, so a whole batch of records costs one sync
+int wal_sync(wal_t *w);
+// drop the records from idx onwards
+int wal_truncate_tail(wal_t *w, uint64_t idx);
+// records before idx aren't needed anymore, delete the segments that only
+// hold such records
+int wal_truncate_head(wal_t *w, uint64_t idx);
+// drop every record, the next one can have any index
+int wal_reset(wal_t *w);
+// call cb for each record, oldest first, until it returns non zero
+int wal_replay(wal_t *w, wal_replay_cb cb, void *arg);
+uint32_t wal_crc32c(uint32_t crc, const void *buf, size_t len);
+#endif
@@ -0,0 +1,131 @@
+/*************************************************************************
+  > File Name: wal_test.c
+  > Author:perrynzhou
+  > Mail:perrynzhou@gmail.com
+  > Created Time: Fri 16 Oct 2026 06:40:31 PM UTC
+ ************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "wal.h"
+
+#define WAL_TEST_DIR "/tmp/wal_test"
+
+static uint64_t replayed[64];
+static int n_replayed;
+
+static int replay_cb(void *arg, uint64_t idx, const char *rec, uint32_t len)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "rec-%lu", idx);
+  assert(len == strlen(buf) && memcmp(rec, buf, len) == 0);
+  replayed[n_replayed++] = idx;
+  return 0;
+}
+static int append(wal_t *w, uint64_t idx)
+{
+  char buf[32];
+  const char *rec = NULL;
+  struct iovec iov[2];
+  int n = snprintf(buf, sizeof(buf), "rec-%lu", idx);
+  // a record can be split over several buffers
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = buf + 4;
+  iov[1].iov_len = n - 4;
+  int ret = wal_append(w, idx, iov, 2, &rec);
+  assert(ret != 0 || memcmp(rec, buf, n) == 0);
+  return ret;
+}
+static int replay(wal_t *w)
+{
+  n_replayed = 0;
+  assert(wal_replay(w, replay_cb, NULL) == 0);
+  return n_replayed;
+}
+static int count_segments()
+{
+  int n = 0;
+  struct dirent *de;
+  DIR *d = opendir(WAL_TEST_DIR);
+  while ((de = readdir(d)) != NULL)
+  {
+    n += strstr(de->d_name, ".wal") != NULL;
+  }
+  closedir(d);
+  return n;
+}
+int main(int argc, char *argv[])
+{
+  wal_t w;
+  uint64_t i;
+  system("rm -rf " WAL_TEST_DIR);
+  assert(wal_crc32c(0, "123456789", 9) == 0xe3069283);
+
+  // 4 records of 32 bytes to a segment
+  assert(wal_open(&w, WAL_TEST_DIR, 128) == 0);
+  for (i = 1; i <= 10; i++)
+  {
+    assert(append(&w, i) == 0);
+  }
+  // indexes have to follow on
+  assert(append(&w, 12) == -1);
+  assert(wal_sync(&w) == 0);
+  assert(count_segments() == 3);
+  assert(replay(&w) == 10 && replayed[0] == 1 && replayed[9] == 10);
+  wal_close(&w);
+
+  // everything is there after a restart
+  assert(wal_open(&w, WAL_TEST_DIR, 128) == 0);
+  assert(replay(&w) == 10);
+  assert(append(&w, 11) == 0);
+
+  // dropping the tail goes back into the previous segment
+  assert(wal_truncate_tail(&w, 6) == 0);
+  assert(count_segments() == 2);
+  assert(replay(&w) == 5 && replayed[4] == 5);
+  assert(append(&w, 6) == 0);
+  assert(wal_sync(&w) == 0);
+  wal_close(&w);
+
+  // the dropped records 7 and 8 are still on disk after the new record 6,
+  // they mustn't come back
+  assert(wal_open(&w, WAL_TEST_DIR, 128) == 0);
+  assert(replay(&w) == 6 && replayed[5] == 6);
+
+  // old records go a segment at a time
+  assert(wal_truncate_head(&w, 4) == 0);
+  assert(count_segments() == 2);
+  assert(wal_truncate_head(&w, 5) == 0);
+  assert(count_segments() == 1);
+  assert(replay(&w) == 2 && replayed[0] == 5);
+  wal_close(&w);
+
+  // a torn write at the tail is dropped
+  int fd = open(WAL_TEST_DIR "/0000000000000005.wal", O_WRONLY);
+  assert(fd >= 0 && pwrite(fd, "x", 1, 32 + 26) == 1);
+  close(fd);
+  assert(wal_open(&w, WAL_TEST_DIR, 128) == 0);
+  assert(replay(&w) == 1 && replayed[0] == 5);
+  assert(append(&w, 7) == -1 && append(&w, 6) == 0);
+
+  // a record bigger than a segment gets a segment of its own
+  char big[512] = {'\0'};
+  struct iovec iov = {.iov_base = big, .iov_len = sizeof(big)};
+  assert(wal_append(&w, 7, &iov, 1, NULL) == 0);
+  assert(count_segments() == 2);
+
+  // after a reset any index can come next
+  assert(wal_reset(&w) == 0);
+  assert(count_segments() == 0 && replay(&w) == 0);
+  assert(append(&w, 100) == 0);
+  wal_close(&w);
+  system("rm -rf " WAL_TEST_DIR);
+  fprintf(stdout, "wal test succ\n");
+  return 0;
+}
@@ -106,6 +106,14 @@ int sender_appendentries_response(raft_server_t* raft,
                         sizeof(*msg), node, raft);
 }
 
+int sender_installsnapshot(raft_server_t* raft,
+                           void* udata, raft_node_t* node,
+                           msg_installsnapshot_t* msg)
+{
+    return __append_msg(udata, msg, RAFT_MSG_INSTALLSNAPSHOT, sizeof(*msg),
+                        node, raft);
+}
+
 int sender_entries_response(raft_server_t* raft,
                             void* udata, raft_node_t* node, msg_entry_response_t* msg)
 {
@@ -163,6 +171,14 @@ void sender_poll_msgs(void* s)
         case RAFT_MSG_APPENDENTRIES_RESPONSE:
             raft_recv_appendentries_response(me->raft, m->sender, m->data);
             break;
+        case RAFT_MSG_INSTALLSNAPSHOT:
+        {
+            msg_appendentries_response_t response;
+            raft_recv_installsnapshot(me->raft, m->sender, m->data, &response);
+            __append_msg(me, &response, RAFT_MSG_APPENDENTRIES_RESPONSE,
+                         sizeof(response), m->sender, me->raft);
+        }
+        break;
         case RAFT_MSG_REQUESTVOTE:
         {
             msg_requestvote_response_t response;
@@ -7,6 +7,7 @@ typedef enum
     RAFT_MSG_REQUESTVOTE_RESPONSE,
     RAFT_MSG_APPENDENTRIES,
     RAFT_MSG_APPENDENTRIES_RESPONSE,
+    RAFT_MSG_INSTALLSNAPSHOT,
     RAFT_MSG_ENTRY,
     RAFT_MSG_ENTRY_RESPONSE,
 } raft_message_type_e;
@@ -35,6 +36,9 @@ int sender_appendentries(raft_server_t* raft,
 int sender_appendentries_response(raft_server_t* raft,
         void* udata, raft_node_t* node, msg_appendentries_response_t* msg);
 
+int sender_installsnapshot(raft_server_t* raft,
+        void* udata, raft_node_t* node, msg_installsnapshot_t* msg);
+
 int sender_entries(raft_server_t* raft,
         void* udata, raft_node_t* node, msg_entry_t* msg);
 
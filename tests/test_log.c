@@ -130,6 +130,154 @@ void TestLog_delete_onwards(CuTest * tc)
     CuAssertTrue(tc, NULL == log_get_at_idx(l, 3));
 }
 
+void TestLog_poll_then_append_wraps_around(CuTest * tc)
+{
+    void *l;
+    raft_entry_t e;
+    int i;
+
+    l = log_new();
+    for (i = 1; i <= 8; i++)
+    {
+        e.id = i;
+        CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    }
+    for (i = 1; i <= 6; i++)
+        CuAssertTrue(tc, i == ((raft_entry_t*)log_poll(l))->id);
+
+    /* room freed at the front gets reused without growing */
+    for (i = 9; i <= 14; i++)
+    {
+        e.id = i;
+        CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    }
+    CuAssertTrue(tc, 8 == log_count(l));
+    CuAssertTrue(tc, 14 == log_get_current_idx(l));
+    CuAssertTrue(tc, NULL == log_get_at_idx(l, 6));
+    for (i = 7; i <= 14; i++)
+        CuAssertTrue(tc, i == log_get_at_idx(l, i)->id);
+    CuAssertTrue(tc, 14 == log_peektail(l)->id);
+
+    log_delete(l, 13);
+    CuAssertTrue(tc, 12 == log_peektail(l)->id);
+    CuAssertTrue(tc, 12 == log_get_current_idx(l));
+}
+
+void TestLog_entries_stay_put_across_chunks(CuTest * tc)
+{
+    void *l;
+    raft_entry_t e;
+    int i, n_etys;
+
+    memset(&e, 0, sizeof(e));
+    l = log_new();
+    e.id = 1;
+    CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    raft_entry_t* first = log_get_at_idx(l, 1);
+
+    for (i = 2; i <= 5000; i++)
+    {
+        e.id = i;
+        CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    }
+
+    /* growing the log doesn't move what's already in it */
+    CuAssertTrue(tc, first == log_get_at_idx(l, 1));
+    for (i = 1; i <= 5000; i++)
+        CuAssertIntEquals(tc, i, log_get_at_idx(l, i)->id);
+
+    /* runs of entries end with their chunk */
+    raft_entry_t* run = log_get_from_idx(l, 1, &n_etys);
+    CuAssertTrue(tc, first == run);
+    CuAssertTrue(tc, 0 < n_etys && n_etys < 5000);
+    CuAssertIntEquals(tc, n_etys + 1, log_get_from_idx(l, n_etys + 1,
+                                                       &n_etys)->id);
+
+    for (i = 1; i <= 3000; i++)
+        CuAssertIntEquals(tc, i, ((raft_entry_t*)log_poll(l))->id);
+    log_delete(l, 4001);
+
+    CuAssertIntEquals(tc, 1000, log_count(l));
+    CuAssertIntEquals(tc, 4000, log_peektail(l)->id);
+    for (i = 3001; i <= 4000; i++)
+        CuAssertIntEquals(tc, i, log_get_at_idx(l, i)->id);
+
+    log_get_from_idx(l, 3990, &n_etys);
+    CuAssertTrue(tc, n_etys <= 11);
+
+    for (i = 4001; i <= 6000; i++)
+    {
+        e.id = i;
+        CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    }
+    for (i = 3001; i <= 6000; i++)
+        CuAssertIntEquals(tc, i, log_get_at_idx(l, i)->id);
+}
+
+void TestLog_load_from_snapshot(CuTest * tc)
+{
+    void *l;
+    raft_entry_t e;
+
+    l = log_new();
+    e.id = 1;
+    CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+
+    log_load_from_snapshot(l, 10);
+    CuAssertTrue(tc, 0 == log_count(l));
+    CuAssertTrue(tc, 10 == log_get_base(l));
+    CuAssertTrue(tc, 10 == log_get_current_idx(l));
+    CuAssertTrue(tc, NULL == log_get_at_idx(l, 10));
+
+    e.id = 2;
+    CuAssertTrue(tc, 0 == log_append_entry(l, &e));
+    CuAssertTrue(tc, 11 == log_get_current_idx(l));
+    CuAssertTrue(tc, 2 == log_get_at_idx(l, 11)->id);
+}
+
+static int __batch_calls, __batch_idx, __batch_n;
+
+static int __log_offer_batch(
+    raft_server_t* raft,
+    void *user_data,
+    raft_entry_t *entries,
+    int entry_idx,
+    int n_entries
+    )
+{
+    __batch_calls++;
+    __batch_idx = entry_idx;
+    __batch_n = n_entries;
+    return 0;
+}
+
+void TestLog_append_batch_offers_entries_at_once(CuTest * tc)
+{
+    void *l;
+    raft_entry_t e[3];
+
+    memset(e, 0, sizeof(e));
+    e[0].id = 1;
+    e[1].id = 2;
+    e[2].id = 3;
+
+    l = log_new();
+    raft_cbs_t funcs = {
+        .log_offer_batch = __log_offer_batch
+    };
+    log_set_callbacks(l, &funcs, raft_new());
+
+    CuAssertTrue(tc, 0 == log_append_batch(l, e, 1));
+    __batch_calls = 0;
+    CuAssertTrue(tc, 0 == log_append_batch(l, &e[1], 2));
+    CuAssertIntEquals(tc, 1, __batch_calls);
+    CuAssertIntEquals(tc, 1, __batch_idx);
+    CuAssertIntEquals(tc, 2, __batch_n);
+
+    CuAssertIntEquals(tc, 3, log_count(l));
+    CuAssertIntEquals(tc, 3, log_get_at_idx(l, 3)->id);
+}
+
 void TestLog_peektail(CuTest * tc)
 {
     void *l;
@@ -967,6 +967,222 @@ void TestRaft_follower_recv_appendentries_delete_entries_if_conflict_with_new_en
     CuAssertTrue(tc, !strncmp(ety_appended->data.buf, strs[0], 3));
 }
 
+static void __append_terms(void* r, int* terms, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        raft_entry_t ety = {};
+        ety.term = terms[i];
+        ety.id = raft_get_current_idx(r) + 1;
+        ety.data.buf = "aaa";
+        ety.data.len = 3;
+        raft_append_entry(r, &ety);
+    }
+}
+
+static int __applied_batches;
+static int __applied_idx;
+static int __applied_n;
+
+static int __applylog_batch(raft_server_t* raft, void* udata,
+                            raft_entry_t* etys, int ety_idx, int n_etys)
+{
+    __applied_batches++;
+    __applied_idx = ety_idx;
+    __applied_n = n_etys;
+    return 0;
+}
+
+void TestRaft_server_apply_all_applies_committed_entries_in_one_batch(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .applylog_batch = __applylog_batch,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+
+    int terms[] = { 1, 1, 1, 1, 1 };
+    __append_terms(r, terms, 5);
+    raft_set_commit_idx(r, 1);
+    raft_apply_all(r);
+
+    __applied_batches = 0;
+    raft_set_commit_idx(r, 4);
+    raft_apply_all(r);
+    CuAssertIntEquals(tc, 1, __applied_batches);
+    CuAssertIntEquals(tc, 2, __applied_idx);
+    CuAssertIntEquals(tc, 3, __applied_n);
+    CuAssertIntEquals(tc, 4, raft_get_last_applied_idx(r));
+}
+
+static int __applylog_batch_full(raft_server_t* raft, void *udata,
+                                 raft_entry_t *etys, int ety_idx, int n_etys)
+{
+    __applied_batches++;
+    return -1;
+}
+
+void TestRaft_server_apply_all_retries_entries_that_failed_to_apply(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .applylog_batch = __applylog_batch_full,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+
+    int terms[] = { 1, 1, 1 };
+    __append_terms(r, terms, 3);
+    raft_set_commit_idx(r, 3);
+
+    __applied_batches = 0;
+    CuAssertIntEquals(tc, -1, raft_apply_all(r));
+    CuAssertIntEquals(tc, 1, __applied_batches);
+    CuAssertIntEquals(tc, 0, raft_get_last_applied_idx(r));
+
+    /* the store has room again */
+    funcs.applylog_batch = __applylog_batch;
+    raft_set_callbacks(r, &funcs, NULL);
+    CuAssertIntEquals(tc, 0, raft_apply_all(r));
+    CuAssertIntEquals(tc, 1, __applied_idx);
+    CuAssertIntEquals(tc, 3, __applied_n);
+    CuAssertIntEquals(tc, 3, raft_get_last_applied_idx(r));
+}
+
+void TestRaft_server_compact_log_discards_applied_entries(CuTest * tc)
+{
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+
+    int terms[] = { 1, 1, 2, 2, 2 };
+    __append_terms(r, terms, 5);
+    raft_set_commit_idx(r, 3);
+    raft_apply_all(r);
+
+    /* only applied entries can be compacted */
+    CuAssertIntEquals(tc, -1, raft_compact_log(r, 4));
+
+    CuAssertIntEquals(tc, 0, raft_compact_log(r, 3));
+    CuAssertIntEquals(tc, 3, raft_get_snapshot_last_idx(r));
+    CuAssertIntEquals(tc, 2, raft_get_snapshot_last_term(r));
+    CuAssertIntEquals(tc, 2, raft_get_log_count(r));
+    CuAssertIntEquals(tc, 5, raft_get_current_idx(r));
+    CuAssertTrue(tc, NULL == raft_get_entry_from_idx(r, 3));
+    CuAssertTrue(tc, NULL != raft_get_entry_from_idx(r, 4));
+    CuAssertIntEquals(tc, -1, raft_compact_log(r, 3));
+
+    /* the last term is still known once every entry is gone */
+    raft_set_commit_idx(r, 5);
+    raft_apply_all(r);
+    CuAssertIntEquals(tc, 0, raft_compact_log(r, 5));
+    CuAssertIntEquals(tc, 0, raft_get_log_count(r));
+    CuAssertIntEquals(tc, 2, raft_get_last_log_term(r));
+}
+
+void TestRaft_follower_recv_installsnapshot_replaces_log(CuTest * tc)
+{
+    msg_appendentries_response_t aer;
+
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 2);
+
+    int terms[] = { 1, 1 };
+    __append_terms(r, terms, 2);
+
+    /* from an old leader */
+    msg_installsnapshot_t is = {};
+    is.term = 1;
+    is.last_idx = 5;
+    is.last_term = 1;
+    CuAssertIntEquals(tc, -1, raft_recv_installsnapshot(r, raft_get_node(r, 2), &is, &aer));
+    CuAssertIntEquals(tc, 0, aer.success);
+    CuAssertIntEquals(tc, 2, raft_get_current_idx(r));
+
+    /* the snapshot is ahead of us, our log goes */
+    is.term = 2;
+    is.last_term = 2;
+    CuAssertIntEquals(tc, 0, raft_recv_installsnapshot(r, raft_get_node(r, 2), &is, &aer));
+    CuAssertIntEquals(tc, 1, aer.success);
+    CuAssertIntEquals(tc, 5, aer.current_idx);
+    CuAssertIntEquals(tc, 0, raft_get_log_count(r));
+    CuAssertIntEquals(tc, 5, raft_get_current_idx(r));
+    CuAssertIntEquals(tc, 5, raft_get_commit_idx(r));
+    CuAssertIntEquals(tc, 5, raft_get_last_applied_idx(r));
+    CuAssertIntEquals(tc, 2, raft_get_last_log_term(r));
+
+    /* appendentries carry on from the snapshot */
+    msg_appendentries_t ae = {};
+    msg_entry_t ety = {};
+    ety.id = 6;
+    ety.term = 2;
+    ety.data.buf = "aaa";
+    ety.data.len = 3;
+    ae.term = 2;
+    ae.prev_log_idx = 5;
+    ae.prev_log_term = 2;
+    ae.entries = &ety;
+    ae.n_entries = 1;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertIntEquals(tc, 1, aer.success);
+    CuAssertIntEquals(tc, 6, aer.current_idx);
+
+    /* we are past it already */
+    CuAssertIntEquals(tc, 1, raft_recv_installsnapshot(r, raft_get_node(r, 2), &is, &aer));
+    CuAssertIntEquals(tc, 1, aer.success);
+    CuAssertIntEquals(tc, 6, raft_get_current_idx(r));
+}
+
+void TestRaft_follower_recv_appendentries_failure_includes_conflict_hints(
+    CuTest * tc)
+{
+    msg_appendentries_t ae;
+    msg_appendentries_response_t aer;
+
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 3);
+
+    /* log terms are 1, 1, 2, 3, 3 */
+    int terms[] = { 1, 1, 2, 3, 3 };
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        raft_entry_t ety = {};
+        ety.term = terms[i];
+        ety.id = i + 1;
+        ety.data.buf = "aaa";
+        ety.data.len = 3;
+        raft_append_entry(r, &ety);
+    }
+
+    /* our entry at prev_log_idx is from term 3, which starts at 4 */
+    memset(&ae, 0, sizeof(msg_appendentries_t));
+    ae.term = 4;
+    ae.prev_log_idx = 5;
+    ae.prev_log_term = 4;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertIntEquals(tc, 0, aer.success);
+    CuAssertIntEquals(tc, 3, aer.conflict_term);
+    CuAssertIntEquals(tc, 4, aer.conflict_idx);
+
+    /* our log doesn't reach prev_log_idx, the leader should carry on from
+     * just past our last entry */
+    ae.prev_log_idx = 9;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertIntEquals(tc, 0, aer.success);
+    CuAssertIntEquals(tc, 0, aer.conflict_term);
+    CuAssertIntEquals(tc, raft_get_current_idx(r) + 1, aer.conflict_idx);
+}
+
 void TestRaft_follower_recv_appendentries_delete_entries_if_current_idx_greater_than_prev_log_idx(
     CuTest * tc)
 {
@@ -1772,6 +1988,176 @@ void TestRaft_leader_sends_appendentries_with_prevLogIdx(
     CuAssertTrue(tc, ae->prev_log_idx == 1);
 }
 
+void TestRaft_leader_sends_installsnapshot_to_follower_behind_snapshot(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = sender_appendentries,
+        .send_installsnapshot = sender_installsnapshot,
+        .log                = NULL
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 2);
+
+    int terms[] = { 1, 1, 2, 2, 2 };
+    __append_terms(r, terms, 5);
+    raft_set_commit_idx(r, 4);
+    raft_apply_all(r);
+    raft_compact_log(r, 4);
+    raft_set_state(r, RAFT_STATE_LEADER);
+
+    raft_node_t* n = raft_get_node(r, 2);
+    raft_node_set_next_idx(n, 2);
+    raft_send_appendentries(r, n);
+
+    msg_installsnapshot_t* is = sender_poll_msg_data(sender);
+    CuAssertTrue(tc, NULL != is);
+    CuAssertIntEquals(tc, 2, is->term);
+    CuAssertIntEquals(tc, 4, is->last_idx);
+    CuAssertIntEquals(tc, 2, is->last_term);
+    CuAssertIntEquals(tc, 5, raft_node_get_next_idx(n));
+
+    /* the snapshot's last term goes along with the entries after it */
+    raft_send_appendentries(r, n);
+    msg_appendentries_t* ae = sender_poll_msg_data(sender);
+    CuAssertTrue(tc, NULL != ae);
+    CuAssertIntEquals(tc, 4, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 2, ae->prev_log_term);
+    CuAssertIntEquals(tc, 1, ae->n_entries);
+}
+
+void TestRaft_leader_sends_appendentries_with_several_entries(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = sender_appendentries,
+        .log                = NULL
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1); /* me */
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_state(r, RAFT_STATE_LEADER);
+
+    raft_entry_t ety;
+    ety.term = 1;
+    ety.data.len = 4;
+    ety.data.buf = (unsigned char*)"aaa";
+    for (ety.id = 1; ety.id <= 5; ety.id++)
+        raft_append_entry(r, &ety);
+
+    raft_node_t* n = raft_get_node(r, 2);
+    raft_node_set_next_idx(n, 1);
+
+    /* a lagging follower gets everything we have in one go */
+    raft_send_appendentries(r, n);
+    msg_appendentries_t*  ae = sender_poll_msg_data(sender);
+    CuAssertTrue(tc, NULL != ae);
+    CuAssertIntEquals(tc, 5, ae->n_entries);
+    CuAssertIntEquals(tc, 1, ae->entries[0].id);
+    CuAssertIntEquals(tc, 5, ae->entries[4].id);
+
+    /* up to the entry limit */
+    raft_set_appendentries_max_entries(r, 2);
+    raft_node_set_next_idx(n, 1);
+    raft_send_appendentries(r, n);
+    ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 2, ae->n_entries);
+
+    /* and the byte limit */
+    raft_set_appendentries_max_entries(r, 0);
+    raft_set_appendentries_max_bytes(r, 10);
+    raft_node_set_next_idx(n, 1);
+    raft_send_appendentries(r, n);
+    ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 2, ae->n_entries);
+
+    /* an entry bigger than the limit still goes out on its own */
+    raft_set_appendentries_max_bytes(r, 1);
+    raft_node_set_next_idx(n, 1);
+    raft_send_appendentries(r, n);
+    ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 1, ae->n_entries);
+}
+
+void TestRaft_leader_pipelines_appendentries_up_to_max_inflight(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = sender_appendentries,
+        .log                = NULL
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1); /* me */
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_state(r, RAFT_STATE_LEADER);
+    raft_set_current_term(r, 1);
+    raft_set_appendentries_max_inflight(r, 2);
+
+    raft_node_t* n = raft_get_node(r, 2);
+    raft_node_set_next_idx(n, 1);
+
+    msg_entry_t ety = {};
+    msg_entry_response_t cr;
+    ety.data.buf = "aaa";
+    ety.data.len = 3;
+
+    /* each entry goes out without waiting for the previous one */
+    ety.id = 1;
+    raft_recv_entry(r, &ety, &cr);
+    ety.id = 2;
+    raft_recv_entry(r, &ety, &cr);
+    CuAssertIntEquals(tc, 3, raft_node_get_next_idx(n));
+    CuAssertIntEquals(tc, 2, raft_node_get_inflight(n));
+
+    msg_appendentries_t* ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 0, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 1, ae->n_entries);
+    ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 1, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 1, ae->n_entries);
+
+    /* the window is full */
+    ety.id = 3;
+    raft_recv_entry(r, &ety, &cr);
+    CuAssertTrue(tc, NULL == sender_poll_msg_data(sender));
+    CuAssertIntEquals(tc, 3, raft_node_get_next_idx(n));
+
+    /* an acknowledgement makes room for the entry that was held back */
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 1;
+    raft_recv_appendentries_response(r, n, &aer);
+    CuAssertIntEquals(tc, 1, raft_node_get_match_idx(n));
+    CuAssertIntEquals(tc, 4, raft_node_get_next_idx(n));
+    ae = sender_poll_msg_data(sender);
+    CuAssertIntEquals(tc, 2, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 1, ae->n_entries);
+
+    /* the second batch went missing so the follower rejects the third, we
+     * roll back to where the follower is and resend from there */
+    aer.success = 0;
+    aer.current_idx = 1;
+    aer.first_idx = 3;
+    raft_recv_appendentries_response(r, n, &aer);
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 1, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 2, ae->n_entries);
+    CuAssertIntEquals(tc, 1, raft_node_get_inflight(n));
+}
+
 void TestRaft_leader_sends_appendentries_when_node_has_next_idx_of_0(
     CuTest * tc)
 {
@@ -2112,53 +2498,137 @@ void TestRaft_leader_recv_appendentries_response_do_not_increase_commit_idx_beca
     CuAssertIntEquals(tc, 0, raft_get_commit_idx(r));
     raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
     CuAssertIntEquals(tc, 3, raft_get_commit_idx(r));
-    raft_periodic(r, 1);
-    CuAssertIntEquals(tc, 1, raft_get_last_applied_idx(r));
-    raft_periodic(r, 1);
-    CuAssertIntEquals(tc, 2, raft_get_last_applied_idx(r));
-    raft_periodic(r, 1);
+    /* all newly committed entries are applied without waiting for periodic */
     CuAssertIntEquals(tc, 3, raft_get_last_applied_idx(r));
 }
 
-void TestRaft_leader_recv_appendentries_response_jumps_to_lower_next_idx(
+static int __raft_applylog_count(
+    raft_server_t* raft,
+    void *udata,
+    raft_entry_t *ety
+    )
+{
+    (*(int*)udata)++;
+    return 0;
+}
+
+void TestRaft_leader_recv_appendentries_response_applies_committed_entries(
     CuTest * tc)
 {
     raft_cbs_t funcs = {
-        .send_appendentries          = sender_appendentries,
-        .log                         = NULL
+        .applylog = __raft_applylog_count,
     };
     msg_appendentries_response_t aer;
+    int applied = 0;
 
-    void *sender = sender_new(NULL);
     void *r = raft_new();
     raft_add_node(r, NULL, 1, 1);
     raft_add_node(r, NULL, 2, 0);
-    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_callbacks(r, &funcs, &applied);
 
-    raft_set_current_term(r, 2);
+    raft_set_state(r, RAFT_STATE_LEADER);
+    raft_set_current_term(r, 1);
     raft_set_commit_idx(r, 0);
+    raft_set_last_applied_idx(r, 0);
 
-    /* append entries */
-    raft_entry_t ety;
+    raft_entry_t ety = {};
     ety.term = 1;
-    ety.id = 1;
     ety.data.buf = "aaaa";
     ety.data.len = 4;
+    ety.id = 1;
     raft_append_entry(r, &ety);
-    ety.term = 2;
     ety.id = 2;
     raft_append_entry(r, &ety);
-    ety.term = 3;
-    ety.id = 3;
-    raft_append_entry(r, &ety);
-    ety.term = 4;
-    ety.id = 4;
-    raft_append_entry(r, &ety);
 
-    msg_appendentries_t* ae;
+    memset(&aer, 0, sizeof(msg_appendentries_response_t));
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 2;
+    aer.first_idx = 1;
+    raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
 
-    /* become leader sets next_idx to current_idx */
-    raft_become_leader(r);
+    /* no periodic needed */
+    CuAssertIntEquals(tc, 2, raft_get_commit_idx(r));
+    CuAssertIntEquals(tc, 2, raft_get_last_applied_idx(r));
+    CuAssertIntEquals(tc, 2, applied);
+}
+
+void TestRaft_follower_recv_appendentries_applies_committed_entries(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .applylog = __raft_applylog_count,
+    };
+    int applied = 0;
+
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_callbacks(r, &funcs, &applied);
+    raft_set_current_term(r, 1);
+
+    msg_entry_t etys[2] = {};
+    etys[0].term = 1;
+    etys[0].id = 1;
+    etys[1].term = 1;
+    etys[1].id = 2;
+
+    msg_appendentries_t ae;
+    msg_appendentries_response_t aer;
+    memset(&ae, 0, sizeof(msg_appendentries_t));
+    ae.term = 1;
+    ae.prev_log_idx = 0;
+    ae.prev_log_term = 1;
+    ae.leader_commit = 2;
+    ae.entries = etys;
+    ae.n_entries = 2;
+
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertIntEquals(tc, 1, aer.success);
+    CuAssertIntEquals(tc, 2, raft_get_last_applied_idx(r));
+    CuAssertIntEquals(tc, 2, applied);
+}
+
+void TestRaft_leader_recv_appendentries_response_jumps_to_lower_next_idx(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries          = sender_appendentries,
+        .log                         = NULL
+    };
+    msg_appendentries_response_t aer;
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_callbacks(r, &funcs, sender);
+
+    raft_set_current_term(r, 2);
+    raft_set_commit_idx(r, 0);
+
+    /* append entries */
+    raft_entry_t ety;
+    ety.term = 1;
+    ety.id = 1;
+    ety.data.buf = "aaaa";
+    ety.data.len = 4;
+    raft_append_entry(r, &ety);
+    ety.term = 2;
+    ety.id = 2;
+    raft_append_entry(r, &ety);
+    ety.term = 3;
+    ety.id = 3;
+    raft_append_entry(r, &ety);
+    ety.term = 4;
+    ety.id = 4;
+    raft_append_entry(r, &ety);
+
+    msg_appendentries_t* ae;
+
+    /* become leader sets next_idx to current_idx */
+    raft_become_leader(r);
     raft_node_t* node = raft_get_node(r, 2);
     CuAssertIntEquals(tc, 5, raft_node_get_next_idx(node));
     CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
@@ -2177,7 +2647,8 @@ void TestRaft_leader_recv_appendentries_response_jumps_to_lower_next_idx(
     aer.success = 0;
     aer.current_idx = 1;
     raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
-    CuAssertIntEquals(tc, 2, raft_node_get_next_idx(node));
+    /* we rolled back to 2, and the retry has moved us past what it sent */
+    CuAssertIntEquals(tc, 5, raft_node_get_next_idx(node));
 
     /* see if new appendentries have appropriate values */
     CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
@@ -2187,6 +2658,75 @@ void TestRaft_leader_recv_appendentries_response_jumps_to_lower_next_idx(
     CuAssertTrue(tc, NULL == sender_poll_msg_data(sender));
 }
 
+void TestRaft_leader_recv_appendentries_response_uses_conflict_hints(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries          = sender_appendentries,
+        .log                         = NULL
+    };
+    msg_appendentries_response_t aer;
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_callbacks(r, &funcs, sender);
+    raft_set_current_term(r, 4);
+
+    /* log terms are 1, 1, 2, 2, 4, 4 */
+    int terms[] = { 1, 1, 2, 2, 4, 4 };
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        raft_entry_t ety = {};
+        ety.term = terms[i];
+        ety.id = i + 1;
+        ety.data.buf = "aaaa";
+        ety.data.len = 4;
+        raft_append_entry(r, &ety);
+    }
+
+    raft_become_leader(r);
+    raft_node_t* node = raft_get_node(r, 2);
+    msg_appendentries_t* ae;
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 6, ae->prev_log_idx);
+
+    memset(&aer, 0, sizeof(msg_appendentries_response_t));
+    aer.term = 4;
+    aer.success = 0;
+    aer.current_idx = 6;
+    aer.first_idx = 7;
+
+    /* the follower's term 3 isn't in our log, skip all of it */
+    aer.conflict_term = 3;
+    aer.conflict_idx = 4;
+    raft_recv_appendentries_response(r, node, &aer);
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 3, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 2, ae->prev_log_term);
+
+    /* we have term 2 up to 4, resume right after it */
+    raft_node_set_next_idx(node, 7);
+    aer.conflict_term = 2;
+    aer.conflict_idx = 3;
+    raft_recv_appendentries_response(r, node, &aer);
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 4, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 2, ae->prev_log_term);
+
+    /* the follower's log is short */
+    raft_node_set_next_idx(node, 7);
+    aer.current_idx = 2;
+    aer.conflict_term = 0;
+    aer.conflict_idx = 3;
+    raft_recv_appendentries_response(r, node, &aer);
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 2, ae->prev_log_idx);
+    CuAssertIntEquals(tc, 1, ae->prev_log_term);
+}
+
 void TestRaft_leader_recv_appendentries_response_decrements_to_lower_next_idx(
     CuTest * tc)
 {
@@ -2244,7 +2784,8 @@ void TestRaft_leader_recv_appendentries_response_decrements_to_lower_next_idx(
     aer.success = 0;
     aer.current_idx = 4;
     raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
-    CuAssertIntEquals(tc, 4, raft_node_get_next_idx(node));
+    /* we rolled back to 4, and the retry has moved us past what it sent */
+    CuAssertIntEquals(tc, 5, raft_node_get_next_idx(node));
 
     /* see if new appendentries have appropriate values */
     CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
@@ -2256,8 +2797,10 @@ void TestRaft_leader_recv_appendentries_response_decrements_to_lower_next_idx(
     aer.term = 2;
     aer.success = 0;
     aer.current_idx = 4;
+    /* the follower rejected the retry, which started at 4 */
+    aer.first_idx = 4;
     raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
-    CuAssertIntEquals(tc, 3, raft_node_get_next_idx(node));
+    CuAssertIntEquals(tc, 5, raft_node_get_next_idx(node));
 
     /* see if new appendentries have appropriate values */
     CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
@@ -2408,6 +2951,191 @@ void TestRaft_leader_recv_entry_is_committed_returns_neg_1_if_invalidated(CuTest
     CuAssertTrue(tc, -1 == raft_msg_entry_response_committed(r, &cr));
 }
 
+static int __appendentries_sent;
+static int __appendentries_sent_at_offer;
+
+static int __count_appendentries(raft_server_t* raft, void* udata,
+                                 raft_node_t* node, msg_appendentries_t* msg)
+{
+    __appendentries_sent++;
+    return 0;
+}
+
+static int __offer_records_sends(raft_server_t* raft, void* udata,
+                                 raft_entry_t* ety, int ety_idx)
+{
+    __appendentries_sent_at_offer = __appendentries_sent;
+    return 0;
+}
+
+void TestRaft_leader_recv_entry_sends_appendentries_before_persisting(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = __count_appendentries,
+        .log_offer          = __offer_records_sends,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    __appendentries_sent = 0;
+    __appendentries_sent_at_offer = 0;
+
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.id = 1;
+    mety.data.buf = "entry";
+    mety.data.len = strlen("entry");
+    raft_recv_entry(r, &mety, &cr);
+
+    /* the follower already had the entry by the time we wrote it */
+    CuAssertIntEquals(tc, 1, __appendentries_sent);
+    CuAssertIntEquals(tc, 1, __appendentries_sent_at_offer);
+}
+
+static int __offer_fails(raft_server_t* raft, void* udata,
+                         raft_entry_t* ety, int ety_idx)
+{
+    return -1;
+}
+
+void TestRaft_leader_does_not_count_itself_until_entry_persisted(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = sender_appendentries,
+        .log_offer          = __offer_fails,
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    /* our write fails, eg. the disk is full */
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.id = 1;
+    mety.data.buf = "entry";
+    mety.data.len = strlen("entry");
+    raft_recv_entry(r, &mety, &cr);
+
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 1;
+
+    /* one follower and us would be a majority, if we had it on disk */
+    raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
+    CuAssertIntEquals(tc, 0, raft_get_commit_idx(r));
+
+    /* both followers are */
+    raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
+    CuAssertIntEquals(tc, 1, raft_get_commit_idx(r));
+}
+
+static int __offer_batch_calls;
+static int __offer_batch_idx;
+static int __offer_batch_n;
+
+static int __offer_batch(raft_server_t* raft, void* udata,
+                         raft_entry_t* etys, int ety_idx, int n_etys)
+{
+    __offer_batch_calls++;
+    __offer_batch_idx = ety_idx;
+    __offer_batch_n = n_etys;
+    return 0;
+}
+
+void TestRaft_follower_recv_appendentries_persists_entries_in_one_batch(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .log_offer_batch = __offer_batch,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+
+    msg_appendentries_t ae;
+    msg_appendentries_response_t aer;
+
+    memset(&ae, 0, sizeof(msg_appendentries_t));
+    ae.term = 1;
+    ae.prev_log_idx = 0;
+    ae.prev_log_term = 1;
+    msg_entry_t e[3];
+    memset(&e, 0, sizeof(msg_entry_t) * 3);
+    e[0].id = 1;
+    e[1].id = 2;
+    e[2].id = 3;
+    ae.entries = e;
+    ae.n_entries = 3;
+
+    __offer_batch_calls = 0;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+
+    CuAssertTrue(tc, 1 == aer.success);
+    CuAssertIntEquals(tc, 3, aer.current_idx);
+    CuAssertIntEquals(tc, 3, raft_get_log_count(r));
+    CuAssertIntEquals(tc, 1, __offer_batch_calls);
+    CuAssertIntEquals(tc, 0, __offer_batch_idx);
+    CuAssertIntEquals(tc, 3, __offer_batch_n);
+}
+
+static int __offer_batch_fails_once(raft_server_t* raft, void* udata,
+                                    raft_entry_t* etys, int ety_idx,
+                                    int n_etys)
+{
+    __offer_batch(raft, udata, etys, ety_idx, n_etys);
+    return 1 == __offer_batch_calls ? -1 : 0;
+}
+
+void TestRaft_leader_recv_entry_retries_entries_that_failed_to_persist(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .log_offer_batch = __offer_batch_fails_once,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.data.buf = "entry";
+    mety.data.len = strlen("entry");
+
+    __offer_batch_calls = 0;
+    mety.id = 1;
+    raft_recv_entry(r, &mety, &cr);
+    CuAssertIntEquals(tc, 0, raft_get_commit_idx(r));
+
+    /* the first entry goes to disk along with the second */
+    mety.id = 2;
+    raft_recv_entry(r, &mety, &cr);
+    CuAssertIntEquals(tc, 2, __offer_batch_calls);
+    CuAssertIntEquals(tc, 0, __offer_batch_idx);
+    CuAssertIntEquals(tc, 2, __offer_batch_n);
+    CuAssertIntEquals(tc, 2, raft_get_commit_idx(r));
+}
+
 void TestRaft_leader_recv_entry_does_not_send_new_appendentries_to_slow_nodes(CuTest * tc)
 {
     void *r = raft_new();
@@ -2491,10 +3219,16 @@ void TestRaft_leader_recv_appendentries_response_failure_does_not_set_node_nexti
     aer.current_idx = 0;
     aer.first_idx = 0;
     raft_node_t* p = raft_get_node(r, 2);
+    msg_appendentries_t* ae;
+    CuAssertTrue(tc, NULL != sender_poll_msg_data(sender));
     raft_recv_appendentries_response(r, p, &aer);
-    CuAssertTrue(tc, 1 == raft_node_get_next_idx(p));
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 0, ae->prev_log_idx);
     raft_recv_appendentries_response(r, p, &aer);
-    CuAssertTrue(tc, 1 == raft_node_get_next_idx(p));
+    CuAssertTrue(tc, NULL != (ae = sender_poll_msg_data(sender)));
+    CuAssertIntEquals(tc, 0, ae->prev_log_idx);
+    /* the hint sends us back to entry 1, which is in flight again */
+    CuAssertIntEquals(tc, 2, raft_node_get_next_idx(p));
 }
 
 void TestRaft_leader_recv_appendentries_response_increment_idx_of_node(
@@ -2717,3 +3451,505 @@ void TestRaft_leader_recv_requestvote_responds_with_granting_if_term_is_higher(C
     raft_recv_requestvote(r, raft_get_node(r, 3), &rv, &rvr);
     CuAssertTrue(tc, 1 == raft_is_follower(r));
 }
+
+static int __timeoutnows_sent;
+
+static int __send_timeoutnow(raft_server_t* raft, void* udata,
+                             raft_node_t* node, msg_timeoutnow_t* msg)
+{
+    __timeoutnows_sent++;
+    return 0;
+}
+
+void TestRaft_leader_transfer_leadership_sends_timeoutnow_once_caught_up(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_appendentries = sender_appendentries,
+        .send_timeoutnow    = __send_timeoutnow,
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.id = 1;
+    mety.data.buf = "entry";
+    mety.data.len = strlen("entry");
+    CuAssertIntEquals(tc, 0, raft_recv_entry(r, &mety, &cr));
+
+    __timeoutnows_sent = 0;
+    CuAssertIntEquals(tc, 0, raft_transfer_leadership(r, raft_get_node(r, 2)));
+    CuAssertTrue(tc, raft_get_node(r, 2) == raft_get_transfer_leader_node(r));
+    CuAssertIntEquals(tc, -1, raft_transfer_leadership(r, raft_get_node(r, 3)));
+
+    /* node 2 doesn't have the entry yet */
+    CuAssertIntEquals(tc, 0, __timeoutnows_sent);
+
+    /* no new entries while we're handing over */
+    mety.id = 2;
+    CuAssertIntEquals(tc, -1, raft_recv_entry(r, &mety, &cr));
+
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 1;
+    raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
+    CuAssertIntEquals(tc, 1, __timeoutnows_sent);
+}
+
+void TestRaft_leader_transfer_leadership_times_out_after_election_timeout(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_timeoutnow    = __send_timeoutnow,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_election_timeout(r, 1000);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    /* node 2 is up to date, it gets timeoutnow straight away */
+    __timeoutnows_sent = 0;
+    CuAssertIntEquals(tc, 0, raft_transfer_leadership(r, raft_get_node(r, 2)));
+    CuAssertIntEquals(tc, 1, __timeoutnows_sent);
+
+    raft_periodic(r, 999);
+    CuAssertTrue(tc, NULL != raft_get_transfer_leader_node(r));
+
+    /* but it never took over */
+    raft_periodic(r, 1);
+    CuAssertTrue(tc, NULL == raft_get_transfer_leader_node(r));
+    CuAssertTrue(tc, raft_is_leader(r));
+
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.id = 1;
+    CuAssertIntEquals(tc, 0, raft_recv_entry(r, &mety, &cr));
+}
+
+void TestRaft_leader_transfer_leadership_fails_for_self_or_follower(
+    CuTest * tc)
+{
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+
+    CuAssertIntEquals(tc, -1, raft_transfer_leadership(r, raft_get_node(r, 2)));
+
+    raft_become_leader(r);
+    CuAssertIntEquals(tc, -1, raft_transfer_leadership(r, raft_get_node(r, 1)));
+}
+
+void TestRaft_follower_recv_timeoutnow_starts_election(CuTest * tc)
+{
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 2);
+
+    msg_timeoutnow_t tn = { .term = 1 };
+
+    /* from a leader that's since been replaced */
+    CuAssertIntEquals(tc, -1, raft_recv_timeoutnow(r, raft_get_node(r, 2), &tn));
+    CuAssertTrue(tc, raft_is_follower(r));
+
+    tn.term = 2;
+    CuAssertIntEquals(tc, 0, raft_recv_timeoutnow(r, raft_get_node(r, 2), &tn));
+    CuAssertTrue(tc, raft_is_candidate(r));
+    CuAssertIntEquals(tc, 3, raft_get_current_term(r));
+}
+
+static msg_requestvote_t __last_rv;
+
+static int __record_requestvote(raft_server_t* raft, void* udata,
+                                raft_node_t* node, msg_requestvote_t* msg)
+{
+    __last_rv = *msg;
+    return 0;
+}
+
+void TestRaft_follower_with_prevote_asks_before_becoming_candidate(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_requestvote = __record_requestvote,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_prevote(r, 1);
+    raft_set_current_term(r, 1);
+    raft_set_election_timeout(r, 1000);
+
+    memset(&__last_rv, 0, sizeof(__last_rv));
+    raft_periodic(r, 1000);
+
+    /* our term and vote stay put until we know we could win */
+    CuAssertTrue(tc, raft_is_follower(r));
+    CuAssertIntEquals(tc, 1, raft_get_current_term(r));
+    CuAssertIntEquals(tc, -1, raft_get_voted_for(r));
+    CuAssertIntEquals(tc, 1, __last_rv.prevote);
+    CuAssertIntEquals(tc, 2, __last_rv.term);
+
+    msg_requestvote_response_t rvr = {};
+    rvr.term = 1;
+    rvr.vote_granted = 1;
+    rvr.prevote = 1;
+    raft_recv_requestvote_response(r, raft_get_node(r, 2), &rvr);
+
+    CuAssertTrue(tc, raft_is_candidate(r));
+    CuAssertIntEquals(tc, 2, raft_get_current_term(r));
+    CuAssertIntEquals(tc, 0, __last_rv.prevote);
+    CuAssertIntEquals(tc, 2, __last_rv.term);
+}
+
+void TestRaft_follower_with_prevote_stays_follower_when_prevote_rejected(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .send_requestvote = __record_requestvote,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_prevote(r, 1);
+    raft_set_current_term(r, 1);
+    raft_election_start(r);
+
+    msg_requestvote_response_t rvr = {};
+    rvr.term = 1;
+    rvr.vote_granted = 0;
+    rvr.prevote = 1;
+    raft_recv_requestvote_response(r, raft_get_node(r, 2), &rvr);
+    raft_recv_requestvote_response(r, raft_get_node(r, 3), &rvr);
+
+    CuAssertTrue(tc, raft_is_follower(r));
+    CuAssertIntEquals(tc, 1, raft_get_current_term(r));
+}
+
+void TestRaft_follower_rejects_prevote_while_leader_is_alive(CuTest * tc)
+{
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_set_election_timeout(r, 1000);
+
+    /* node 2 is leader */
+    msg_appendentries_t ae = {};
+    msg_appendentries_response_t aer;
+    ae.term = 1;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertTrue(tc, 1 == aer.success);
+
+    /* node 3 was cut off and thinks there's no leader */
+    msg_requestvote_t rv = {};
+    msg_requestvote_response_t rvr;
+    rv.term = 2;
+    rv.candidate_id = 3;
+    rv.prevote = 1;
+    raft_recv_requestvote(r, raft_get_node(r, 3), &rv, &rvr);
+    CuAssertIntEquals(tc, 0, rvr.vote_granted);
+    CuAssertIntEquals(tc, 1, rvr.prevote);
+    CuAssertIntEquals(tc, 1, raft_get_current_term(r));
+
+    /* we haven't heard from node 2 in a while either */
+    raft_set_prevote(r, 1);
+    raft_periodic(r, 1000);
+    raft_recv_requestvote(r, raft_get_node(r, 3), &rv, &rvr);
+    CuAssertIntEquals(tc, 1, rvr.vote_granted);
+
+    /* a pre-vote changes neither our term nor our vote */
+    CuAssertIntEquals(tc, 1, raft_get_current_term(r));
+    CuAssertIntEquals(tc, -1, raft_get_voted_for(r));
+}
+
+/** Make r, of three nodes, leader with an entry of its term committed */
+static void __leader_with_committed_entry(void* r)
+{
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    msg_entry_t mety = {};
+    msg_entry_response_t cr;
+    mety.id = 1;
+    raft_recv_entry(r, &mety, &cr);
+
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 1;
+    aer.sent_at = 0;
+    raft_recv_appendentries_response(r, raft_get_node(r, 2), &aer);
+}
+
+void TestRaft_leader_read_lease_runs_from_majority_acknowledgement(
+    CuTest * tc)
+{
+    void *r = raft_new();
+    raft_set_read_lease(r, 500);
+    raft_set_election_timeout(r, 1000);
+
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_become_leader(r);
+
+    /* we don't know what's committed until an entry of our term is */
+    CuAssertIntEquals(tc, 0, raft_read_lease_remaining(r));
+
+    raft_free(r);
+    r = raft_new();
+    raft_set_read_lease(r, 500);
+    raft_set_election_timeout(r, 1000);
+    __leader_with_committed_entry(r);
+    CuAssertIntEquals(tc, 1, raft_get_commit_idx(r));
+    CuAssertIntEquals(tc, 500, raft_read_lease_remaining(r));
+
+    raft_periodic(r, 300);
+    CuAssertIntEquals(tc, 200, raft_read_lease_remaining(r));
+
+    /* node 3 acknowledges a heartbeat sent just now */
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 2;
+    aer.sent_at = 300;
+    raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
+    CuAssertIntEquals(tc, 500, raft_read_lease_remaining(r));
+
+    raft_periodic(r, 500);
+    CuAssertIntEquals(tc, 0, raft_read_lease_remaining(r));
+}
+
+void TestRaft_leader_read_index_waits_for_heartbeats_sent_after_it(
+    CuTest * tc)
+{
+    void *r = raft_new();
+    __leader_with_committed_entry(r);
+
+    raft_read_index_t rd;
+    CuAssertIntEquals(tc, 0, raft_read_index_start(r, &rd));
+    CuAssertIntEquals(tc, 1, rd.idx);
+    CuAssertIntEquals(tc, 0, raft_read_index_ready(r, &rd));
+
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 2;
+
+    /* acknowledging a message sent before the read started proves nothing */
+    aer.read_seq = rd.seq;
+    raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
+    CuAssertIntEquals(tc, 0, raft_read_index_ready(r, &rd));
+
+    aer.read_seq = rd.seq + 1;
+    raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
+    CuAssertIntEquals(tc, 1, raft_read_index_ready(r, &rd));
+
+    /* a newer leader took over */
+    raft_become_follower(r);
+    CuAssertIntEquals(tc, -1, raft_read_index_ready(r, &rd));
+}
+
+void TestRaft_leader_read_index_leaves_the_clock_alone(CuTest * tc)
+{
+    void *r = raft_new();
+    raft_set_read_lease(r, 500);
+    raft_set_election_timeout(r, 1000);
+    __leader_with_committed_entry(r);
+
+    raft_read_index_t rd;
+    CuAssertIntEquals(tc, 0, raft_read_index_start(r, &rd));
+    CuAssertIntEquals(tc, 0, raft_read_index_start(r, &rd));
+
+    /* a heartbeat sent now, acknowledged after the reads started, still
+     * renews the whole lease */
+    msg_appendentries_response_t aer = {};
+    aer.term = 1;
+    aer.success = 1;
+    aer.current_idx = 1;
+    aer.first_idx = 2;
+    aer.sent_at = 0;
+    aer.read_seq = rd.seq + 1;
+    raft_recv_appendentries_response(r, raft_get_node(r, 3), &aer);
+    CuAssertIntEquals(tc, 500, raft_read_lease_remaining(r));
+    CuAssertIntEquals(tc, 1, raft_read_index_ready(r, &rd));
+}
+
+void TestRaft_follower_recv_appendentries_echoes_sent_at(CuTest * tc)
+{
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+
+    msg_appendentries_t ae = {};
+    msg_appendentries_response_t aer;
+    ae.term = 1;
+    ae.sent_at = 42;
+    ae.read_seq = 7;
+    raft_recv_appendentries(r, raft_get_node(r, 2), &ae, &aer);
+    CuAssertIntEquals(tc, 42, aer.sent_at);
+    CuAssertIntEquals(tc, 7, aer.read_seq);
+}
+
+static int __n_persists, __persisted_term, __persisted_vote;
+
+static int __persist_term_vote(raft_server_t* raft, void* udata,
+                               int term, int voted_for)
+{
+    __n_persists++;
+    __persisted_term = term;
+    __persisted_vote = voted_for;
+    return 0;
+}
+
+void TestRaft_server_become_candidate_persists_term_and_vote_at_once(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .persist_term_vote = __persist_term_vote,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+
+    __n_persists = 0;
+    raft_become_candidate(r);
+    CuAssertIntEquals(tc, 1, __n_persists);
+    CuAssertIntEquals(tc, 2, __persisted_term);
+    CuAssertIntEquals(tc, 1, __persisted_vote);
+}
+
+void TestRaft_server_recv_requestvote_of_newer_term_persists_term_and_vote_at_once(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .persist_term_vote = __persist_term_vote,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+    raft_vote_for_nodeid(r, 1);
+
+    msg_requestvote_t rv = {};
+    msg_requestvote_response_t rvr;
+    rv.term = 2;
+    rv.candidate_id = 2;
+    __n_persists = 0;
+    raft_recv_requestvote(r, raft_get_node(r, 2), &rv, &rvr);
+    CuAssertIntEquals(tc, 1, rvr.vote_granted);
+    CuAssertIntEquals(tc, 1, __n_persists);
+    CuAssertIntEquals(tc, 2, __persisted_term);
+    CuAssertIntEquals(tc, 2, __persisted_vote);
+
+    /* a refused vote still saves the new term, with the old vote reset */
+    rv.term = 3;
+    rv.last_log_term = -1;
+    rv.last_log_idx = -1;
+    raft_entry_t ety = {};
+    ety.term = 2;
+    ety.id = 1;
+    raft_append_entry(r, &ety);
+    __n_persists = 0;
+    raft_recv_requestvote(r, raft_get_node(r, 2), &rv, &rvr);
+    CuAssertIntEquals(tc, 0, rvr.vote_granted);
+    CuAssertIntEquals(tc, 1, __n_persists);
+    CuAssertIntEquals(tc, 3, __persisted_term);
+    CuAssertIntEquals(tc, -1, __persisted_vote);
+}
+
+static int __persist_term_vote_fails(raft_server_t* raft, void* udata,
+                                     int term, int voted_for)
+{
+    return -1;
+}
+
+void TestRaft_server_recv_requestvote_refuses_vote_it_cant_persist(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .persist_term_vote = __persist_term_vote_fails,
+    };
+
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, NULL);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_add_node(r, NULL, 3, 0);
+    raft_set_current_term(r, 1);
+    raft_set_election_timeout(r, 1000);
+    raft_periodic(r, 300);
+
+    msg_requestvote_t rv = {};
+    msg_requestvote_response_t rvr;
+    rv.term = 2;
+    rv.candidate_id = 2;
+    raft_recv_requestvote(r, raft_get_node(r, 2), &rv, &rvr);
+    CuAssertIntEquals(tc, 0, rvr.vote_granted);
+    CuAssertIntEquals(tc, -1, raft_get_voted_for(r));
+    CuAssertIntEquals(tc, 300, raft_get_timeout_elapsed(r));
+
+    /* nor is a vote in the current term granted unsaved */
+    rv.candidate_id = 3;
+    raft_recv_requestvote(r, raft_get_node(r, 3), &rv, &rvr);
+    CuAssertIntEquals(tc, 0, rvr.vote_granted);
+    CuAssertIntEquals(tc, -1, raft_get_voted_for(r));
+}
+
+void TestRaft_server_become_candidate_stands_down_if_it_cant_persist(
+    CuTest * tc)
+{
+    raft_cbs_t funcs = {
+        .persist_term_vote = __persist_term_vote_fails,
+        .send_requestvote = sender_requestvote,
+    };
+
+    void *sender = sender_new(NULL);
+    void *r = raft_new();
+    raft_set_callbacks(r, &funcs, sender);
+    raft_add_node(r, NULL, 1, 1);
+    raft_add_node(r, NULL, 2, 0);
+    raft_set_current_term(r, 1);
+
+    CuAssertIntEquals(tc, -1, raft_become_candidate(r));
+    CuAssertTrue(tc, raft_is_follower(r));
+    CuAssertIntEquals(tc, 1, raft_get_current_term(r));
+    CuAssertIntEquals(tc, -1, raft_get_voted_for(r));
+    CuAssertTrue(tc, NULL == sender_poll_msg_data(sender));
+}